@@ -0,0 +1,249 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include "glt/buffer_allocator.h"
+#include "glt/buffer_storage.h"
+
+/*
+ * Replays synthetic or recorded allocation traces against a BufferAllocator backed
+ * by host memory with each allocation strategy, reporting throughput, fragmentation
+ * and peak footprint. Recorded traces are those written by BufferAllocator::set_trace
+ */
+
+using namespace glt;
+
+enum class OpType { ALLOC, REALLOC, FREE };
+struct Op {
+	OpType type;
+	// Dense index of the allocation the op works on
+	uint32_t id;
+	size_t size, align;
+	BufferUsage usage;
+};
+struct Trace {
+	std::string name;
+	std::vector<Op> ops;
+	size_t max_ids;
+};
+
+// Parameters for generating a synthetic trace
+struct Workload {
+	const char *name;
+	size_t min_size, max_size;
+	// Chance of each op being a free or realloc instead of an alloc once there are live allocations
+	double free_chance, realloc_chance;
+	size_t max_live;
+	// Free the oldest allocation instead of a random one, like streaming in and out level data
+	bool fifo;
+};
+
+Trace generate_trace(const Workload &w, size_t num_ops, uint32_t seed){
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> unif(0, 1);
+	// Sizes are log-uniform so the small allocations common in practice dominate
+	const double log_min = std::log(static_cast<double>(w.min_size));
+	const double log_max = std::log(static_cast<double>(w.max_size));
+	auto rand_size = [&](){
+		return static_cast<size_t>(std::exp(log_min + unif(rng) * (log_max - log_min)));
+	};
+	Trace trace;
+	trace.name = w.name;
+	trace.ops.reserve(num_ops);
+	std::vector<uint32_t> live;
+	std::vector<size_t> sizes;
+	size_t fifo_head = 0;
+	for (size_t i = 0; i < num_ops; ++i){
+		const double r = unif(rng);
+		const size_t n_live = live.size() - fifo_head;
+		if (n_live != 0 && (n_live >= w.max_live || r < w.free_chance)){
+			size_t idx = fifo_head;
+			if (w.fifo){
+				++fifo_head;
+			}
+			else {
+				idx = fifo_head + rng() % n_live;
+				std::swap(live[idx], live.back());
+				idx = live.size() - 1;
+			}
+			trace.ops.push_back(Op { OpType::FREE, live[idx], 0, 0, BufferUsage::DYNAMIC });
+			if (!w.fifo){
+				live.pop_back();
+			}
+		}
+		else if (n_live != 0 && r < w.free_chance + w.realloc_chance){
+			const uint32_t id = live[fifo_head + rng() % n_live];
+			sizes[id] = std::min(sizes[id] + sizes[id] / 2 + 1, w.max_size * 4);
+			trace.ops.push_back(Op { OpType::REALLOC, id, sizes[id], 0, BufferUsage::DYNAMIC });
+		}
+		else {
+			const uint32_t id = static_cast<uint32_t>(sizes.size());
+			sizes.push_back(rand_size());
+			const size_t align = size_t{1} << (rng() % 9);
+			trace.ops.push_back(Op { OpType::ALLOC, id, sizes[id], align, BufferUsage::DYNAMIC });
+			live.push_back(id);
+		}
+	}
+	trace.max_ids = sizes.size();
+	return trace;
+}
+bool load_trace(const std::string &file, Trace &trace){
+	std::ifstream fin(file.c_str());
+	if (!fin){
+		std::cout << "Failed to open trace " << file << "\n";
+		return false;
+	}
+	trace.name = file;
+	// Map the ids recorded, which are only unique while the allocation is live, to dense indices
+	std::unordered_map<uint64_t, uint32_t> ids;
+	std::string line;
+	size_t line_num = 0;
+	while (std::getline(fin, line)){
+		++line_num;
+		std::istringstream ss(line);
+		char op = 0;
+		uint64_t id = 0;
+		ss >> op >> id;
+		if (op == 'a'){
+			size_t size = 0, align = 1;
+			int usage = 0;
+			ss >> size >> align >> usage;
+			const uint32_t dense = static_cast<uint32_t>(trace.max_ids++);
+			ids[id] = dense;
+			trace.ops.push_back(Op { OpType::ALLOC, dense, size, align, static_cast<BufferUsage>(usage) });
+			continue;
+		}
+		auto fnd = ids.find(id);
+		if (fnd == ids.end()){
+			std::cout << "Trace " << file << " line " << line_num << ": unknown allocation " << id << "\n";
+			return false;
+		}
+		const uint32_t dense = fnd->second;
+		if (op == 'r'){
+			size_t size = 0;
+			uint64_t new_id = 0;
+			ss >> size >> new_id;
+			ids.erase(fnd);
+			ids[new_id] = dense;
+			trace.ops.push_back(Op { OpType::REALLOC, dense, size, 0, BufferUsage::DYNAMIC });
+		}
+		else if (op == 'f'){
+			ids.erase(fnd);
+			trace.ops.push_back(Op { OpType::FREE, dense, 0, 0, BufferUsage::DYNAMIC });
+		}
+		else {
+			std::cout << "Trace " << file << " line " << line_num << ": unknown op " << op << "\n";
+			return false;
+		}
+	}
+	return true;
+}
+void replay(const Trace &trace, AllocStrategy strategy, const char *strategy_name, size_t capacity){
+	HostBufferStorage storage;
+	size_t buffers_created = 0, high_water = 0, free_bytes = 0, largest_free = 0;
+	double elapsed = 0;
+	{
+		BufferAllocator allocator(capacity, strategy, false, &storage);
+		std::vector<SubBuffer> subs(trace.max_ids);
+		using namespace std::chrono;
+		const auto start = high_resolution_clock::now();
+		for (size_t i = 0; i < trace.ops.size(); ++i){
+			const Op &op = trace.ops[i];
+			switch (op.type){
+				case OpType::ALLOC:
+					subs[op.id] = allocator.alloc(op.size, op.align, op.usage);
+					break;
+				case OpType::REALLOC:
+					allocator.realloc(subs[op.id], op.size);
+					break;
+				case OpType::FREE:
+					allocator.free(subs[op.id]);
+					break;
+			}
+			// Let empty buffers be released like they would be over frames in an application
+			if (i % 1024 == 1023){
+				allocator.end_frame();
+			}
+		}
+		elapsed = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+		for (size_t u = 0; u < BUFFER_USAGE_COUNT; ++u){
+			const PoolStats stats = allocator.pool_stats(static_cast<BufferUsage>(u));
+			buffers_created += stats.buffers_created;
+			high_water += stats.high_water;
+			free_bytes += stats.free_bytes;
+			largest_free = std::max(largest_free, stats.largest_free);
+		}
+	}
+	const double fragmentation = free_bytes == 0 ? 0 : 1.0 - static_cast<double>(largest_free) / free_bytes;
+	const double mb = 1024.0 * 1024.0;
+	std::cout << trace.name << "\t" << strategy_name << "\t" << trace.ops.size()
+		<< "\t" << trace.ops.size() / elapsed / 1e6 << "\t" << fragmentation
+		<< "\t" << high_water / mb << "\t" << storage.peak_bytes() / mb
+		<< "\t" << buffers_created << "\n";
+}
+
+int main(int argc, char **argv){
+	size_t num_ops = 1000000;
+	size_t capacity = 64 * 1024 * 1024;
+	uint32_t seed = 1;
+	std::vector<std::string> trace_files;
+	for (int i = 1; i < argc; ++i){
+		if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+			num_ops = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+			capacity = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc){
+			seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "-h") == 0){
+			std::cout << "Usage: " << argv[0] << " [-n ops] [-c buffer capacity] [-s seed] [trace files...]\n"
+				<< "Without trace files synthetic workloads of `ops` operations are run\n";
+			return 0;
+		}
+		else {
+			trace_files.push_back(argv[i]);
+		}
+	}
+	std::vector<Trace> traces;
+	if (trace_files.empty()){
+		const Workload workloads[] = {
+			{ "small_objects", 16, 512, 0.45, 0.05, 100000, false },
+			{ "mixed", 16, 256 * 1024, 0.45, 0.1, 20000, false },
+			{ "level_streaming", 64 * 1024, 4 * 1024 * 1024, 0.4, 0, 500, true },
+		};
+		for (const auto &w : workloads){
+			traces.push_back(generate_trace(w, num_ops, seed));
+		}
+	}
+	for (const auto &f : trace_files){
+		Trace t;
+		t.max_ids = 0;
+		if (!load_trace(f, t)){
+			return 1;
+		}
+		traces.push_back(std::move(t));
+	}
+	const std::pair<AllocStrategy, const char*> strategies[] = {
+		{ AllocStrategy::FIRST_FIT, "first_fit" },
+		{ AllocStrategy::TLSF, "tlsf" },
+		{ AllocStrategy::BUDDY, "buddy" },
+	};
+	std::cout << "trace\tstrategy\tops\tMops/s\tfragmentation\thigh_water_MB\tpeak_footprint_MB\tbuffers_created\n";
+	for (const auto &t : traces){
+		for (const auto &s : strategies){
+			replay(t, s.first, s.second, capacity);
+		}
+	}
+	return 0;
+}
+
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <vector>
+#include <array>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "glt/mesh_optimizer.h"
+
+/*
+ * Runs the mesh optimizations over a synthetic mesh with its triangles shuffled, like the
+ * arbitrary order indices come out of a model file in, reporting the vertex cache
+ * statistics and time taken after each stage
+ */
+
+using namespace glt;
+
+// Make a grid of n x n quads on a bumpy sphere-ish height field with interleaved
+// vec3 pos, vec3 normal, vec2 texcoord vertices and shuffled triangles
+void make_mesh(size_t n, uint32_t seed, std::vector<float> &verts, std::vector<GLuint> &indices){
+	verts.clear();
+	indices.clear();
+	for (size_t y = 0; y <= n; ++y){
+		for (size_t x = 0; x <= n; ++x){
+			const float u = static_cast<float>(x) / n, v = static_cast<float>(y) / n;
+			const float h = 0.1f * std::sin(u * 20.f) * std::cos(v * 20.f);
+			const float vert[8] = { u, v, h, 0, 0, 1, u, v };
+			verts.insert(verts.end(), vert, vert + 8);
+		}
+	}
+	std::vector<std::array<GLuint, 3>> tris;
+	for (size_t y = 0; y < n; ++y){
+		for (size_t x = 0; x < n; ++x){
+			const GLuint i = static_cast<GLuint>(y * (n + 1) + x);
+			tris.push_back({{ i, i + 1, static_cast<GLuint>(i + n + 2) }});
+			tris.push_back({{ i, static_cast<GLuint>(i + n + 2), static_cast<GLuint>(i + n + 1) }});
+		}
+	}
+	std::mt19937 rng(seed);
+	std::shuffle(tris.begin(), tris.end(), rng);
+	for (const auto &t : tris){
+		indices.insert(indices.end(), t.begin(), t.end());
+	}
+}
+
+int main(int argc, char **argv){
+	size_t n = 512;
+	size_t cache_size = VERTEX_CACHE_SIZE;
+	uint32_t seed = 1;
+	for (int i = 1; i < argc; ++i){
+		if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+			n = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+			cache_size = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc){
+			seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [-n grid size] [-c cache size] [-s seed]\n";
+			return argv[i] == std::string("-h") ? 0 : 1;
+		}
+	}
+	std::vector<float> verts;
+	std::vector<GLuint> indices;
+	make_mesh(n, seed, verts, indices);
+	const size_t n_verts = verts.size() / 8;
+
+	using namespace std::chrono;
+	auto elapsed_ms = [](high_resolution_clock::time_point start){
+		return duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - start).count();
+	};
+	std::cout << "stage\tacmr\tatvr\tms\n";
+	VertexCacheStats stats = analyze_vertex_cache(indices.data(), indices.size(), n_verts, cache_size);
+	std::cout << "shuffled\t" << stats.acmr() << "\t" << stats.atvr() << "\t0\n";
+
+	std::vector<GLuint> reordered(indices.size());
+	std::vector<size_t> clusters;
+	auto start = high_resolution_clock::now();
+	optimize_vertex_cache(reordered.data(), indices.data(), indices.size(), n_verts, cache_size, &clusters);
+	double ms = elapsed_ms(start);
+	stats = analyze_vertex_cache(reordered.data(), reordered.size(), n_verts, cache_size);
+	std::cout << "vertex_cache\t" << stats.acmr() << "\t" << stats.atvr() << "\t" << ms << "\n";
+
+	start = high_resolution_clock::now();
+	optimize_overdraw(reordered.data(), reordered.size(), verts.data(), 8, n_verts, clusters, cache_size);
+	ms = elapsed_ms(start);
+	stats = analyze_vertex_cache(reordered.data(), reordered.size(), n_verts, cache_size);
+	std::cout << "overdraw\t" << stats.acmr() << "\t" << stats.atvr() << "\t" << ms
+		<< "\t(" << clusters.size() << " clusters)\n";
+
+	start = high_resolution_clock::now();
+	optimize_vertex_fetch(verts.data(), 8, n_verts, reordered.data(), reordered.size());
+	ms = elapsed_ms(start);
+	stats = analyze_vertex_cache(reordered.data(), reordered.size(), n_verts, cache_size);
+	std::cout << "vertex_fetch\t" << stats.acmr() << "\t" << stats.atvr() << "\t" << ms << "\n";
+	return 0;
+}
+
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <tiny_obj_loader.h>
+#include "glt/obj_parser.h"
+
+/*
+ * Times tinyobj::LoadObj against load_obj with 1, 2, 4, ... threads up to the number of cores
+ * on an OBJ file, by default a synthetic grid mesh written out to a temporary file
+ */
+
+using namespace glt;
+
+// Write an n x n grid of quads split into `groups` groups with v/vt/vn faces
+void write_mesh(const std::string &file, size_t n, size_t groups){
+	std::ofstream fout(file.c_str());
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> height(-1.f, 1.f);
+	for (size_t y = 0; y <= n; ++y){
+		for (size_t x = 0; x <= n; ++x){
+			const float u = static_cast<float>(x) / n, v = static_cast<float>(y) / n;
+			fout << "v " << u * 100.f << " " << height(rng) << " " << v * 100.f << "\n"
+				<< "vt " << u << " " << v << "\n"
+				<< "vn 0 1 0\n";
+		}
+	}
+	for (size_t y = 0; y < n; ++y){
+		if (y % (n / groups + 1) == 0){
+			fout << "g group" << y << "\n";
+		}
+		for (size_t x = 0; x < n; ++x){
+			const size_t i = y * (n + 1) + x + 1;
+			const size_t quad[4] = { i, i + 1, i + n + 2, i + n + 1 };
+			fout << "f";
+			for (const auto &q : quad){
+				fout << " " << q << "/" << q << "/" << q;
+			}
+			fout << "\n";
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	size_t n = 1024;
+	size_t groups = 16;
+	std::string file;
+	for (int i = 1; i < argc; ++i){
+		if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+			n = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "-g") == 0 && i + 1 < argc){
+			groups = std::max<size_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+		}
+		else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+			file = argv[++i];
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [-n grid size] [-g groups] [-f obj file]\n";
+			return argv[i] == std::string("-h") ? 0 : 1;
+		}
+	}
+	const bool synthetic = file.empty();
+	if (synthetic){
+		file = "glt_bench_obj_parser.obj";
+		write_mesh(file, n, groups);
+	}
+
+	using namespace std::chrono;
+	auto elapsed_ms = [](high_resolution_clock::time_point start){
+		return duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - start).count();
+	};
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::cout << "parser\tthreads\tshapes\tindices\tms\n";
+	auto start = high_resolution_clock::now();
+	std::string err = tinyobj::LoadObj(shapes, materials, file.c_str());
+	double ms = elapsed_ms(start);
+	size_t indices = 0;
+	for (const auto &s : shapes){
+		indices += s.mesh.indices.size();
+	}
+	std::cout << "tinyobj\t1\t" << shapes.size() << "\t" << indices << "\t" << ms << "\n";
+
+	const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	for (size_t threads = 1;; threads = std::min(threads * 2, cores)){
+		start = high_resolution_clock::now();
+		err = load_obj(shapes, materials, file, "", threads);
+		ms = elapsed_ms(start);
+		if (!err.empty()){
+			std::cout << "load_obj error: " << err << "\n";
+			break;
+		}
+		indices = 0;
+		for (const auto &s : shapes){
+			indices += s.mesh.indices.size();
+		}
+		std::cout << "load_obj\t" << threads << "\t" << shapes.size() << "\t" << indices << "\t" << ms << "\n";
+		if (threads == cores){
+			break;
+		}
+	}
+	if (synthetic){
+		std::remove(file.c_str());
+	}
+	return 0;
+}
+
@@ -0,0 +1,203 @@
+#ifndef GLT_ALLOC_ENGINE_H
+#define GLT_ALLOC_ENGINE_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+ * The allocation engines manage the free space within a single Buffer. They only
+ * deal with offsets and sizes within [0, size) and never touch GL, so the Buffer
+ * can select whichever algorithm best suits the allocation pattern it will see
+ */
+namespace glt {
+// A block of memory in the buffer
+struct Block {
+	size_t offset, size;
+};
+
+/*
+ * The allocation algorithms available for managing a Buffer's free space
+ * FIRST_FIT: linear first-fit walk over an ordered free list, O(n) alloc, O(log n) free
+ * TLSF: two-level segregated fit, O(1) alloc and free with immediate coalescing
+ * 		of physical neighbours through boundary tags
+ * BUDDY: binary buddy allocator, O(log n) alloc and free, allocations are rounded
+ * 		up to power of two blocks
+ */
+enum class AllocStrategy { FIRST_FIT, TLSF, BUDDY };
+
+/*
+ * Interface implemented by the allocation engines
+ */
+class AllocEngine {
+public:
+	virtual ~AllocEngine(){}
+	/*
+	 * Allocate a block of at least sz bytes with an offset aligned to align,
+	 * returns true and sets offset if the request could be satisfied
+	 */
+	virtual bool alloc(size_t sz, size_t align, size_t &offset) = 0;
+	/*
+	 * Try to grow the allocation at offset to new_sz bytes without moving it,
+	 * returns true if the allocation now has room for new_sz bytes
+	 */
+	virtual bool grow(size_t offset, size_t new_sz) = 0;
+	/*
+	 * Try to grow the allocation at offset to new_sz bytes by also taking the free space
+	 * directly before it (and after it, if needed), keeping the new start aligned to align
+	 * and at least min_shift bytes before the old one. Returns true and sets new_offset to the
+	 * allocation's new start if it could grow, the caller must then move the data down to
+	 * new_offset
+	 */
+	virtual bool grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset) = 0;
+	/*
+	 * Cut the end off the allocation at offset so it's new_sz bytes long. The space cut off
+	 * becomes one or more separate allocations which are appended to tails for the caller
+	 * to free. Returns false if nothing could be cut off
+	 */
+	virtual bool split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails) = 0;
+	/*
+	 * Release the allocation at offset, merging it with neighboring free space
+	 */
+	virtual void free(size_t offset) = 0;
+	/*
+	 * Get the number of bytes not currently allocated
+	 */
+	virtual size_t free_bytes() const = 0;
+	/*
+	 * Get the size of the largest free block, the largest allocation that could succeed
+	 * ignoring alignment
+	 */
+	virtual size_t largest_free() const = 0;
+	/*
+	 * Get the allocations currently live in the engine. Each block's offset is the one
+	 * handed out by alloc and its size is the space available to the allocation,
+	 * which can be larger than requested for engines that round up allocations
+	 */
+	virtual void used_blocks(std::vector<Block> &blocks) const = 0;
+	/*
+	 * Print out the engine's free and used blocks for debugging
+	 */
+	virtual void print(std::ostream &os) const = 0;
+};
+/*
+ * Create an allocation engine using the strategy to manage a region of size bytes
+ */
+std::unique_ptr<AllocEngine> make_alloc_engine(AllocStrategy strategy, size_t size);
+/*
+ * Get the smallest region an engine using the strategy needs to be created with
+ * to be guaranteed to satisfy an allocation of sz bytes aligned to align
+ */
+size_t min_region_size(AllocStrategy strategy, size_t sz, size_t align);
+
+/*
+ * First-fit allocation over ordered maps of free and used blocks
+ */
+class FirstFitEngine : public AllocEngine {
+	std::map<size_t, Block> freeb, used;
+	size_t total_free;
+
+public:
+	FirstFitEngine(size_t size);
+	bool alloc(size_t sz, size_t align, size_t &offset) override;
+	bool grow(size_t offset, size_t new_sz) override;
+	bool grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset) override;
+	bool split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails) override;
+	void free(size_t offset) override;
+	size_t free_bytes() const override;
+	size_t largest_free() const override;
+	void used_blocks(std::vector<Block> &blocks) const override;
+	void print(std::ostream &os) const override;
+};
+
+/*
+ * Two-level segregated fit allocator. Free blocks are binned by the position of their
+ * highest set bit (first level) and the next SL_LOG2 bits (second level), with bitmaps
+ * tracking which bins are non-empty so a suitable bin is found with two bit scans.
+ * Each block keeps links to its physical neighbours so freeing can merge in O(1)
+ */
+class TLSFEngine : public AllocEngine {
+	static const uint32_t NIL = ~0u;
+	static const int SL_LOG2 = 4;
+	static const int SL_COUNT = 1 << SL_LOG2;
+	static const int FL_COUNT = 64 - SL_LOG2 + 1;
+
+	struct Node {
+		size_t offset, size;
+		// Physical neighbours in the buffer (boundary tags) and free list links
+		uint32_t prev_phys, next_phys, prev_free, next_free;
+		bool free;
+	};
+	// Nodes are referenced by index so the table can grow without invalidating links
+	std::vector<Node> nodes;
+	std::vector<uint32_t> unused_nodes;
+	std::unordered_map<size_t, uint32_t> used;
+	uint64_t fl_bitmap;
+	uint32_t sl_bitmap[FL_COUNT];
+	uint32_t heads[FL_COUNT][SL_COUNT];
+	size_t total_free;
+
+public:
+	TLSFEngine(size_t size);
+	bool alloc(size_t sz, size_t align, size_t &offset) override;
+	bool grow(size_t offset, size_t new_sz) override;
+	bool grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset) override;
+	bool split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails) override;
+	void free(size_t offset) override;
+	size_t free_bytes() const override;
+	size_t largest_free() const override;
+	void used_blocks(std::vector<Block> &blocks) const override;
+	void print(std::ostream &os) const override;
+
+private:
+	uint32_t new_node();
+	void release_node(uint32_t n);
+	// Split the node so it's sz bytes long, returning the node for the remainder
+	uint32_t split(uint32_t n, size_t sz);
+	// Merge the node b into its physical predecessor a
+	void absorb(uint32_t a, uint32_t b);
+	void insert_free(uint32_t n);
+	void remove_free(uint32_t n);
+	uint32_t find_suitable(int fl, int sl) const;
+};
+
+/*
+ * Binary buddy allocator. The region is decomposed into power of two blocks of at
+ * least MIN_BLOCK bytes, allocations split blocks down to the smallest order that fits
+ * and freeing merges blocks back together with their buddy while it's also free
+ */
+class BuddyEngine : public AllocEngine {
+	static const size_t MIN_BLOCK = 16;
+
+	struct Alloc {
+		size_t block;
+		int order;
+	};
+	// Free block offsets for each order, a block of order k is MIN_BLOCK << k bytes
+	std::vector<std::unordered_set<size_t>> free_lists;
+	// Allocations keyed by the offset handed out, which may be past the block's
+	// start if the alignment requested wasn't a power of two
+	std::unordered_map<size_t, Alloc> used;
+	size_t total_free;
+
+public:
+	BuddyEngine(size_t size);
+	bool alloc(size_t sz, size_t align, size_t &offset) override;
+	bool grow(size_t offset, size_t new_sz) override;
+	bool grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset) override;
+	bool split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails) override;
+	void free(size_t offset) override;
+	size_t free_bytes() const override;
+	size_t largest_free() const override;
+	void used_blocks(std::vector<Block> &blocks) const override;
+	void print(std::ostream &os) const override;
+};
+}
+std::ostream& operator<<(std::ostream &os, const glt::Block &b);
+
+#endif
+
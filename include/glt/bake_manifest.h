@@ -0,0 +1,36 @@
+#ifndef GLT_BAKE_MANIFEST_H
+#define GLT_BAKE_MANIFEST_H
+
+#include <string>
+#include <vector>
+
+namespace glt {
+/*
+ * A source asset and the baked file made from it, as listed in a manifest written by glt_bake
+ */
+struct BakeEntry {
+	std::string source, baked;
+};
+/*
+ * Write the manifest listing the baked files. Paths are stored relative to the manifest's
+ * directory if they're under it so the baked tree can be moved along with its sources.
+ * Returns false and prints an error if the manifest couldn't be written
+ */
+bool write_bake_manifest(const std::string &manifest_file, const std::vector<BakeEntry> &entries);
+/*
+ * Read the manifest and register its baked files so the model and texture loaders map them
+ * instead of parsing and decoding the sources they were baked from. Sources are matched by
+ * path, so the manifest should be loaded from the same directory the assets are loaded from,
+ * eg. get_resource_path() + "bake_manifest.txt". Baked files are still checked against their
+ * source when opened and ignored if it's changed since baking.
+ * Returns false and prints an error if the manifest couldn't be read
+ */
+bool load_bake_manifest(const std::string &manifest_file);
+/*
+ * Get the baked file registered for the source file, or an empty string if there isn't one
+ */
+std::string baked_file(const std::string &source_file);
+}
+
+#endif
+
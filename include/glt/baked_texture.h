@@ -0,0 +1,71 @@
+#ifndef GLT_BAKED_TEXTURE_H
+#define GLT_BAKED_TEXTURE_H
+
+#include <cstdint>
+#include <string>
+#include "gl_core_4_5.h"
+#include "mapped_file.h"
+
+namespace glt {
+/*
+ * A mip level of a baked texture, size is the number of bytes of data
+ */
+struct TextureLevel {
+	const char *data;
+	size_t size;
+	int width, height;
+};
+/*
+ * Number of levels in the full mip chain of a width x height image, down to 1x1
+ */
+int mip_levels(int width, int height);
+/*
+ * Get the path an image is baked to by default, next to the image
+ */
+std::string baked_texture_path(const std::string &image_file);
+/*
+ * Decode the image, flip it so it's right side up for GL and build its full mip chain
+ * with a box filter. If `compress` is set 1 and 2 channel images are stored as RGTC1 and
+ * RGTC2, which halve their size for red and quarter it for red-green images. Writes the
+ * baked texture to out_file, or baked_texture_path if none is given. Doesn't need a GL
+ * context, returns false and prints an error if baking failed
+ */
+bool bake_texture(const std::string &image_file, bool compress, const std::string &out_file = "");
+
+/*
+ * An image baked by bake_texture, in a versioned binary format which can be memory mapped and
+ * uploaded level by level without decoding or generating mips. As with the geometry cache
+ * it's keyed by the image's size, modification time and a hash of its contents and is out
+ * of date if they've changed
+ */
+class BakedTexture {
+	MappedFile mapping;
+
+public:
+	/*
+	 * Map the baked texture registered for the image by a bake manifest (see bake_manifest.h)
+	 * or at baked_texture_path, returning false if there isn't an up to date one
+	 */
+	bool open(const std::string &image_file);
+	bool is_open() const;
+	int width() const;
+	int height() const;
+	int channels() const;
+	int levels() const;
+	// Check if the levels are compressed and must be uploaded with glCompressedTexSubImage*
+	bool compressed() const;
+	// The sized internal format to allocate storage for the texture with
+	GLenum internal_format() const;
+	// The pixel format of the levels if they're uncompressed, their type is GL_UNSIGNED_BYTE
+	GLenum format() const;
+	TextureLevel level(int i) const;
+
+private:
+	// Check the mapped file is a valid baked texture of the image, setting touched if the image's
+	// modification time has changed but its contents haven't
+	bool validate(const std::string &image_file, bool &touched);
+};
+}
+
+#endif
+
@@ -0,0 +1,77 @@
+#ifndef GLT_BOUNDED_QUEUE_H
+#define GLT_BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace glt {
+/*
+ * A FIFO queue between pipeline stages holding at most `capacity` items, so a fast producer
+ * blocks instead of running arbitrarily far ahead of its consumer. Once closed pushes fail
+ * and pops drain the remaining items, then fail
+ */
+template<typename T>
+class BoundedQueue {
+	std::mutex lock;
+	std::condition_variable not_empty, not_full;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed;
+
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity == 0 ? 1 : capacity), closed(false){}
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+	// Push the item, blocking while the queue is full. Returns false if the queue was closed
+	bool push(T item){
+		std::unique_lock<std::mutex> l(lock);
+		not_full.wait(l, [&](){ return closed || items.size() < capacity; });
+		if (closed){
+			return false;
+		}
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+		return true;
+	}
+	// Pop the next item, blocking until there is one. Returns false if the queue is closed and empty
+	bool pop(T &item){
+		std::unique_lock<std::mutex> l(lock);
+		not_empty.wait(l, [&](){ return closed || !items.empty(); });
+		return take(item);
+	}
+	// Pop the next item, waiting up to `timeout` for one. Returns false if there wasn't one
+	template<typename Rep, typename Period>
+	bool pop_for(T &item, const std::chrono::duration<Rep, Period> &timeout){
+		std::unique_lock<std::mutex> l(lock);
+		not_empty.wait_for(l, timeout, [&](){ return closed || !items.empty(); });
+		return take(item);
+	}
+	// Close the queue, waking any blocked producers and consumers
+	void close(){
+		std::lock_guard<std::mutex> l(lock);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+	size_t size(){
+		std::lock_guard<std::mutex> l(lock);
+		return items.size();
+	}
+
+private:
+	bool take(T &item){
+		if (items.empty()){
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+};
+}
+
+#endif
+
@@ -1,10 +1,23 @@
 #ifndef GLT_BUFFER_ALLOCATOR_H
 #define GLT_BUFFER_ALLOCATOR_H
 
+#include <cstdint>
 #include <vector>
-#include <map>
+#include <deque>
+#include <list>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <atomic>
 #include <iterator>
 #include "gl_core_4_5.h"
+#include "alloc_engine.h"
+#include "buffer_storage.h"
 
 namespace glt {
 	class Buffer;
@@ -15,72 +28,536 @@ std::ostream& operator<<(std::ostream &os, const glt::Buffer &b);
 std::ostream& operator<<(std::ostream &os, const glt::BufferAllocator &b);
 
 namespace glt {
+/*
+ * Alignment classes the BufferAllocator segregates its allocations into, so padding skipped
+ * to align ranges bound as uniform or storage buffers doesn't litter the buffers holding
+ * tightly packed vertex and index data with unusable slivers, and vice versa
+ * PACKED: allocations aligned to at most PACKED_ALIGN bytes, e.g. vertex, index and indirect data
+ * ALIGNED: more strictly aligned allocations, e.g. uniform, storage and texture buffer ranges.
+ * 		Their blocks are rounded up to a multiple of their alignment so the next one
+ * 		starts aligned without any padding
+ */
+enum class AlignClass { PACKED, ALIGNED };
+const size_t ALIGN_CLASS_COUNT = 2;
+const size_t PACKED_ALIGN = 16;
+// Get the alignment class for allocations with some alignment
+AlignClass align_class(size_t align);
+
 // An allocated sub buffer within some large buffer
 struct SubBuffer {
 	size_t offset, size;
 	GLuint buffer;
+	// Start of the parent buffer's persistent mapping, or null if the
+	// parent isn't persistently mapped
+	char *mapping;
+	// If the persistent mapping is coherent, if not writes must be flushed
+	bool coherent;
 
-	SubBuffer(size_t offset = 0, size_t size = 0, GLuint buf = 0);
-	// Map this sub buffer and return a pointer to the mapped range
-	void* map(GLenum target, GLenum access);
-	// Unamp this sub buffer
-	void unmap(GLenum target);
+	SubBuffer(size_t offset = 0, size_t size = 0, GLuint buf = 0, char *mapping = nullptr,
+			bool coherent = false);
+	// Map this sub buffer and return a pointer to the mapped range. If the parent
+	// buffer is persistently mapped this just returns a pointer into that mapping
+	void* map(GLenum target, GLenum access) const;
+	// Unamp this sub buffer. If the parent buffer is persistently mapped the
+	// sub buffer stays mapped and its range is flushed if the mapping isn't coherent
+	void unmap(GLenum target) const;
+	// Flush writes to a range of a persistently mapped, non-coherent sub buffer. The
+	// offset is relative to the start of the sub buffer and a size of 0 flushes to the end
+	void flush(size_t flush_offset = 0, size_t flush_size = 0) const;
 };
+// Enqueue a device-side copy of src.size bytes from src into dst
+void copy_sub_buffer(const SubBuffer &src, const SubBuffer &dst);
 
-// A block of memory in the buffer
-struct Block {
-	size_t offset, size;
-};
-
-// A large buffer that can hand out sub buffers to satisfy allocation requests
+// A large buffer that can hand out sub buffers to satisfy allocation requests. Buffers
+// aren't synchronised themselves, those owned by a BufferAllocator are guarded by its lock
 class Buffer {
 	size_t size;
 	GLuint buffer;
-	std::map<size_t, Block> freeb, used;
+	std::unique_ptr<AllocEngine> engine;
+	// Persistent mapping of the entire buffer, kept for the buffer's lifetime
+	char *mapping;
+	bool coherent;
+	BufferUsage usage_hint;
+	// Number of live sub buffers and frames the buffer has been empty for
+	size_t live, idle_frames;
+	BufferStorage *storage;
+	// Alignment class of the allocations the BufferAllocator is placing in this buffer
+	AlignClass arena;
 
+	friend class BufferAllocator;
 	friend std::ostream& ::operator<<(std::ostream &os, const glt::Buffer &b);
 public:
-	// Allocate a buffer with some capacity
-	Buffer(size_t size);
+	// Allocate a buffer with some capacity, using the allocation strategy to manage its free space.
+	// On GL 4.4+ the buffer is persistently mapped, optionally with a coherent mapping, unless
+	// its usage is STATIC in which case it's not mappable. The data store is made by the storage
+	// backend passed, or a GL buffer if it's null
+	Buffer(size_t size, AllocStrategy strategy = AllocStrategy::FIRST_FIT, bool coherent = false,
+			BufferUsage usage = BufferUsage::DYNAMIC, BufferStorage *storage = nullptr);
 	Buffer(const Buffer&) = delete;
 	Buffer& operator=(const Buffer&) = delete;
 	Buffer(Buffer &&b);
+	Buffer& operator=(Buffer &&b);
 	~Buffer();
 	// Check if the sub buffer was allocated from this block's data store
-	bool contains(SubBuffer &b) const;
+	bool contains(const SubBuffer &b) const;
 	// Allocate a sub buffer with some capacity, returns
 	// true if the buffer was able to satisfy the request
 	bool alloc(size_t sz, SubBuffer &buf, size_t align = 1);
+	// Try to expand a sub buffer allocated in this buffer to some new (larger) capacity
+	// without moving it, returns true if the sub buffer was expanded
+	bool grow(SubBuffer &b, size_t new_sz);
+	// Try to expand a sub buffer to some new (larger) capacity by also taking the free space
+	// directly before it, moving its data down with device-side copies. Returns true if the
+	// sub buffer was expanded
+	bool grow_back(SubBuffer &b, size_t new_sz, size_t align = 1);
+	// Shrink a sub buffer to new_sz bytes, giving the space cut off its end back to the buffer.
+	// Returns true if any space was given back
+	bool shrink(SubBuffer &b, size_t new_sz);
 	// Reallocate a sub buffer to some new (larger) capacity, returns true if the
 	// buffer was able to meet the request. The buffer be realloc'd should
 	// be one allocated in this buffer
 	bool realloc(SubBuffer &b, size_t new_sz);
 	// Free the block used by the sub buffer and merge and neighboring free blocks
 	void free(SubBuffer &buf);
+	// Get the capacity of the buffer
+	size_t capacity() const;
+	// Get the number of bytes in the buffer not currently allocated
+	size_t free_bytes() const;
+	// Get the size of the largest free block in the buffer
+	size_t largest_free_block() const;
+	// Check if there are no sub buffers allocated from this buffer
+	bool empty() const;
+	// Get the usage the buffer's storage was created for
+	BufferUsage usage() const;
+	// Get the free bytes in gaps between allocations smaller than min_gap, which
+	// are left behind by aligning allocations and are too small to be useful
+	size_t padding_bytes(size_t min_gap) const;
+};
+
+// Number of buckets in the alloc latency histograms, bucket i counts calls which took
+// under 2^(i + 7) ns (so the first is < 128ns), the last bucket counts all slower calls
+const size_t LATENCY_BUCKETS = 16;
+
+// Statistics for the buffers of one alignment class within a pool
+struct ArenaStats {
+	size_t buffers, capacity, free_bytes;
+	// Free bytes lost to alignment padding, in gaps too small for an allocation of the class
+	size_t padding;
+
+	ArenaStats();
+};
+
+// Statistics for the buffers the allocator has created for some usage
+struct PoolStats {
+	size_t buffers, capacity, free_bytes;
+	// Largest free block in any of the pool's buffers and the most bytes the pool has had in use
+	size_t largest_free, high_water;
+	size_t allocs, reallocs, frees, buffers_created;
+	// Sub buffers evicted to host memory to stay within the budget and restored from it
+	size_t evictions, restores;
+	size_t alloc_latency[LATENCY_BUCKETS];
+	// Breakdown of the pool's buffers by the alignment class they hold
+	ArenaStats arenas[ALIGN_CLASS_COUNT];
+
+	PoolStats();
+	// Get the bytes in use in the pool's buffers
+	size_t used_bytes() const;
+	// Get the fraction of free space that's unusable for an allocation the size of all the free
+	// space, 0 when it's all in one block and approaching 1 as it's split into small pieces
+	double fragmentation() const;
+};
+
+// How BufferAllocator::realloc resizes sub buffers
+struct ReallocPolicy {
+	// Give the space cut off the end of a sub buffer back when it's shrunk
+	bool shrink;
+	// Let sub buffers grow into free space directly before them, moving the data down
+	// within the buffer instead of copying it to a new block
+	bool grow_backward;
+	// Factor to grow the capacity of a sub buffer by when it has to grow, so N appends only
+	// move the data O(log N) times. Sub buffers are also only shrunk once they'd be this much
+	// larger than needed, so shrinking and growing again doesn't thrash. 1 grows to exactly
+	// the size requested
+	double growth_factor;
+
+	// The default policy shrinks and grows backward with no over-allocation
+	ReallocPolicy();
+};
+
+// A stable handle to a sub buffer allocated through the BufferAllocator's handle API,
+// the handle stays valid if the sub buffer is moved by realloc or defragmentation
+typedef uint32_t BufferHandle;
+const BufferHandle INVALID_HANDLE = ~0u;
+
+// An entry in the handle table as laid out when uploaded for use on the GPU,
+// matches a std430 uvec4 so shaders can resolve a handle with a single index
+struct HandleEntry {
+	GLuint offset, size, buffer, pad;
 };
 
 // A buffer allocator that will use Buffers to meet allocation requests. If the allocator
-// runs out of free space in its buffers it will allocate another to meet demand
+// runs out of free space in its buffers it will allocate another to meet demand.
+// Each buffer holds allocations of a single usage and alignment class, empty buffers
+// are picked up by whichever alignment class next needs room.
+// The allocator's bookkeeping is guarded by a lock so alloc, realloc, free, upload and the
+// handle API can be called from worker threads. GL work they need (creating buffers and
+// enqueuing copies) is handed to the thread the allocator was created on, which must
+// call run_gl_tasks or end_frame regularly. end_frame, defragment and handle_table
+// make GL calls directly so should only be called on the GL thread
 class BufferAllocator {
+	// Sub buffers freed during a frame, released once the fence after the frame has passed
+	struct RetireList {
+		GLsync fence;
+		std::vector<SubBuffer> buffers;
+	};
 	size_t capacity;
+	AllocStrategy strategy;
+	bool coherent;
+	// Atomic so ThreadAllocCache can check it on its free path without taking the lock
+	std::atomic<bool> deferred_free;
+	// Number of frames an empty buffer must stay empty before it's released
+	size_t release_delay;
+	BufferStorage *storage;
 	std::vector<Buffer> buffers;
+	// Index of each buffer in `buffers`, keyed by GL buffer name
+	std::unordered_map<GLuint, size_t> buffer_index;
+	std::vector<SubBuffer> pending;
+	std::deque<RetireList> retired;
+	std::function<void(const SubBuffer&, const SubBuffer&)> relocate;
+	// The dense handle table, unused slots in it and the handle owning each
+	// allocation, keyed by buffer name and offset. A deque so references returned
+	// by get stay valid while other threads add handles
+	std::deque<SubBuffer> handles;
+	std::vector<BufferHandle> free_handles;
+	std::unordered_map<uint64_t, BufferHandle> handle_owners;
+	// GPU copies of the handle table, used in turn when the table changes so rewriting it doesn't
+	// race with draws from earlier frames still reading the last one. Each copy is fenced when
+	// the next is handed out and the fence waited on before it's rewritten
+	static const size_t TABLE_COPIES = 3;
+	std::unique_ptr<Buffer> table_buffer;
+	SubBuffer table_copies[TABLE_COPIES];
+	GLsync table_fences[TABLE_COPIES];
+	size_t table_copy;
+	SubBuffer table;
+	bool table_dirty;
+	// Allocation counters for each usage pool and the most bytes in use across all of them
+	PoolStats pools[BUFFER_USAGE_COUNT];
+	size_t high_water;
+	ReallocPolicy realloc_policy;
+	// Offset alignment required by each buffer binding target, queried on first use
+	std::unordered_map<GLenum, size_t> target_align;
+	// Most bytes of buffers the allocator may have at once, or 0 if it's unlimited
+	size_t budget;
+	// Host copies of evicted sub buffers and what they need to be restored
+	struct Shadow {
+		std::vector<char> data;
+		size_t align;
+		BufferUsage usage;
+	};
+	std::unordered_map<BufferHandle, Shadow> evicted;
+	// Evictable handles from least to most recently used, and each one's place in the list
+	std::list<BufferHandle> lru;
+	std::unordered_map<BufferHandle, std::list<BufferHandle>::iterator> lru_pos;
+	std::function<void(BufferHandle, const SubBuffer&)> restored;
+	// Debugging tags for allocations, keyed by buffer name and offset, and the buffers
+	// whose GL label needs to be updated to reflect a change in their tags
+	struct Tag {
+		std::string name;
+		size_t size;
+	};
+	std::unordered_map<uint64_t, Tag> tags;
+	std::unordered_set<GLuint> relabel;
+	// Sub buffers being moved by a realloc which may drop the lock before the copy has run and
+	// those handed out by alloc_batch, keyed by buffer name and offset. Defragment leaves these
+	// where they are
+	std::unordered_multiset<uint64_t> pinned;
+	// Stream to record the alloc, realloc and free calls made to, if any
+	std::ostream *trace;
+	// Guards all the state above. Recursive so relocation callbacks run by defragment
+	// can call back into the allocator
+	mutable std::recursive_mutex lock;
+	// The thread with the GL context and the GL work queued for it by other threads
+	std::thread::id gl_thread;
+	std::mutex task_lock;
+	std::deque<std::packaged_task<void()>> gl_tasks;
 
 	friend std::ostream& ::operator<<(std::ostream &os, const glt::BufferAllocator &b);
 public:
-	// Create a buffer allocator which will allocate memory in chunks of `capacity`
-	BufferAllocator(size_t capacity);
+	// Create a buffer allocator which will allocate memory in chunks of `capacity`, each
+	// managing its free space with the allocation strategy passed and persistently
+	// mapped with a coherent mapping if `coherent` is set. Must be created on the GL thread.
+	// Buffers are made with the storage backend passed, or as GL buffers if it's null
+	BufferAllocator(size_t capacity, AllocStrategy strategy = AllocStrategy::FIRST_FIT,
+			bool coherent = false, BufferStorage *storage = nullptr);
+	BufferAllocator(const BufferAllocator&) = delete;
+	BufferAllocator& operator=(const BufferAllocator&) = delete;
+	~BufferAllocator();
 	// Allocate a sub buffer of some size within some free space in the allocator's buffers
-	SubBuffer alloc(size_t sz, size_t align = 1);
-	// Reallocate a sub buffer to some new (larger) capacity. If there's enough room after
-	// the buffer in the parent it will simply be expanded otherwise the data
-	// may be moved within the parent or to a new buffer in the allocator
+	// created for the usage passed. STATIC sub buffers can't be mapped and should be filled with upload.
+	// If the allocation would put the allocator over its budget and evicting sub buffers
+	// doesn't make room an empty sub buffer is returned
+	SubBuffer alloc(size_t sz, size_t align = 1, BufferUsage usage = BufferUsage::DYNAMIC);
+	// Allocate a sub buffer to be bound to some buffer binding target (e.g. GL_UNIFORM_BUFFER),
+	// aligned to the offset alignment the target requires
+	SubBuffer alloc_for(GLenum target, size_t sz, BufferUsage usage = BufferUsage::DYNAMIC);
+	// Get the offset alignment required for ranges bound to the target. The GL limit is
+	// only queried the first time each target is asked for
+	size_t target_alignment(GLenum target);
+	// Allocate n sub buffers of sz bytes each, appending them to out. The lock is only
+	// taken once so this is used by ThreadAllocCache to refill its magazines. Stops at the
+	// first allocation that fails, so fewer than n may be appended. The sub buffers are pinned
+	// so defragment won't move them while they sit in a magazine, where the relocation callback
+	// can't reach them, until they're returned with free_batch
+	void alloc_batch(size_t n, size_t sz, size_t align, BufferUsage usage, std::vector<SubBuffer> &out);
+	// Reallocate a sub buffer to some new capacity. If there's enough room after (or, depending
+	// on the realloc policy, before) the buffer in the parent it will simply be expanded
+	// otherwise the data may be moved within the parent or to a new buffer in the allocator.
+	// Shrinking gives the space cut off back to the parent if the policy allows. The sub buffer's
+	// size is new_sz either way, any capacity over-allocated by the policy's growth factor is
+	// only kept in its block so growing into it later happens in place
 	void realloc(SubBuffer &b, size_t new_sz);
-	// Free the sub buffer so that the used space may be re-used
+	// Shrink a sub buffer to exactly new_sz bytes, giving everything past it back to the parent
+	// whatever the realloc policy. For trimming a sub buffer once its final size is known
+	void trim(SubBuffer &b, size_t new_sz);
+	// Set the policy used to shrink and grow sub buffers in realloc
+	void set_realloc_policy(const ReallocPolicy &policy);
+	// Free the sub buffer so that the used space may be re-used. If deferred freeing is
+	// enabled the space is only re-used once the GPU has finished the frame it was freed in
 	void free(SubBuffer &buf);
+	// Free n sub buffers, taking the lock once. Sub buffers from alloc_batch are unpinned
+	void free_batch(size_t n, SubBuffer *bufs);
+	// Enable or disable deferred freeing. When enabled freed sub buffers are held in a
+	// per-frame retire list and only returned to their buffer once a fence inserted at
+	// the end of the frame has signaled, so the GPU can't still be reading the space when
+	// it's handed out again. Sub buffers moved by realloc are released the same way
+	void set_deferred_free(bool deferred);
+	// Check if deferred freeing is enabled
+	bool deferred_freeing() const;
+	// Mark the end of a frame, fencing the sub buffers freed during it and releasing
+	// those from earlier frames the GPU has completed. Buffers that have been empty for
+	// longer than the release delay are also released back to GL. Never blocks on the GPU
+	void end_frame();
+	// Set the callback to be informed when defragment moves a sub buffer, the callback
+	// is passed the old sub buffer and the new one its data has been moved to. Owners
+	// should match the old sub buffer by its buffer and offset
+	void set_relocation_callback(const std::function<void(const SubBuffer&, const SubBuffer&)> &callback);
+	// Run an incremental defragmentation pass, moving live sub buffers out of the least
+	// occupied buffer into the others (or towards the front of the buffer if it's the
+	// only one in use) with device-side copies so that it can be released. Stops once
+	// `byte_budget` bytes have been moved or `time_budget_ms` has elapsed (if non-zero).
+	// Returns the number of bytes moved. Sub buffers moved are freed through free so
+	// this should be used with deferred freeing enabled
+	size_t defragment(size_t byte_budget, double time_budget_ms = 0);
+	// Set how many frames a buffer must be empty for before it's released, one empty
+	// buffer is always kept around as a spare so bursts don't thrash buffer creation
+	void set_release_delay(size_t frames);
+	// Allocate a sub buffer and return a stable handle to it. The sub buffer's current
+	// location is looked up through the handle and is kept up to date if it's moved.
+	// Returns INVALID_HANDLE if the allocation doesn't fit in the budget
+	BufferHandle alloc_handle(size_t sz, size_t align = 1, BufferUsage usage = BufferUsage::DYNAMIC);
+	// Get the sub buffer currently referred to by the handle
+	const SubBuffer& get(BufferHandle h) const;
+	// Reallocate the sub buffer referred to by the handle, the handle remains valid
+	void realloc(BufferHandle h, size_t new_sz);
+	// Free the sub buffer referred to by the handle, the handle may be re-used after
+	void free(BufferHandle h);
+	// Limit the allocator to `bytes` bytes of buffers, 0 removes the limit. When an allocation
+	// needs a new buffer that would go over the budget, empty buffers other than the spare
+	// kept for each usage are released and evictable sub buffers are evicted to host memory,
+	// least recently used first, until it fits. The spares are only released once there's
+	// nothing left to evict, and nothing is evicted if it could never make enough room. The
+	// budget only stops new buffers being made, it won't release any that are already in use
+	void set_budget(size_t bytes);
+	// Get the bytes of buffers the allocator currently has
+	size_t allocated_bytes() const;
+	// Mark the handle's sub buffer as one that may be evicted to stay within the budget. An
+	// evicted sub buffer's data is copied back to host memory and its space freed, get returns
+	// an empty sub buffer with buffer 0 for it until it's restored by touch
+	void set_evictable(BufferHandle h, bool evictable);
+	// Mark the handle's sub buffer as used, making it the last evictable one to be evicted.
+	// If it's been evicted it's restored to a new location and its data uploaded from the
+	// host copy, returns false if it couldn't be restored within the budget
+	bool touch(BufferHandle h);
+	// Check if the handle's sub buffer is currently evicted
+	bool is_evicted(BufferHandle h) const;
+	// Set the callback to be informed when an evicted sub buffer is restored by touch,
+	// the callback is passed the handle and the sub buffer it now refers to
+	void set_restore_callback(const std::function<void(BufferHandle, const SubBuffer&)> &callback);
+	// Get a sub buffer containing the handle table for binding as an SSBO, with one
+	// HandleEntry per handle indexed by the handle. The table is re-uploaded if
+	// handles have changed since it was last fetched, so this should be called each frame
+	// before the table is bound. The table is triple buffered, a new copy is written each
+	// time it changes and this only blocks if the GPU is still using the copy from two changes ago
+	const SubBuffer& handle_table();
+	// Write size bytes of data into the sub buffer starting at dst_offset. Mapped sub buffers
+	// are written directly, others (e.g. STATIC ones) are written to a staging sub buffer
+	// from the STREAM pool and copied over on the GPU
+	void upload(const SubBuffer &dst, const void *data, size_t size, size_t dst_offset = 0);
+	// Get statistics about the buffers used for some usage
+	PoolStats pool_stats(BufferUsage usage) const;
+	// Tag an allocation with a name for debugging. Tags are included in the JSON snapshot
+	// and the tags of each buffer's allocations are set as its GL object label at the end
+	// of the frame so they show up in GL debuggers. The tag follows the data if it's moved
+	void set_tag(const SubBuffer &b, const std::string &tag);
+	// Write a JSON snapshot of the statistics for each pool, the totals across them and
+	// the bytes allocated under each tag, for graphing memory use over time
+	void write_json(std::ostream &os) const;
+	// Record the alloc, realloc and free calls made to the allocator to the stream, one per line:
+	// "a <id> <size> <align> <usage>", "r <id> <new size> <new id>" and "f <id>", where the id
+	// identifies the allocation while it's live. Pass null to stop recording
+	void set_trace(std::ostream *os);
+	// Run the GL work queued by other threads. Must be called on the GL thread, it's also
+	// run by end_frame but should be called more often if workers are allocating heavily
+	void run_gl_tasks();
+
+private:
+	// Allocate a sub buffer, recording the call's latency and the pool's high water mark
+	SubBuffer alloc(std::unique_lock<std::recursive_mutex> &l, size_t sz, size_t align, BufferUsage usage);
+	SubBuffer alloc_block(std::unique_lock<std::recursive_mutex> &l, size_t sz, size_t align, BufferUsage usage);
+	void realloc(std::unique_lock<std::recursive_mutex> &l, SubBuffer &b, size_t new_sz);
+	void free_block(SubBuffer &buf);
+	// Set the sub buffer's size to new_sz and cut its block down to hold `keep` bytes if possible
+	void shrink(Buffer &parent, SubBuffer &b, size_t new_sz, size_t keep);
+	// Run the GL work on the GL thread. If called from another thread the lock is released
+	// while waiting for the GL thread to get to it, so the GL thread can't deadlock on it
+	void run_on_gl_thread(std::unique_lock<std::recursive_mutex> &l, const std::function<void()> &fn);
+	// Release the sub buffers of any retired frames whose fence has signaled,
+	// returns true if any space was released
+	bool collect_retired();
+	// Return the sub buffer's space to its parent buffer
+	void release(SubBuffer &buf);
+	// Release buffers which have been empty for longer than the release delay
+	void release_empty_buffers(std::unique_lock<std::recursive_mutex> &l);
+	// Release the empty buffers, keeping the first of each usage as a spare if `keep_spares` is set
+	// and only those empty for longer than the release delay if `wait_delay` is set. The buffers
+	// are destroyed on the GL thread, dropping the lock if called from another. Returns true
+	// if any were released
+	bool drop_empty_buffers(std::unique_lock<std::recursive_mutex> &l, bool keep_spares, bool wait_delay);
+	// Check if evicting and releasing buffers could ever make room in the budget for a block,
+	// either in an existing buffer or a new one of new_size bytes
+	bool budget_can_fit(size_t block, size_t new_size, BufferUsage usage) const;
+	// Rebuild the buffer index after buffers have been removed
+	void rebuild_index();
+	// Evict the least recently used evictable sub buffer to host memory,
+	// returns false if there was nothing to evict
+	bool evict_lru(std::unique_lock<std::recursive_mutex> &l);
+	void upload(std::unique_lock<std::recursive_mutex> &l, const SubBuffer &dst, const void *data,
+			size_t size, size_t dst_offset);
+	// Create a new buffer of some size for the usage and add it to the allocator
+	Buffer& add_buffer(std::unique_lock<std::recursive_mutex> &l, size_t size, BufferUsage usage);
+	// Find the buffer the sub buffer was allocated from, or null if it's not one of ours
+	Buffer* find_parent(const SubBuffer &buf);
+	// Point the handle owning the old sub buffer, if any, at its new location
+	void update_handle(const SubBuffer &old, const SubBuffer &moved);
+	// Move the tag on the old sub buffer, if any, to its new location
+	void move_tag(const SubBuffer &old, const SubBuffer &moved);
+	// Update the high water marks after the pool's usage has grown
+	void update_high_water(BufferUsage usage);
+	// Set the GL label of buffers whose tags have changed
+	void update_labels();
+};
+
+/*
+ * A per-thread cache of sub buffers for a BufferAllocator, letting worker threads make
+ * small allocations without contending on the allocator's lock. Requests up to MAX_CLASS
+ * bytes are rounded up to a power of two size class and served from a magazine of blocks
+ * of that class, which is refilled from the allocator a batch at a time and returns a batch
+ * when it holds too many. Sub buffers allocated from the cache have the size of their class
+ * and should be freed back to the same cache. They stay pinned in place until the cache hands
+ * them back to the allocator, so defragment doesn't move them. A cache must only be used by one thread
+ */
+class ThreadAllocCache {
+	static const size_t MIN_CLASS = 16;
+	static const size_t MAX_CLASS = 64 * 1024;
+	static const size_t NUM_CLASSES = 13;
+	// Rough number of bytes fetched from the allocator per refill
+	static const size_t MAGAZINE_BYTES = 64 * 1024;
+
+	BufferAllocator &allocator;
+	BufferUsage usage;
+	size_t align;
+	std::vector<SubBuffer> magazines[NUM_CLASSES];
+	// Frees to pass through to the allocator when it's deferring frees
+	std::vector<SubBuffer> to_free;
+
+public:
+	// Create a cache allocating sub buffers with some usage and alignment from the allocator
+	ThreadAllocCache(BufferAllocator &allocator, BufferUsage usage = BufferUsage::DYNAMIC,
+			size_t align = 16);
+	ThreadAllocCache(const ThreadAllocCache&) = delete;
+	ThreadAllocCache& operator=(const ThreadAllocCache&) = delete;
+	// Returns any cached sub buffers to the allocator
+	~ThreadAllocCache();
+	// Allocate a sub buffer of at least sz bytes. Requests larger than MAX_CLASS
+	// go straight to the allocator
+	SubBuffer alloc(size_t sz);
+	// Free a sub buffer allocated from this cache. If the allocator is deferring frees the
+	// block can't be reused right away so it's passed back to the allocator to retire
+	void free(SubBuffer &buf);
+	// Return all cached sub buffers to the allocator
+	void flush();
+
+private:
+	// Get the size class index for an allocation of sz bytes
+	static size_t size_class(size_t sz);
+	// Number of blocks fetched from the allocator per refill of a class
+	static size_t batch_size(size_t cls);
+};
+
+// Statistics about how often the CPU had to wait on the GPU to free up
+// space in a StreamRingBuffer, for sizing the ring
+struct StreamRingStats {
+	size_t allocs, frames, wraps, stalls;
+	// Total and longest time spent blocked on fences, in milliseconds
+	double stall_ms, max_stall_ms;
+
+	StreamRingStats();
+};
+
+// A ring buffer for streaming transient per-frame data (vertices, uniforms, indirect commands)
+// through a persistently mapped Buffer. Allocations are handed out linearly and the end of
+// each frame's data is marked with a fence, the CPU only waits on a fence when the writer
+// wraps around and catches up with data the GPU may still be reading
+class StreamRingBuffer {
+	struct Frame {
+		GLsync fence;
+		// Bytes consumed by the frame, including any padding skipped for alignment or wrapping
+		size_t bytes;
+	};
+	Buffer buffer;
+	SubBuffer ring;
+	// The ring's data store and frame fences are made through the storage backend
+	BufferStorage *storage;
+	// Write position and number of bytes in flight between the oldest fenced frame and head
+	size_t head, used, frame_bytes;
+	std::deque<Frame> frames;
+	StreamRingStats ring_stats;
+
+public:
+	// Create a ring buffer of `size` bytes, optionally with a coherent mapping. If the mapping
+	// isn't coherent allocations must be flushed after writing them. The ring is made by the
+	// storage backend passed, or a GL buffer if it's null
+	StreamRingBuffer(size_t size, bool coherent = true, BufferStorage *storage = nullptr);
+	StreamRingBuffer(const StreamRingBuffer&) = delete;
+	StreamRingBuffer& operator=(const StreamRingBuffer&) = delete;
+	~StreamRingBuffer();
+	// Allocate a transient sub buffer of sz bytes for this frame. The sub buffer is valid
+	// to write until the fence for its frame is passed by the GPU. Returns an empty sub buffer
+	// if sz can't fit in the ring alongside the data already allocated this frame
+	SubBuffer alloc(size_t sz, size_t align = 1);
+	// Mark the end of the current frame's allocations, inserting a fence after the
+	// commands using them. Should be called after submitting the frame's draws
+	void end_frame();
+	const StreamRingStats& stats() const;
+
+private:
+	// Wait for the oldest in flight frame to complete and reclaim its space
+	void retire_frame();
 };
 }
 std::ostream& operator<<(std::ostream &os, const glt::SubBuffer &b);
-std::ostream& operator<<(std::ostream &os, const glt::Block &b);
+std::ostream& operator<<(std::ostream &os, const glt::StreamRingStats &s);
+std::ostream& operator<<(std::ostream &os, const glt::PoolStats &s);
 
 #endif
 
@@ -0,0 +1,130 @@
+#ifndef GLT_BUFFER_STORAGE_H
+#define GLT_BUFFER_STORAGE_H
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include "gl_core_4_5.h"
+
+namespace glt {
+/*
+ * Usage hints for what a buffer will hold, used to pick the storage flags for the buffer
+ * DYNAMIC: data updated from the CPU and read by the GPU, persistently mapped read/write
+ * STATIC: data written once and only read by the GPU after, stored in non-mappable
+ * 		storage and filled through a staging copy with BufferAllocator::upload
+ * STREAM: transient data written by the CPU each frame, persistently mapped write-only
+ * READBACK: data written by the GPU to be read on the CPU, persistently mapped read-only
+ * 		in client storage
+ */
+enum class BufferUsage { DYNAMIC, STATIC, STREAM, READBACK };
+const size_t BUFFER_USAGE_COUNT = 4;
+
+/*
+ * Interface for the data stores backing Buffers. Buffer and BufferAllocator only
+ * create, copy between and fence their data stores through the storage they're given,
+ * so the allocation bookkeeping can be run against host memory for testing and
+ * benchmarking without a GL context
+ */
+class BufferStorage {
+public:
+	virtual ~BufferStorage(){}
+	/*
+	 * Create a data store of size bytes for the usage, returning its name. coherent is the
+	 * coherence requested for the mapping and is set to the coherence actually provided,
+	 * mapping is set to the store's persistent mapping or null if it isn't mapped
+	 */
+	virtual GLuint create(size_t size, BufferUsage usage, bool &coherent, char *&mapping) = 0;
+	/*
+	 * Release a data store made by create
+	 */
+	virtual void destroy(GLuint buffer) = 0;
+	/*
+	 * Enqueue a copy of size bytes from one data store to another
+	 */
+	virtual void copy(GLuint src, size_t src_offset, GLuint dst, size_t dst_offset, size_t size) = 0;
+	/*
+	 * Read size bytes back from a data store into data, waiting for
+	 * the GPU to finish any commands enqueued using the store
+	 */
+	virtual void read(GLuint buffer, size_t offset, size_t size, void *data) = 0;
+	/*
+	 * Insert a fence after the commands enqueued so far
+	 */
+	virtual GLsync fence() = 0;
+	/*
+	 * Check if the fence has been passed, without blocking
+	 */
+	virtual bool signaled(GLsync fence) = 0;
+	/*
+	 * Wait up to timeout nanoseconds for the fence to be passed, flushing the commands before
+	 * it. Returns the status as glClientWaitSync does: GL_ALREADY_SIGNALED or GL_CONDITION_SATISFIED
+	 * if it's been passed, GL_TIMEOUT_EXPIRED if not or GL_WAIT_FAILED on error
+	 */
+	virtual GLenum wait(GLsync fence, uint64_t timeout) = 0;
+	virtual void delete_fence(GLsync fence) = 0;
+	/*
+	 * Set a debugging label for the data store
+	 */
+	virtual void label(GLuint buffer, const std::string &label) = 0;
+	/*
+	 * Get the alignment required for offsets of ranges bound to the buffer binding
+	 * target, e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for GL_UNIFORM_BUFFER
+	 */
+	virtual size_t offset_alignment(GLenum target) = 0;
+};
+/*
+ * Get the storage backend making GL buffers in the current context, used by
+ * Buffers and BufferAllocators which aren't given a storage backend
+ */
+BufferStorage* gl_buffer_storage();
+
+/*
+ * GL buffer objects, persistently mapped on GL 4.4+ with storage flags picked from the usage
+ */
+class GLBufferStorage : public BufferStorage {
+public:
+	GLuint create(size_t size, BufferUsage usage, bool &coherent, char *&mapping) override;
+	void destroy(GLuint buffer) override;
+	void copy(GLuint src, size_t src_offset, GLuint dst, size_t dst_offset, size_t size) override;
+	void read(GLuint buffer, size_t offset, size_t size, void *data) override;
+	GLsync fence() override;
+	bool signaled(GLsync fence) override;
+	GLenum wait(GLsync fence, uint64_t timeout) override;
+	void delete_fence(GLsync fence) override;
+	void label(GLuint buffer, const std::string &label) override;
+	size_t offset_alignment(GLenum target) override;
+};
+
+/*
+ * Data stores in host memory for running the allocator without a GL context. Every store
+ * is coherently mapped, copies are done immediately and fences are always signaled
+ */
+class HostBufferStorage : public BufferStorage {
+	std::unordered_map<GLuint, std::unique_ptr<char[]>> stores;
+	std::unordered_map<GLuint, size_t> sizes;
+	GLuint next_name;
+	size_t bytes, peak;
+
+public:
+	HostBufferStorage();
+	GLuint create(size_t size, BufferUsage usage, bool &coherent, char *&mapping) override;
+	void destroy(GLuint buffer) override;
+	void copy(GLuint src, size_t src_offset, GLuint dst, size_t dst_offset, size_t size) override;
+	void read(GLuint buffer, size_t offset, size_t size, void *data) override;
+	GLsync fence() override;
+	bool signaled(GLsync fence) override;
+	GLenum wait(GLsync fence, uint64_t timeout) override;
+	void delete_fence(GLsync fence) override;
+	void label(GLuint buffer, const std::string &label) override;
+	// Reports the largest alignment GL implementations require for each target
+	size_t offset_alignment(GLenum target) override;
+	// Get the bytes currently allocated for data stores
+	size_t allocated_bytes() const;
+	// Get the most bytes that have been allocated for data stores at once
+	size_t peak_bytes() const;
+};
+}
+
+#endif
+
@@ -0,0 +1,114 @@
+#ifndef GLT_GEOMETRY_CACHE_H
+#define GLT_GEOMETRY_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "gl_core_4_5.h"
+#include "mapped_file.h"
+#include "vertex_format.h"
+#include "load_models.h"
+
+namespace glt {
+// Texture maps a material can use, indexing MaterialDesc::textures
+enum MaterialTexture { MAT_TEX_AMBIENT, MAT_TEX_DIFFUSE, MAT_TEX_SPECULAR, MAT_TEX_NORMAL,
+	MAT_TEX_MASK, MAT_TEX_COUNT };
+/*
+ * A model file's material as stored in the geometry cache. textures holds the index of
+ * the texture used for each MaterialTexture in GeometryData::textures, or -1 if none is used
+ */
+struct MaterialDesc {
+	std::string name;
+	glm::vec4 ka, kd, ks;
+	int32_t textures[MAT_TEX_COUNT];
+
+	MaterialDesc();
+};
+/*
+ * Everything the model loaders need from a model file, with the vertices already
+ * packed in the format requested and the indices of each shape relative to its vert_offset.
+ * Texture file names are relative to the model file's directory
+ */
+struct GeometryData {
+	std::vector<std::pair<std::string, ModelMatInfo>> shapes;
+	std::vector<MaterialDesc> materials;
+	std::vector<std::string> textures;
+	std::vector<char> verts;
+	std::vector<GLuint> elems;
+};
+
+/*
+ * Set the directory geometry caches are written to and read from. If empty, the default,
+ * each cache is stored next to its model file. Should be set before loading any models
+ */
+void set_geometry_cache_dir(const std::string &dir);
+/*
+ * Enable or disable reading and writing geometry caches in the model loaders, enabled by default
+ */
+void set_geometry_cache_enabled(bool enabled);
+bool geometry_cache_enabled();
+/*
+ * Get the path of the cache for the model file loaded with the vertex format and optimization
+ */
+std::string geometry_cache_path(const std::string &model_file, const VertexFormat &format, bool optimize);
+
+/*
+ * A model file's GeometryData in a versioned binary format which can be memory mapped and
+ * uploaded from without any parsing. A cache is keyed by the model file's path, size,
+ * modification time and a hash of its contents, along with the vertex format and optimization
+ * it was made with. It's out of date if the size changes or if the modification time changes
+ * and the hash no longer matches, so touching a model file without changing it only costs
+ * a rehash. Once opened or built the cache's data is read through the accessors
+ */
+class GeometryCache {
+	MappedFile mapping;
+	// The cache's bytes when it was built in memory instead of mapped
+	std::vector<char> bytes;
+	const char *data;
+	size_t size;
+
+public:
+	GeometryCache();
+	/*
+	 * Map the baked geometry registered for the model file by a bake manifest (see bake_manifest.h)
+	 * or, if caching is enabled, its cache at geometry_cache_path if there's an up to date one,
+	 * returning false if not
+	 */
+	bool open(const std::string &model_file, const VertexFormat &format, bool optimize);
+	/*
+	 * Serialize the model file's data into the cache and write it to out_file, or to
+	 * geometry_cache_path if caching is enabled and no out_file is given, printing where it was
+	 * written to log. Returns false if it wasn't written. The cache is usable even if writing
+	 * failed or caching is disabled
+	 */
+	bool build(const std::string &model_file, const VertexFormat &format, bool optimize,
+			const GeometryData &geom, const std::string &out_file = "", std::ostream &log = std::cout);
+	size_t shapes() const;
+	std::string shape_name(size_t i) const;
+	ModelMatInfo shape(size_t i) const;
+	size_t materials() const;
+	MaterialDesc material(size_t i) const;
+	size_t textures() const;
+	std::string texture(size_t i) const;
+	// The packed vertex data, ready to upload
+	const char* verts() const;
+	size_t verts_size() const;
+	// The shapes' indices, ready to upload
+	const GLuint* elems() const;
+	size_t elems_count() const;
+
+private:
+	bool open_file(const std::string &path, const std::string &model_file, const VertexFormat &format,
+			bool optimize);
+	// Check the mapped cache is intact and up to date with the model, touched is set if the model's
+	// modification time changed but its contents didn't
+	bool validate(const std::string &model_file, const VertexFormat &format, bool optimize,
+			bool &touched);
+};
+}
+
+#endif
+
@@ -3,12 +3,19 @@
 
 #include <unordered_map>
 #include <ostream>
+#include <iostream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <atomic>
 #include <glm/glm.hpp>
 #include <tiny_obj_loader.h>
 #include "buffer_allocator.h"
 #include "load_texture.h"
+#include "mesh_optimizer.h"
+#include "vertex_format.h"
 
 namespace glt {
 /*
@@ -17,10 +24,14 @@ namespace glt {
  * indices: number of indices for the model
  * vert_offset: offset in number of vertices in the vert_buf to reach this
  * 				model's vertex data
+ * verts: number of unique vertices for the model after welding
+ * dequant: transform from the model's stored attributes back to model space,
+ * 				the identity unless loaded with a quantized VertexFormat
  */
 struct ModelInfo {
-	size_t index_offset, indices, vert_offset;
-	ModelInfo(size_t index_offset = 0, size_t indices = 0, size_t vert_offset = 0);
+	size_t index_offset, indices, vert_offset, verts;
+	Dequantization dequant;
+	ModelInfo(size_t index_offset = 0, size_t indices = 0, size_t vert_offset = 0, size_t verts = 0);
 };
 /*
  * Stores information about the offsets for some loaded model along with it's material id
@@ -28,11 +39,15 @@ struct ModelInfo {
  * indices: number of indices for the model
  * vert_offset: offset in number of vertices in the vert_buf to reach this
  * 				model's vertex data
+ * verts: number of unique vertices for the model after welding
+ * dequant: transform from the model's stored attributes back to model space,
+ * 				the identity unless loaded with a quantized VertexFormat
  */
 struct ModelMatInfo {
-	size_t index_offset, indices, vert_offset, mat_id;
+	size_t index_offset, indices, vert_offset, mat_id, verts;
+	Dequantization dequant;
 	ModelMatInfo(size_t index_offset = 1, size_t indices = 0, size_t vert_offset = 0,
-			size_t mat_id = 0);
+			size_t mat_id = 0, size_t verts = 0);
 };
 /*
  * Information about a model's material stored in the material buffer
@@ -56,22 +71,149 @@ struct Material {
  * Load all objects contained in the list of obj files using the buffer allocator
  * to allocate sub buffers `vert_buf` and `elem_buf` to store all the model information
  * elements will be stored as GLuints
- * vertex attribs are stored as interleaved vecs in the order:
- * 	vec3 pos, vec3 normal, vec2 texcoord
- * If a model doesn't have texcoords the texcoords will just be junk values
+ * vertex attribs are stored interleaved in the order pos, normal, texcoord in `format`,
+ * which defaults to vec3 pos, vec3 normal, vec2 texcoord floats. Quantized formats are fit
+ * to each model's bounds, the error introduced is reported and the transform to model space
+ * is returned in the model's info. Use format.set_attrib_formats to set up a vertex array for it
+ * Vertices with identical attributes are welded within each model so each unique
+ * vertex is stored once and the buffers are sized to exactly fit the welded data.
+ * If a model doesn't have normals or texcoords they're left as 0
+ * If `optimize` is set each model's triangles and vertices are reordered with optimize_mesh
+ * for better vertex cache use, less overdraw and more linear vertex fetches, this takes
+ * a bit longer to load but can make vertex bound scenes much faster to draw
+ * The processed geometry of each file is stored in a GeometryCache which is mapped and
+ * uploaded directly on later loads while it's up to date, see geometry_cache.h. Geometry
+ * baked offline by glt_bake and registered with load_bake_manifest is used the same way
+ * The files are loaded on a worker thread while the previously loaded ones are uploaded, so
+ * the buffers grow as files come in and are trimmed to fit once all are uploaded
  * returns true if all models loaded successfully, false if not
  */
 bool load_models(const std::vector<std::string> &model_files, SubBuffer &vert_buf,
 		SubBuffer &elem_buf, BufferAllocator &allocator,
-		std::unordered_map<std::string, ModelInfo> &elem_offsets);
+		std::unordered_map<std::string, ModelInfo> &elem_offsets, bool optimize = false,
+		const VertexFormat &format = VertexFormat());
 /*
  * Load the model specified along with its materials. Fills out the vert and
  * elem buffers as before but also loads textures and material info (int mat_buf).
  * The material ids are returned per object as well in the ModelMatInfo map
+ * The models can optionally be optimized and quantized, as with load_models
+ * The model is loaded on a worker thread which starts decoding the textures with a
+ * TextureSetLoader as soon as the materials are known, the textures are uploaded as they're
+ * decoded while the rest of the model is processed
  */
 bool load_model_with_mats(const std::string &model_file, BufferAllocator &allocator,
 		SubBuffer &vert_buf, SubBuffer &elem_buf, SubBuffer &mat_buf,
-		OBJTextures &obj_textures, std::unordered_map<std::string, ModelMatInfo> &model_info);
+		OBJTextures &obj_textures, std::unordered_map<std::string, ModelMatInfo> &model_info,
+		bool optimize = false, const VertexFormat &format = VertexFormat());
+/*
+ * Stream an OBJ file too large to load into host memory into `vert_buf` and `elem_buf`. The file
+ * is memory mapped and read twice in windows of `window` bytes, each released once it's been read:
+ * first to count the vertices and triangles to size the buffers, then to parse it straight into
+ * the buffers' mappings. So host memory use is bounded by the window rather than the file size,
+ * the process' peak RSS is printed once the model is loaded.
+ * As nothing is kept per vertex the vertices aren't welded or de-indexed: each position is one
+ * float vertex in the default VertexFormat, with the normals and texcoords only kept if the file
+ * has one per position (see stream_obj). Materials are ignored. g and o statements split the
+ * model into the shapes returned in elem_offsets, which all index into the same vertices.
+ * returns true if the model was loaded, false if not
+ */
+bool stream_model(const std::string &model_file, SubBuffer &vert_buf, SubBuffer &elem_buf,
+		BufferAllocator &allocator, std::unordered_map<std::string, ModelInfo> &elem_offsets,
+		size_t window = 64 << 20);
+/*
+ * Parse, weld, optimize and pack the model file as the loaders would and write the result as
+ * a geometry cache to out_file, or geometry_cache_path if none is given. No buffers are created
+ * so models can be baked offline without a GL context. The file is parsed on `threads` threads,
+ * 0 uses one per core, and what was loaded is printed to log.
+ * Returns false if the model couldn't be loaded or the cache couldn't be written
+ */
+bool bake_model(const std::string &model_file, bool optimize = false,
+		const VertexFormat &format = VertexFormat(), const std::string &out_file = "",
+		size_t threads = 0, std::ostream &log = std::cout);
+
+class GeometryCache;
+/*
+ * Progress of an AsyncModelLoad, the totals are 0 until the model has been loaded
+ */
+struct ModelLoadProgress {
+	// Shapes uploaded and ready to draw out of the model's shapes
+	size_t shapes_ready, shapes;
+	// Bytes of vertex and index data uploaded out of the model's total
+	size_t bytes_uploaded, bytes;
+	// Textures uploaded out of those used by the model's materials
+	size_t textures_ready, textures;
+
+	ModelLoadProgress();
+};
+/*
+ * Loads a model with its materials as load_model_with_mats does but without blocking, so a
+ * long load doesn't freeze the render loop. The model is loaded (parsed or mapped from its
+ * geometry cache) and its textures decoded on worker threads while update, called each frame
+ * on the render thread, does the GL work in slices under a byte and time budget.
+ * Shapes become drawable as soon as their vertices and indices are uploaded and are added to
+ * ready_shapes. Their materials are written untextured (maps of -1) until every texture has
+ * been uploaded, then the material buffer is rewritten with the texture maps and the load is done.
+ * The buffers and textures belong to the caller once the load is done, destroying the load
+ * before then cancels it and frees them so it should be destroyed on the render thread
+ */
+class AsyncModelLoad {
+	// The state the worker loads into, shared with it so a cancelled load can be destroyed
+	// without waiting for the worker to finish
+	struct Shared {
+		std::atomic<bool> cancelled;
+		std::unique_ptr<GeometryCache> cache;
+		// The textures start loading on the worker once the materials have been parsed
+		std::mutex texture_lock;
+		std::shared_ptr<TextureSetLoader> texture_loader;
+
+		Shared();
+	};
+	BufferAllocator &allocator;
+	std::string base_path;
+	std::shared_ptr<Shared> shared;
+	size_t stride;
+	std::future<bool> geometry;
+	SubBuffer vert_buf, elem_buf, mat_buf;
+	OBJTextures obj_textures;
+	std::unordered_map<std::string, ModelMatInfo> model_info;
+	// The next shape to upload and the bytes of the vertices and elements uploaded so far,
+	// shapes are stored in order so each is ready once both have passed its end
+	size_t next_shape, verts_uploaded, elems_uploaded;
+	bool geometry_loaded, is_done, is_failed;
+
+public:
+	// Start loading the model on a worker thread, the model can be optimized and quantized
+	// as with load_models
+	AsyncModelLoad(const std::string &model_file, BufferAllocator &allocator, bool optimize = false,
+			const VertexFormat &format = VertexFormat());
+	AsyncModelLoad(const AsyncModelLoad&) = delete;
+	AsyncModelLoad& operator=(const AsyncModelLoad&) = delete;
+	// Cancels the load if it's not done without waiting for the worker, which stops at the next
+	// shape it would process and then exits
+	~AsyncModelLoad();
+	/*
+	 * Do the GL work for the parts of the load that are ready, uploading up to `byte_budget` bytes
+	 * of geometry and textures and stopping once `time_budget_ms` has elapsed (if non-zero).
+	 * Must be called on the render thread, returns true once the load is done or has failed
+	 */
+	bool update(size_t byte_budget, double time_budget_ms = 0);
+	bool done() const;
+	bool failed() const;
+	ModelLoadProgress progress();
+	// The shapes that have been uploaded and can be drawn, along with their material ids
+	const std::unordered_map<std::string, ModelMatInfo>& ready_shapes() const;
+	// The buffers are allocated once the model has been loaded, the material buffer is left
+	// empty if the model has no materials
+	const SubBuffer& vertex_buffer() const;
+	const SubBuffer& element_buffer() const;
+	const SubBuffer& material_buffer() const;
+	// Where the textures ended up, filled out once the load is done
+	const OBJTextures& textures() const;
+
+private:
+	std::shared_ptr<TextureSetLoader> get_texture_loader();
+	void fail();
+};
 }
 std::ostream& operator<<(std::ostream &os, const glt::ModelInfo &m);
 std::ostream& operator<<(std::ostream &os, const glt::ModelMatInfo &m);
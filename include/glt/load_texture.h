@@ -6,7 +6,15 @@
 #include <set>
 #include <unordered_map>
 #include <utility>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
 #include "gl_core_4_5.h"
+#include "bounded_queue.h"
+#include "baked_texture.h"
 
 /*
  * Defines various texture loading utility functions
@@ -46,9 +54,82 @@ GLint load_cubemap(const std::vector<std::string> &files, int *width = nullptr,
 /*
  * Load the textures passed into as few 2D texture arrays as possible, grouping by image
  * dimension and format. Information about which textures ended up where is returned in the
- * OBJTextures struct
+ * OBJTextures struct. Textures with an up to date baked texture (see baked_texture.h) are
+ * uploaded from it with their precomputed mips instead of being decoded
  */
 OBJTextures load_texture_set(const std::set<std::string> &files);
+/*
+ * Loads a set of textures into texture arrays as load_texture_set does, as a pipeline: worker
+ * threads read the header of each image (or map its baked texture) then decode the images
+ * while the GL thread creates the arrays and uploads each texture as soon as it's decoded.
+ * The workers start on construction so decoding overlaps whatever the caller does next,
+ * upload or finish must then be called on the GL thread to get the textures onto the GPU
+ */
+class TextureSetLoader {
+	struct Texture {
+		std::string name;
+		int width, height, channels;
+		GLenum internal_format;
+		std::shared_ptr<BakedTexture> baked;
+	};
+	// A texture ready to upload, pixels is null if it's uploaded from its baked texture
+	struct Decoded {
+		size_t index;
+		std::shared_ptr<unsigned char> pixels;
+	};
+	std::vector<Texture> textures;
+	// Workers claim a header to read for each texture, then an image to decode
+	std::atomic<size_t> next_task;
+	std::atomic<bool> error, stop;
+	size_t headers_read;
+	std::mutex header_lock;
+	std::condition_variable header_read;
+	// Bounds the decoded images waiting on the GL thread, so decoding can't run far ahead of uploads
+	BoundedQueue<Decoded> decoded;
+	std::vector<std::thread> workers;
+	// The array and layer each texture goes in, and the layers left to upload to each array
+	// and if any were decoded so it needs mips generated once they're uploaded
+	std::vector<std::pair<GLuint, GLuint>> placement;
+	std::vector<size_t> remaining;
+	std::vector<bool> gen_mips;
+	OBJTextures result;
+	size_t uploaded, uploaded_bytes;
+	bool arrays_made;
+
+public:
+	// Start loading the textures on `threads` worker threads, 0 uses one per core
+	TextureSetLoader(const std::set<std::string> &files, size_t threads = 0);
+	TextureSetLoader(const TextureSetLoader&) = delete;
+	TextureSetLoader& operator=(const TextureSetLoader&) = delete;
+	// Stops the workers, textures already created are left to the caller
+	~TextureSetLoader();
+	/*
+	 * Upload the textures which have finished decoding, first creating the texture arrays once
+	 * every header has been read. Waits up to `timeout_ms` if nothing is ready and stops once
+	 * `byte_budget` bytes have been uploaded, though with a non-zero budget at least one texture
+	 * is uploaded if one is ready so large textures can't stall. Must be called on the GL thread,
+	 * returns true once every texture is uploaded or loading has failed
+	 */
+	bool upload(double timeout_ms = 0, size_t byte_budget = SIZE_MAX);
+	// Upload the textures as they're decoded until all are loaded, returns where the textures
+	// ended up or nothing if any failed to load
+	OBJTextures finish();
+	// Stop loading and delete the texture arrays created so far. Must be called on the GL thread
+	void cancel();
+	bool failed() const;
+	// The number of textures being loaded, and the number and bytes of them uploaded so far
+	size_t texture_count() const;
+	size_t textures_uploaded() const;
+	size_t bytes_uploaded() const;
+
+private:
+	void work();
+	bool read_header(Texture &tex);
+	bool decode(size_t i);
+	void make_arrays();
+	void join_workers();
+	void upload_texture(const Decoded &d);
+};
 }
 
 #endif
@@ -0,0 +1,98 @@
+#ifndef GLT_MAPPED_FILE_H
+#define GLT_MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+
+namespace glt {
+/*
+ * A read only memory mapping of a whole file, unmapped when the MappedFile is closed or destroyed
+ */
+class MappedFile {
+	const char *ptr;
+	size_t len;
+#ifdef _WIN32
+	void *file, *mapping;
+#else
+	int fd;
+#endif
+
+public:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile &&m);
+	MappedFile& operator=(MappedFile &&m);
+	~MappedFile();
+	/*
+	 * Map the file, closing any file currently mapped. Returns false and
+	 * prints an error if the file couldn't be mapped
+	 */
+	bool open(const std::string &path);
+	void close();
+	bool is_open() const;
+	// Get the file's contents, null for empty files
+	const char* data() const;
+	size_t size() const;
+	/*
+	 * Tell the OS the range won't be read again so its pages can be dropped from memory,
+	 * for streaming through files too large to keep resident. The page the range starts in
+	 * is released with it while the page it ends in is kept, so consecutive ranges can be
+	 * released as they're consumed. The data can still be read, it's just paged back in
+	 */
+	void release(size_t offset, size_t size) const;
+};
+/*
+ * Size and last modification time (seconds since the epoch) of a file
+ */
+struct FileStat {
+	uint64_t size;
+	int64_t mtime;
+};
+/*
+ * Get the size and modification time of the file, returns false if it doesn't exist
+ */
+bool stat_file(const std::string &path, FileStat &stat);
+/*
+ * 64 bit hash of the bytes for detecting changed files, not for security. Reads 32 bytes
+ * at a time in independent lanes so hashing large files runs close to memory bandwidth
+ */
+uint64_t hash_bytes(const char *data, size_t size);
+/*
+ * Hash the contents of the file, returns false if it couldn't be read
+ */
+bool hash_file(const std::string &path, uint64_t &hash);
+/*
+ * Identifies the version of a source file a derived file (cache or baked asset) was made from
+ */
+struct FileKey {
+	uint64_t size;
+	int64_t mtime;
+	uint64_t hash;
+};
+/*
+ * Get the key for the current contents of the file, returns false if it couldn't be read
+ */
+bool make_file_key(const std::string &path, FileKey &key);
+/*
+ * Check if the file still matches the key. If the size and modification time match the
+ * file is assumed unchanged, if only the modification time differs the file is rehashed
+ * and `touched` set if the contents are unchanged, so the caller can update its key
+ */
+bool file_key_matches(const std::string &path, const FileKey &key, bool &touched);
+/*
+ * Update the modification time in the FileKey stored `key_offset` bytes into the file at path to
+ * the current one of `source`, for when file_key_matches found the source touched but unchanged
+ * so it won't need rehashing next time. The file must not be mapped while it's updated.
+ * Returns false if it couldn't be updated, which is fine as the source will just be rehashed
+ */
+bool update_file_key(const std::string &path, size_t key_offset, const std::string &source);
+/*
+ * Write the data to a temporary file next to path then move it into place, so a partially
+ * written file is never seen by readers. Returns false and prints an error if writing failed
+ */
+bool replace_file(const std::string &path, const char *data, size_t size);
+}
+
+#endif
+
@@ -0,0 +1,75 @@
+#ifndef GLT_MESH_OPTIMIZER_H
+#define GLT_MESH_OPTIMIZER_H
+
+#include <vector>
+#include <ostream>
+#include "gl_core_4_5.h"
+
+namespace glt {
+// Default number of entries in the simulated FIFO post-transform vertex cache
+const size_t VERTEX_CACHE_SIZE = 16;
+
+/*
+ * Statistics from simulating a FIFO post-transform vertex cache over an indexed triangle list
+ * triangles: number of triangles drawn
+ * vertices: number of unique vertices referenced by the indices
+ * transformed: number of vertex shader invocations, i.e. cache misses
+ */
+struct VertexCacheStats {
+	size_t triangles, vertices, transformed;
+
+	VertexCacheStats();
+	// Average cache miss ratio, vertices transformed per triangle. 0.5 is the best
+	// possible on large closed meshes, 3 means nothing is ever reused
+	double acmr() const;
+	// Average transform to vertex ratio, vertices transformed per unique vertex. 1 is the
+	// best possible and means each vertex is only transformed once
+	double atvr() const;
+};
+// Statistics for the indices before and after optimize_mesh
+struct MeshOptStats {
+	VertexCacheStats before, after;
+};
+
+/*
+ * Simulate drawing the triangle list through a FIFO post-transform cache of cache_size entries
+ */
+VertexCacheStats analyze_vertex_cache(const GLuint *indices, size_t n_indices, size_t n_verts,
+		size_t cache_size = VERTEX_CACHE_SIZE);
+/*
+ * Reorder the triangles to reuse vertices in the post-transform cache using Tipsify
+ * (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+ * The reordered indices are written to dst, which must not alias indices. If clusters is
+ * passed it's filled with the first triangle of each cluster, the runs of triangles
+ * between the points where the reordering had to jump to an unconnected part of the
+ * mesh, for use by optimize_overdraw
+ */
+void optimize_vertex_cache(GLuint *dst, const GLuint *indices, size_t n_indices, size_t n_verts,
+		size_t cache_size = VERTEX_CACHE_SIZE, std::vector<size_t> *clusters = nullptr);
+/*
+ * Reorder the clusters of a cache optimized triangle list so the outward facing parts of the
+ * mesh are drawn first, reducing overdraw from any viewpoint. Clusters are first split further
+ * where the split costs less than `threshold` times the cluster's ACMR to give more freedom in
+ * ordering. Vertex positions are read as the first 3 floats of each `vertex_floats` float vertex
+ */
+void optimize_overdraw(GLuint *indices, size_t n_indices, const float *verts, size_t vertex_floats,
+		size_t n_verts, const std::vector<size_t> &clusters, size_t cache_size = VERTEX_CACHE_SIZE,
+		float threshold = 1.05f);
+/*
+ * Reorder the vertices into the order they're first used by the indices so vertex fetches
+ * walk through memory linearly, remapping the indices to match. Unreferenced vertices are
+ * moved to the end. Returns the number of vertices referenced
+ */
+size_t optimize_vertex_fetch(float *verts, size_t vertex_floats, size_t n_verts, GLuint *indices,
+		size_t n_indices);
+/*
+ * Run the vertex cache, overdraw and vertex fetch optimizations over a mesh in that order,
+ * returning the vertex cache statistics before and after
+ */
+MeshOptStats optimize_mesh(float *verts, size_t vertex_floats, size_t n_verts, GLuint *indices,
+		size_t n_indices, size_t cache_size = VERTEX_CACHE_SIZE);
+}
+std::ostream& operator<<(std::ostream &os, const glt::VertexCacheStats &s);
+
+#endif
+
@@ -0,0 +1,63 @@
+#ifndef GLT_OBJ_PARSER_H
+#define GLT_OBJ_PARSER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <tiny_obj_loader.h>
+
+namespace glt {
+/*
+ * Load the OBJ file and the MTL files it references (found relative to mtl_base_path) into
+ * tinyobj shapes and materials, a drop in replacement for tinyobj::LoadObj. As with tinyobj
+ * a new shape is started by each g, o and usemtl statement, faces are triangulated as fans and
+ * each shape's v/vt/vn combinations are de-indexed into its own position, normal and texcoord
+ * arrays, with one material id per triangle.
+ * The file is memory mapped and split into newline aligned chunks which are parsed in parallel
+ * with a locale independent number parser, then the chunks' attributes are merged by a prefix
+ * sum over their counts to resolve relative indices and the shapes are built in parallel.
+ * `threads` is the number of threads to use, 0 uses one per core.
+ * Returns an empty string on success, or the errors that occurred
+ */
+std::string load_obj(std::vector<tinyobj::shape_t> &shapes, std::vector<tinyobj::material_t> &materials,
+		const std::string &file, const std::string &mtl_base_path = "", size_t threads = 0);
+
+// Default size of the windows stream_obj and count_obj read OBJ files in
+const size_t OBJ_STREAM_WINDOW = 64 << 20;
+/*
+ * Number of each attribute and the triangles (after fan triangulation) in an OBJ file
+ */
+struct OBJCounts {
+	uint64_t positions, normals, texcoords, triangles;
+};
+/*
+ * A run of triangles in a streamed OBJ file, started by a g or o statement
+ */
+struct OBJGroup {
+	std::string name;
+	uint64_t first_triangle, triangles;
+};
+/*
+ * Count the attributes and triangles in the OBJ file so the arrays to stream it into can
+ * be sized. The file is mapped and read in windows of `window` bytes which are released once
+ * they're counted, so memory use is bounded by the window and not the file size.
+ * Returns an empty string on success, or the error that occurred
+ */
+std::string count_obj(const std::string &file, OBJCounts &counts, size_t window = OBJ_STREAM_WINDOW);
+/*
+ * Stream the OBJ file straight into the vertex and index arrays (e.g. mapped buffers) in
+ * windows of `window` bytes, releasing each window once it's parsed so memory use is bounded
+ * by the window and not the file size. `counts` must be the file's counts from count_obj.
+ * To avoid keeping any per vertex state the vertices aren't de-indexed like load_obj does:
+ * position i is written to vertex i of `verts` in the FloatVertexLayout, and the i-th normal
+ * and texcoord are written to it too if the file has one per position (as exported scans
+ * usually do), otherwise they're left as 0. Faces are triangulated as fans into `elems`.
+ * g and o statements split the triangles into `groups`, materials are ignored.
+ * Returns an empty string on success, or the errors that occurred
+ */
+std::string stream_obj(const std::string &file, const OBJCounts &counts, float *verts, uint32_t *elems,
+		std::vector<OBJGroup> &groups, size_t window = OBJ_STREAM_WINDOW);
+}
+
+#endif
+
@@ -0,0 +1,199 @@
+#ifndef GLT_SLAB_POOL_H
+#define GLT_SLAB_POOL_H
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "buffer_allocator.h"
+
+namespace glt {
+// Returned by SlabPool::alloc if the pool couldn't grow to make room
+const uint32_t INVALID_SLOT = ~0u;
+/*
+ * A pool of fixed size slots for T's (e.g. Materials, DrawElemsIndirectCmds or per-instance
+ * transforms) stored in a single sub buffer from a BufferAllocator. Slots are tracked with
+ * a bitmap of the live ones, alloc takes the lowest free slot by scanning from the first word
+ * with a free bit so alloc and free are O(1) apart from stepping over full words 64 slots at a
+ * time, and they don't need any per-slot metadata in the allocator. Slot i lives at sizeof(T) * i
+ * bytes into the pool's sub buffer so indices can be used directly by shaders indexing an array
+ * of T bound from sub_buffer(). When the pool is full its sub buffer is grown through the allocator,
+ * which may move it, so the sub buffer should be re-fetched before binding each frame.
+ * The slot indices themselves never change. T is copied bytewise to and from the GPU
+ * so it should be a plain struct laid out to match the shader's std430 array element
+ */
+template<typename T>
+class SlabPool {
+	BufferAllocator &allocator;
+	BufferHandle handle;
+	size_t slots, live;
+	// Bit i is set if slot i is live, the bits past the last slot are kept set so they're never
+	// handed out. No word before first_free has a free slot, so the lowest is handed out first
+	// and live slots stay packed at the front
+	std::vector<uint64_t> live_bits;
+	size_t first_free;
+
+public:
+	// Create a slab pool with room for `initial_slots` T's allocated from the allocator
+	// with the usage passed. The sub buffer is aligned to `align`, which should be at least
+	// the buffer offset alignment of the target the pool will be bound to
+	SlabPool(BufferAllocator &allocator, size_t initial_slots = 64,
+			BufferUsage usage = BufferUsage::DYNAMIC, size_t align = 256)
+		: allocator(allocator), handle(INVALID_HANDLE), slots(0), live(0), first_free(0)
+	{
+		initial_slots = std::max(initial_slots, size_t{1});
+		handle = allocator.alloc_handle(initial_slots * sizeof(T), align, usage);
+		if (handle == INVALID_HANDLE){
+			std::cout << "SlabPool error: failed to allocate room for " << initial_slots << " slots\n";
+			assert(false);
+			return;
+		}
+		add_slots(initial_slots);
+	}
+	SlabPool(const SlabPool&) = delete;
+	SlabPool& operator=(const SlabPool&) = delete;
+	~SlabPool(){
+		if (handle != INVALID_HANDLE){
+			allocator.free(handle);
+		}
+	}
+	// Allocate a slot, growing the pool if it's full. Returns INVALID_SLOT if the pool
+	// is full and couldn't be grown
+	uint32_t alloc(){
+		if (!reserve(1)){
+			return INVALID_SLOT;
+		}
+		const uint32_t s = pop_free();
+		mark_live(s, true);
+		return s;
+	}
+	// Allocate n slots, writing their indices to out. The pool is grown at most once, returns
+	// false without allocating any if it couldn't be grown to fit them
+	bool alloc(size_t n, uint32_t *out){
+		if (!reserve(n)){
+			return false;
+		}
+		for (size_t i = 0; i < n; ++i){
+			out[i] = pop_free();
+			mark_live(out[i], true);
+		}
+		return true;
+	}
+	// Return a slot to the pool, its index may be handed out again by a later alloc
+	void free(uint32_t s){
+		assert(is_live(s));
+		mark_live(s, false);
+		first_free = std::min(first_free, static_cast<size_t>(s / 64));
+	}
+	// Return n slots to the pool
+	void free(size_t n, const uint32_t *s){
+		for (size_t i = 0; i < n; ++i){
+			free(s[i]);
+		}
+	}
+	// Check if the slot is currently allocated
+	bool is_live(uint32_t s) const {
+		return s < slots && (live_bits[s / 64] >> (s % 64)) & 1;
+	}
+	// Get a pointer to the slot in the persistent mapping, or null if the pool isn't
+	// persistently mapped. The pointer is invalidated if the pool grows
+	T* get(uint32_t s) const {
+		assert(is_live(s));
+		const SubBuffer &buf = allocator.get(handle);
+		if (!buf.mapping){
+			return nullptr;
+		}
+		return reinterpret_cast<T*>(buf.mapping + buf.offset) + s;
+	}
+	// Write the value into the slot, going through a staging copy if the pool isn't mapped
+	void write(uint32_t s, const T &val){
+		assert(is_live(s));
+		allocator.upload(allocator.get(handle), &val, sizeof(T), s * sizeof(T));
+	}
+	// Write n values to consecutive slots starting at s, e.g. for slots from a bulk alloc
+	// of a freshly grown pool
+	void write(uint32_t s, size_t n, const T *vals){
+		assert(s + n <= slots);
+		allocator.upload(allocator.get(handle), vals, n * sizeof(T), s * sizeof(T));
+	}
+	// Make sure there are at least n free slots, growing the pool geometrically if not.
+	// Returns false if the pool couldn't be grown, e.g. if it wouldn't fit in the allocator's budget
+	bool reserve(size_t n){
+		assert(handle != INVALID_HANDLE);
+		if (handle == INVALID_HANDLE){
+			return false;
+		}
+		if (slots - live >= n){
+			return true;
+		}
+		const size_t grow_to = std::max(slots * 2, slots + n - (slots - live));
+		allocator.realloc(handle, grow_to * sizeof(T));
+		// A failed realloc leaves the sub buffer as it was, so the new slots would be past its end
+		if (allocator.get(handle).size < grow_to * sizeof(T)){
+			std::cout << "SlabPool error: failed to grow the pool to " << grow_to << " slots\n";
+			return false;
+		}
+		add_slots(grow_to - slots);
+		return true;
+	}
+	// Get the sub buffer holding the slots, for binding the pool as an array of T
+	const SubBuffer& sub_buffer() const {
+		return allocator.get(handle);
+	}
+	// Get the number of slots allocated
+	size_t size() const {
+		return live;
+	}
+	// Get the number of slots the pool has room for
+	size_t capacity() const {
+		return slots;
+	}
+
+private:
+	// Add n new free slots to the end of the pool, clearing their bits a word at a time
+	void add_slots(size_t n){
+		const size_t new_slots = slots + n;
+		live_bits.resize((new_slots + 63) / 64, ~uint64_t{0});
+		for (size_t i = slots; i < new_slots;){
+			const size_t bit = i % 64;
+			const size_t count = std::min(64 - bit, new_slots - i);
+			const uint64_t mask = count == 64 ? ~uint64_t{0} : ((uint64_t{1} << count) - 1) << bit;
+			live_bits[i / 64] &= ~mask;
+			i += count;
+		}
+		first_free = std::min(first_free, slots / 64);
+		slots = new_slots;
+	}
+	// Find the lowest free slot, there must be one
+	uint32_t pop_free(){
+		while (live_bits[first_free] == ~uint64_t{0}){
+			++first_free;
+		}
+		return static_cast<uint32_t>(first_free * 64 + find_first_set(~live_bits[first_free]));
+	}
+	// Index of the lowest set bit, x must be non-zero
+	static int find_first_set(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(x);
+#else
+		int i = 0;
+		for (; (x & 1) == 0; x >>= 1, ++i);
+		return i;
+#endif
+	}
+	void mark_live(uint32_t s, bool l){
+		if (l){
+			live_bits[s / 64] |= uint64_t{1} << (s % 64);
+			++live;
+		}
+		else {
+			live_bits[s / 64] &= ~(uint64_t{1} << (s % 64));
+			--live;
+		}
+	}
+};
+}
+
+#endif
+
@@ -0,0 +1,60 @@
+#ifndef GLT_UPLOAD_QUEUE_H
+#define GLT_UPLOAD_QUEUE_H
+
+#include <vector>
+#include <ostream>
+#include "gl_core_4_5.h"
+#include "buffer_allocator.h"
+
+namespace glt {
+// Statistics about the writes submitted by an UploadQueue flush
+struct UploadStats {
+	// Number of writes queued, bytes uploaded and copy commands issued to upload them
+	size_t writes, bytes, copies;
+
+	UploadStats();
+};
+
+/*
+ * Batches many small writes to sub buffers into a shared staging ring and uploads them
+ * with as few device-side copies as possible. Writes to adjacent destination ranges
+ * are merged into a single copy when their staged data is also contiguous, which is
+ * the case for writes queued in order. Flush should be called once per frame before
+ * the data written is used
+ */
+class UploadQueue {
+	struct Write {
+		GLuint buffer;
+		size_t dst_offset, src_offset, size;
+	};
+	BufferStorage *storage;
+	StreamRingBuffer staging;
+	// Size of the staging ring and the bytes staged in it since the last flush
+	size_t staging_size, staged;
+	std::vector<Write> writes;
+	GLuint staging_buffer;
+	UploadStats last;
+
+public:
+	// Create an upload queue with a staging ring of `staging_size` bytes. The ring is made and the
+	// copies issued through the storage backend passed, or GL if it's null, which should be the
+	// backend of the allocator the destination sub buffers come from
+	UploadQueue(size_t staging_size, BufferStorage *storage = nullptr);
+	// Queue a write of size bytes of data into dst at dst_offset. The data is copied into
+	// the staging ring immediately so it doesn't need to live until the flush
+	void write(const SubBuffer &dst, const void *data, size_t size, size_t dst_offset = 0);
+	// Submit the copies for all writes queued since the last flush and fence the staging
+	// data they read from, returns the stats for the flush
+	const UploadStats& flush();
+	// Get the stats for the most recent flush
+	const UploadStats& last_flush() const;
+
+private:
+	// Merge the sorted writes into runs and issue a copy for each run
+	void submit(const std::vector<Write> &sorted);
+};
+}
+std::ostream& operator<<(std::ostream &os, const glt::UploadStats &s);
+
+#endif
+
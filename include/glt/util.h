@@ -20,6 +20,8 @@ template<typename T>
 constexpr inline T clamp(T x, T l, T h){
 	return x < l ? l : x > h ? h : x;
 }
+// Get the peak resident set size of the process in bytes, 0 if it's not available
+size_t peak_rss();
 // Get the resource path for resources located under res/<sub_dir>
 // sub_dir defaults to empty to just return res
 std::string get_resource_path(const std::string &sub_dir = "");
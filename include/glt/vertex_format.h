@@ -0,0 +1,114 @@
+#ifndef GLT_VERTEX_FORMAT_H
+#define GLT_VERTEX_FORMAT_H
+
+#include <ostream>
+#include <glm/glm.hpp>
+#include "gl_core_4_5.h"
+
+namespace glt {
+/*
+ * Formats model vertex positions can be stored in
+ * FLOAT: vec3 of floats, 12 bytes
+ * UNORM16: 3 unsigned normalized shorts quantized to the model's bounds, 6 bytes.
+ * 		The model space position is attrib * pos_scale + pos_offset
+ */
+enum class PositionFormat { FLOAT, UNORM16 };
+/*
+ * Formats model vertex normals can be stored in
+ * FLOAT: vec3 of floats, 12 bytes
+ * INT_2_10_10_10_REV: 10 bit signed normalized xyz packed in a GL_INT_2_10_10_10_REV, 4 bytes
+ * OCT16: octahedral encoding in 2 signed normalized shorts, 4 bytes
+ * OCT8: octahedral encoding in 2 signed normalized bytes, 2 bytes
+ * Octahedral normals are decoded in the shader with:
+ * 	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+ * 	if (n.z < 0) n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1), vec2(1), greaterThanEqual(n.xy, vec2(0)));
+ * 	n = normalize(n);
+ */
+enum class NormalFormat { FLOAT, INT_2_10_10_10_REV, OCT16, OCT8 };
+/*
+ * Formats model vertex texcoords can be stored in
+ * FLOAT: vec2 of floats, 8 bytes
+ * HALF: vec2 of half floats, 4 bytes
+ * UNORM16: 2 unsigned normalized shorts quantized to the model's texcoord bounds, 4 bytes.
+ * 		The texcoord is attrib * uv_scale + uv_offset
+ */
+enum class TexcoordFormat { FLOAT, HALF, UNORM16 };
+
+/*
+ * Layout of interleaved position, normal, texcoord vertices, each attribute
+ * stored in the format picked for it. The default is the 32 byte all float layout,
+ * UNORM16 positions with OCT8 normals and HALF texcoords pack a vertex into 12 bytes.
+ * This is the runtime selectable form of VertexLayout, which it forwards to
+ */
+struct VertexFormat {
+	PositionFormat position;
+	NormalFormat normal;
+	TexcoordFormat texcoord;
+
+	VertexFormat(PositionFormat position = PositionFormat::FLOAT, NormalFormat normal = NormalFormat::FLOAT,
+			TexcoordFormat texcoord = TexcoordFormat::FLOAT);
+	// Check if every attribute is stored as floats
+	bool is_float() const;
+	// Byte offsets of the attributes within a vertex, positions are at offset 0
+	size_t normal_offset() const;
+	size_t texcoord_offset() const;
+	// Size of each vertex in bytes
+	size_t stride() const;
+	/*
+	 * Set the formats of the position, normal and texcoord attributes (locations 0, 1 and 2)
+	 * of the bound vertex array and source them from the vertex buffer binding point `binding`
+	 */
+	void set_attrib_formats(GLuint binding = 0) const;
+};
+
+/*
+ * Transform from the stored attributes back to model space for a quantized model,
+ * an identity transform for attributes stored as floats
+ */
+struct Dequantization {
+	glm::vec3 pos_scale, pos_offset;
+	glm::vec2 uv_scale, uv_offset;
+
+	Dequantization();
+};
+
+/*
+ * Error introduced by quantizing vertices, measured by decoding each packed vertex
+ * position: largest distance between original and dequantized positions in model units
+ * position_rel: largest position error relative to the diagonal of the bounds quantized to
+ * position_sq: sum of the squared position errors, for the RMS error
+ * normal: largest angle between original and decoded normals in degrees
+ * texcoord: largest error of a texcoord component
+ * vertices: number of vertices measured
+ */
+struct QuantizationError {
+	float position, position_rel;
+	double position_sq;
+	float normal, texcoord;
+	size_t vertices;
+
+	QuantizationError();
+	float position_rms() const;
+};
+
+/*
+ * Pack `n` interleaved vec3 pos, vec3 normal, vec2 texcoord float vertices into `format`,
+ * writing n * format.stride() bytes to out. Quantized positions and texcoords are fit to the
+ * bounds of the vertices and the transform back to model space is returned in dequant.
+ * The error of the packed vertices is accumulated into err. Packing is done by the
+ * VertexLayout matching the format, see vertex_layout.h to pack a layout known at compile time
+ */
+void pack_vertices(const float *verts, size_t n, const VertexFormat &format, char *out,
+		Dequantization &dequant, QuantizationError &err);
+/*
+ * Unpack `n` vertices packed in `format` with the dequantization dequant back to
+ * vec3 pos, vec3 normal, vec2 texcoord floats, writing 8 * n floats to verts
+ */
+void unpack_vertices(const char *packed, size_t n, const VertexFormat &format,
+		const Dequantization &dequant, float *verts);
+}
+std::ostream& operator<<(std::ostream &os, const glt::VertexFormat &f);
+std::ostream& operator<<(std::ostream &os, const glt::QuantizationError &e);
+
+#endif
+
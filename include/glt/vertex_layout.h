@@ -0,0 +1,464 @@
+#ifndef GLT_VERTEX_LAYOUT_H
+#define GLT_VERTEX_LAYOUT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include "gl_core_4_5.h"
+#include "vertex_format.h"
+
+namespace glt {
+/*
+ * Range a quantized attribute is fit to, the attribute's value is
+ * offset + stored * scale for each component
+ */
+struct AttribRange {
+	float offset[3], scale[3];
+};
+
+namespace detail {
+inline float clamp_unit(float v, float lo){
+	return std::min(std::max(v, lo), 1.f);
+}
+inline uint16_t unorm16(float v, float offset, float scale){
+	return scale == 0 ? 0 : static_cast<uint16_t>(std::round(clamp_unit((v - offset) / scale, 0.f) * 65535.f));
+}
+inline float ununorm16(uint16_t q, float offset, float scale){
+	return offset + static_cast<float>(q) / 65535.f * scale;
+}
+inline int snorm(float v, int max){
+	return static_cast<int>(std::round(clamp_unit(v, -1.f) * max));
+}
+inline float unsnorm(int q, int max){
+	return std::max(static_cast<float>(q) / max, -1.f);
+}
+inline float sign_not_zero(float v){
+	return v >= 0 ? 1.f : -1.f;
+}
+// Get the length of the normal, and its direction in unit if it isn't 0
+inline float normalize(const float *n, float *unit){
+	const float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	const float inv = len > 0 ? 1.f / len : 0.f;
+	for (int i = 0; i < 3; ++i){
+		unit[i] = n[i] * inv;
+	}
+	return len;
+}
+// Map a unit vector onto the octahedron and unfold it onto the [-1, 1] square
+inline void oct_encode(const float *n, float *e){
+	const float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+	e[0] = n[0] / l1;
+	e[1] = n[1] / l1;
+	if (n[2] < 0){
+		const float x = e[0];
+		e[0] = (1.f - std::abs(e[1])) * sign_not_zero(x);
+		e[1] = (1.f - std::abs(x)) * sign_not_zero(e[1]);
+	}
+}
+inline void oct_decode(const float *e, float *n){
+	n[0] = e[0];
+	n[1] = e[1];
+	n[2] = 1.f - std::abs(e[0]) - std::abs(e[1]);
+	if (n[2] < 0){
+		const float x = n[0];
+		n[0] = (1.f - std::abs(n[1])) * sign_not_zero(x);
+		n[1] = (1.f - std::abs(x)) * sign_not_zero(n[1]);
+	}
+	normalize(n, n);
+}
+// Convert to half float with round to nearest, overflowing to infinity
+inline uint16_t float_to_half(float f){
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	const uint32_t sign = (x >> 16) & 0x8000;
+	const uint32_t exp_bits = (x >> 23) & 0xff;
+	uint32_t mant = x & 0x7fffff;
+	if (exp_bits == 0xff){
+		return static_cast<uint16_t>(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+	}
+	const int exp = static_cast<int>(exp_bits) - 127 + 15;
+	if (exp >= 31){
+		return static_cast<uint16_t>(sign | 0x7c00);
+	}
+	if (exp <= 0){
+		// Denormal or too small to represent
+		if (exp < -10){
+			return static_cast<uint16_t>(sign);
+		}
+		mant |= 0x800000;
+		const uint32_t shift = static_cast<uint32_t>(14 - exp);
+		uint32_t h = mant >> shift;
+		if ((mant >> (shift - 1)) & 1){
+			++h;
+		}
+		return static_cast<uint16_t>(sign | h);
+	}
+	// Rounding up may carry into the exponent, which is still the correct result
+	uint32_t h = sign | (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+	if (mant & 0x1000){
+		++h;
+	}
+	return static_cast<uint16_t>(h);
+}
+inline float half_to_float(uint16_t h){
+	const float sign = (h & 0x8000) ? -1.f : 1.f;
+	const int exp = (h >> 10) & 0x1f;
+	const int mant = h & 0x3ff;
+	if (exp == 0){
+		return sign * std::ldexp(static_cast<float>(mant), -24);
+	}
+	if (exp == 31){
+		return mant == 0 ? sign * INFINITY : NAN;
+	}
+	return sign * std::ldexp(static_cast<float>(mant | 0x400), exp - 25);
+}
+}
+
+/*
+ * Vertex attribute formats to build a VertexLayout from. Each describes the bytes it
+ * takes up, the format to give glVertexAttribFormat and how to pack and unpack it
+ * from floats. Attributes which are `quantized` are fit to the AttribRange of the
+ * values being packed, others ignore the range
+ */
+// Position as a vec3 of floats
+struct Pos3f {
+	static constexpr PositionFormat format = PositionFormat::FLOAT;
+	static constexpr size_t size = 3 * sizeof(float), align = 4;
+	static constexpr GLint components = 3;
+	static constexpr GLenum type = GL_FLOAT;
+	static constexpr GLboolean normalized = GL_FALSE;
+	static constexpr bool quantized = false;
+
+	static void pack(const float *v, const AttribRange&, char *out){
+		std::memcpy(out, v, size);
+	}
+	static void unpack(const char *in, const AttribRange&, float *v){
+		std::memcpy(v, in, size);
+	}
+};
+// Position as 3 unsigned normalized shorts fit to the bounds of the positions
+struct Pos16 {
+	static constexpr PositionFormat format = PositionFormat::UNORM16;
+	static constexpr size_t size = 3 * sizeof(uint16_t), align = 4;
+	static constexpr GLint components = 3;
+	static constexpr GLenum type = GL_UNSIGNED_SHORT;
+	static constexpr GLboolean normalized = GL_TRUE;
+	static constexpr bool quantized = true;
+
+	static void pack(const float *v, const AttribRange &r, char *out){
+		const uint16_t q[3] = { detail::unorm16(v[0], r.offset[0], r.scale[0]),
+			detail::unorm16(v[1], r.offset[1], r.scale[1]), detail::unorm16(v[2], r.offset[2], r.scale[2]) };
+		std::memcpy(out, q, size);
+	}
+	static void unpack(const char *in, const AttribRange &r, float *v){
+		uint16_t q[3];
+		std::memcpy(q, in, size);
+		for (int i = 0; i < 3; ++i){
+			v[i] = detail::ununorm16(q[i], r.offset[i], r.scale[i]);
+		}
+	}
+};
+// Normal as a vec3 of floats
+struct Normal3f {
+	static constexpr NormalFormat format = NormalFormat::FLOAT;
+	static constexpr size_t size = 3 * sizeof(float), align = 4;
+	static constexpr GLint components = 3;
+	static constexpr GLenum type = GL_FLOAT;
+	static constexpr GLboolean normalized = GL_FALSE;
+	static constexpr bool quantized = false;
+
+	static void pack(const float *n, const AttribRange&, char *out){
+		std::memcpy(out, n, size);
+	}
+	static void unpack(const char *in, const AttribRange&, float *n){
+		std::memcpy(n, in, size);
+	}
+};
+// Normal as 10 bit signed normalized xyz in a GL_INT_2_10_10_10_REV, w is 0
+struct Normal1010102 {
+	static constexpr NormalFormat format = NormalFormat::INT_2_10_10_10_REV;
+	static constexpr size_t size = 4, align = 4;
+	static constexpr GLint components = 4;
+	static constexpr GLenum type = GL_INT_2_10_10_10_REV;
+	static constexpr GLboolean normalized = GL_TRUE;
+	static constexpr bool quantized = false;
+
+	static void pack(const float *n, const AttribRange&, char *out){
+		float unit[3];
+		detail::normalize(n, unit);
+		uint32_t packed = 0;
+		for (int i = 0; i < 3; ++i){
+			packed |= (static_cast<uint32_t>(detail::snorm(unit[i], 511)) & 0x3ff) << (10 * i);
+		}
+		std::memcpy(out, &packed, size);
+	}
+	// Unpacks to the renormalized normal, as the shader would use it
+	static void unpack(const char *in, const AttribRange&, float *n){
+		uint32_t packed;
+		std::memcpy(&packed, in, size);
+		for (int i = 0; i < 3; ++i){
+			// Sign extend the 10 bit component
+			const int q = static_cast<int>((packed >> (10 * i)) & 0x3ff);
+			n[i] = detail::unsnorm(q >= 512 ? q - 1024 : q, 511);
+		}
+		detail::normalize(n, n);
+	}
+};
+// Octahedral encoded normal in 2 signed normalized integers of type T, decoded in the shader.
+// Normals of length 0 are stored as 0, which decodes to +Z
+template<typename T, NormalFormat F, GLenum GLType>
+struct NormalOctT {
+	static constexpr NormalFormat format = F;
+	static constexpr size_t size = 2 * sizeof(T), align = sizeof(T) == 1 ? 2 : 4;
+	static constexpr GLint components = 2;
+	static constexpr GLenum type = GLType;
+	static constexpr GLboolean normalized = GL_TRUE;
+	static constexpr bool quantized = false;
+	static constexpr int max = sizeof(T) == 1 ? 127 : 32767;
+
+	static void pack(const float *n, const AttribRange&, char *out){
+		float unit[3], e[2] = { 0, 0 };
+		if (detail::normalize(n, unit) > 0){
+			detail::oct_encode(unit, e);
+		}
+		const T q[2] = { static_cast<T>(detail::snorm(e[0], max)), static_cast<T>(detail::snorm(e[1], max)) };
+		std::memcpy(out, q, size);
+	}
+	static void unpack(const char *in, const AttribRange&, float *n){
+		T q[2];
+		std::memcpy(q, in, size);
+		const float e[2] = { detail::unsnorm(q[0], max), detail::unsnorm(q[1], max) };
+		detail::oct_decode(e, n);
+	}
+};
+typedef NormalOctT<int16_t, NormalFormat::OCT16, GL_SHORT> NormalOct;
+typedef NormalOctT<int8_t, NormalFormat::OCT8, GL_BYTE> NormalOct8;
+// Texcoord as a vec2 of floats
+struct UV2f {
+	static constexpr TexcoordFormat format = TexcoordFormat::FLOAT;
+	static constexpr size_t size = 2 * sizeof(float), align = 4;
+	static constexpr GLint components = 2;
+	static constexpr GLenum type = GL_FLOAT;
+	static constexpr GLboolean normalized = GL_FALSE;
+	static constexpr bool quantized = false;
+
+	static void pack(const float *uv, const AttribRange&, char *out){
+		std::memcpy(out, uv, size);
+	}
+	static void unpack(const char *in, const AttribRange&, float *uv){
+		std::memcpy(uv, in, size);
+	}
+};
+// Texcoord as a vec2 of half floats
+struct UVHalf {
+	static constexpr TexcoordFormat format = TexcoordFormat::HALF;
+	static constexpr size_t size = 2 * sizeof(uint16_t), align = 4;
+	static constexpr GLint components = 2;
+	static constexpr GLenum type = GL_HALF_FLOAT;
+	static constexpr GLboolean normalized = GL_FALSE;
+	static constexpr bool quantized = false;
+
+	static void pack(const float *uv, const AttribRange&, char *out){
+		const uint16_t q[2] = { detail::float_to_half(uv[0]), detail::float_to_half(uv[1]) };
+		std::memcpy(out, q, size);
+	}
+	static void unpack(const char *in, const AttribRange&, float *uv){
+		uint16_t q[2];
+		std::memcpy(q, in, size);
+		uv[0] = detail::half_to_float(q[0]);
+		uv[1] = detail::half_to_float(q[1]);
+	}
+};
+// Texcoord as 2 unsigned normalized shorts fit to the bounds of the texcoords
+struct UV16 {
+	static constexpr TexcoordFormat format = TexcoordFormat::UNORM16;
+	static constexpr size_t size = 2 * sizeof(uint16_t), align = 4;
+	static constexpr GLint components = 2;
+	static constexpr GLenum type = GL_UNSIGNED_SHORT;
+	static constexpr GLboolean normalized = GL_TRUE;
+	static constexpr bool quantized = true;
+
+	static void pack(const float *uv, const AttribRange &r, char *out){
+		const uint16_t q[2] = { detail::unorm16(uv[0], r.offset[0], r.scale[0]),
+			detail::unorm16(uv[1], r.offset[1], r.scale[1]) };
+		std::memcpy(out, q, size);
+	}
+	static void unpack(const char *in, const AttribRange &r, float *uv){
+		uint16_t q[2];
+		std::memcpy(q, in, size);
+		uv[0] = detail::ununorm16(q[0], r.offset[0], r.scale[0]);
+		uv[1] = detail::ununorm16(q[1], r.offset[1], r.scale[1]);
+	}
+};
+
+/*
+ * Models are loaded, welded and optimized as interleaved vec3 pos, vec3 normal, vec2 texcoord
+ * float vertices before being packed into the layout they're stored in. These are the number
+ * of floats in each of those vertices and the offsets in floats of the normal and texcoord
+ */
+const size_t FLOAT_VERTEX_NORMAL = Pos3f::components;
+const size_t FLOAT_VERTEX_TEXCOORD = FLOAT_VERTEX_NORMAL + Normal3f::components;
+const size_t FLOAT_VERTEX_FLOATS = FLOAT_VERTEX_TEXCOORD + UV2f::components;
+
+/*
+ * Compile time description of an interleaved position, normal, texcoord vertex with each
+ * attribute stored in the format given, eg. VertexLayout<Pos16, NormalOct8, UVHalf> is the
+ * 12 byte quantized vertex. The stride and offsets are constants and packing is specialised
+ * for the attributes, so there's no branching on the format per vertex. Offsets and stride
+ * match those of the runtime VertexFormat for the same attributes
+ */
+template<typename Pos, typename Normal, typename UV>
+struct VertexLayout {
+	static constexpr size_t align_up(size_t x, size_t align){
+		return (x + align - 1) / align * align;
+	}
+	static constexpr size_t position_offset(){
+		return 0;
+	}
+	static constexpr size_t normal_offset(){
+		return align_up(Pos::size, Normal::align);
+	}
+	static constexpr size_t texcoord_offset(){
+		return align_up(normal_offset() + Normal::size, UV::align);
+	}
+	static constexpr size_t stride(){
+		return align_up(texcoord_offset() + UV::size, 4);
+	}
+	static VertexFormat format(){
+		return VertexFormat(Pos::format, Normal::format, UV::format);
+	}
+	/*
+	 * Set the formats of the position, normal and texcoord attributes (locations 0, 1 and 2)
+	 * of the bound vertex array and source them from the vertex buffer binding point `binding`
+	 */
+	static void set_attrib_formats(GLuint binding = 0){
+		glVertexAttribFormat(0, Pos::components, Pos::type, Pos::normalized, position_offset());
+		glVertexAttribFormat(1, Normal::components, Normal::type, Normal::normalized, normal_offset());
+		glVertexAttribFormat(2, UV::components, UV::type, UV::normalized, texcoord_offset());
+		for (GLuint i = 0; i < 3; ++i){
+			glVertexAttribBinding(i, binding);
+			glEnableVertexAttribArray(i);
+		}
+	}
+	/*
+	 * Pack `n` vec3 pos, vec3 normal, vec2 texcoord float vertices into the layout, writing
+	 * n * stride() bytes to out. Quantized attributes are fit to the bounds of the vertices
+	 * and the transform back to model space is returned in dequant
+	 */
+	static void pack(const float *verts, size_t n, char *out, Dequantization &dequant){
+		AttribRange pos_range, uv_range;
+		find_ranges(verts, n, pos_range, uv_range, dequant);
+		std::memset(out, 0, n * stride());
+		for (size_t v = 0; v < n; ++v, verts += FLOAT_VERTEX_FLOATS, out += stride()){
+			Pos::pack(verts, pos_range, out + position_offset());
+			Normal::pack(verts + FLOAT_VERTEX_NORMAL, pos_range, out + normal_offset());
+			UV::pack(verts + FLOAT_VERTEX_TEXCOORD, uv_range, out + texcoord_offset());
+		}
+	}
+	/*
+	 * Unpack `n` vertices packed with dequant back to vec3 pos, vec3 normal, vec2 texcoord floats
+	 */
+	static void unpack(const char *packed, size_t n, const Dequantization &dequant, float *verts){
+		AttribRange pos_range, uv_range;
+		ranges(dequant, pos_range, uv_range);
+		for (size_t v = 0; v < n; ++v, verts += FLOAT_VERTEX_FLOATS, packed += stride()){
+			Pos::unpack(packed + position_offset(), pos_range, verts);
+			Normal::unpack(packed + normal_offset(), pos_range, verts + 3);
+			UV::unpack(packed + texcoord_offset(), uv_range, verts + 6);
+		}
+	}
+	/*
+	 * Accumulate the error between the float vertices and the ones packed from them into err
+	 */
+	static void measure_error(const float *verts, size_t n, const char *packed, const Dequantization &dequant,
+			QuantizationError &err)
+	{
+		AttribRange pos_range, uv_range;
+		ranges(dequant, pos_range, uv_range);
+		const float diagonal = std::sqrt(pos_range.scale[0] * pos_range.scale[0]
+				+ pos_range.scale[1] * pos_range.scale[1] + pos_range.scale[2] * pos_range.scale[2]);
+		for (size_t v = 0; v < n; ++v, verts += FLOAT_VERTEX_FLOATS, packed += stride()){
+			float d[FLOAT_VERTEX_FLOATS];
+			Pos::unpack(packed + position_offset(), pos_range, d);
+			Normal::unpack(packed + normal_offset(), pos_range, d + 3);
+			UV::unpack(packed + texcoord_offset(), uv_range, d + 6);
+			float pos_sq = 0;
+			for (int i = 0; i < 3; ++i){
+				pos_sq += (d[i] - verts[i]) * (d[i] - verts[i]);
+			}
+			err.position_sq += pos_sq;
+			err.position = std::max(err.position, std::sqrt(pos_sq));
+			if (Pos::quantized && diagonal > 0){
+				err.position_rel = std::max(err.position_rel, std::sqrt(pos_sq) / diagonal);
+			}
+			// Models without normals have them left as 0, there's nothing to measure
+			float unit[3];
+			if (detail::normalize(verts + FLOAT_VERTEX_NORMAL, unit) > 0){
+				float decoded[3];
+				detail::normalize(d + FLOAT_VERTEX_NORMAL, decoded);
+				// atan2 of the cross and dot products is accurate for the tiny angles we expect
+				const float cross[3] = { unit[1] * decoded[2] - unit[2] * decoded[1],
+					unit[2] * decoded[0] - unit[0] * decoded[2], unit[0] * decoded[1] - unit[1] * decoded[0] };
+				const float sin_angle = std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+				const float cos_angle = unit[0] * decoded[0] + unit[1] * decoded[1] + unit[2] * decoded[2];
+				err.normal = std::max(err.normal, std::atan2(sin_angle, cos_angle) * 180.f / 3.14159265f);
+			}
+			for (size_t i = FLOAT_VERTEX_TEXCOORD; i < FLOAT_VERTEX_FLOATS; ++i){
+				err.texcoord = std::max(err.texcoord, std::abs(d[i] - verts[i]));
+			}
+		}
+		err.vertices += n;
+	}
+
+private:
+	static void find_ranges(const float *verts, size_t n, AttribRange &pos_range, AttribRange &uv_range,
+			Dequantization &dequant)
+	{
+		dequant = Dequantization{};
+		if (n != 0 && Pos::quantized){
+			glm::vec3 lo(verts[0], verts[1], verts[2]), hi = lo;
+			for (const float *p = verts; p != verts + n * FLOAT_VERTEX_FLOATS; p += FLOAT_VERTEX_FLOATS){
+				const glm::vec3 pos(p[0], p[1], p[2]);
+				lo = glm::min(lo, pos);
+				hi = glm::max(hi, pos);
+			}
+			dequant.pos_offset = lo;
+			dequant.pos_scale = hi - lo;
+		}
+		if (n != 0 && UV::quantized){
+			const float *t = verts + FLOAT_VERTEX_TEXCOORD;
+			glm::vec2 lo(t[0], t[1]), hi = lo;
+			for (const float *p = t; p != t + n * FLOAT_VERTEX_FLOATS; p += FLOAT_VERTEX_FLOATS){
+				const glm::vec2 uv(p[0], p[1]);
+				lo = glm::min(lo, uv);
+				hi = glm::max(hi, uv);
+			}
+			dequant.uv_offset = lo;
+			dequant.uv_scale = hi - lo;
+		}
+		ranges(dequant, pos_range, uv_range);
+	}
+	static void ranges(const Dequantization &dequant, AttribRange &pos_range, AttribRange &uv_range){
+		for (int i = 0; i < 3; ++i){
+			pos_range.offset[i] = dequant.pos_offset[i];
+			pos_range.scale[i] = dequant.pos_scale[i];
+		}
+		for (int i = 0; i < 2; ++i){
+			uv_range.offset[i] = dequant.uv_offset[i];
+			uv_range.scale[i] = dequant.uv_scale[i];
+		}
+		uv_range.offset[2] = 0;
+		uv_range.scale[2] = 1;
+	}
+};
+// The float vertices models are loaded in, as a layout to pack them with
+typedef VertexLayout<Pos3f, Normal3f, UV2f> FloatVertexLayout;
+static_assert(FloatVertexLayout::stride() == FLOAT_VERTEX_FLOATS * sizeof(float)
+		&& FloatVertexLayout::normal_offset() == FLOAT_VERTEX_NORMAL * sizeof(float)
+		&& FloatVertexLayout::texcoord_offset() == FLOAT_VERTEX_TEXCOORD * sizeof(float),
+		"FloatVertexLayout must be tightly packed floats");
+}
+
+#endif
+
@@ -0,0 +1,632 @@
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include "glt/alloc_engine.h"
+
+using namespace glt;
+
+// Index of the lowest set bit, x must be non-zero
+static int find_first_set(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int i = 0;
+	for (; (x & 1) == 0; x >>= 1, ++i);
+	return i;
+#endif
+}
+// Index of the highest set bit, x must be non-zero
+static int find_last_set(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(x);
+#else
+	int i = -1;
+	for (; x != 0; x >>= 1, ++i);
+	return i;
+#endif
+}
+static size_t align_up(size_t x, size_t align){
+	return x % align == 0 ? x : x + align - x % align;
+}
+
+std::unique_ptr<AllocEngine> glt::make_alloc_engine(AllocStrategy strategy, size_t size){
+	switch (strategy){
+		case AllocStrategy::TLSF:
+			return std::unique_ptr<AllocEngine>(new TLSFEngine(size));
+		case AllocStrategy::BUDDY:
+			return std::unique_ptr<AllocEngine>(new BuddyEngine(size));
+		default:
+			return std::unique_ptr<AllocEngine>(new FirstFitEngine(size));
+	}
+}
+
+size_t glt::min_region_size(AllocStrategy strategy, size_t sz, size_t align){
+	size_t need = sz + (align > 1 ? align - 1 : 0);
+	switch (strategy){
+		case AllocStrategy::TLSF:
+			// TLSF rounds its search up to the next bin so the region must be at least that large
+			if (need >= 16){
+				need += (size_t{1} << (find_last_set(need) - 4)) - 1;
+			}
+			return need;
+		case AllocStrategy::BUDDY:
+			{
+				// The buddy allocator needs a single power of two block for the allocation
+				size_t block = 16;
+				for (; block < need; block *= 2);
+				return block;
+			}
+		default:
+			return need;
+	}
+}
+
+glt::FirstFitEngine::FirstFitEngine(size_t size) : total_free(size){
+	freeb.insert(std::make_pair(0, Block { 0, size }));
+}
+bool glt::FirstFitEngine::alloc(size_t sz, size_t align, size_t &offset){
+	for (auto b = freeb.begin(); b != freeb.end(); ++b){
+		// Account for alignment requirements of allocation requests
+		size_t align_offset = b->second.offset % align == 0 ? 0
+			: align - b->second.offset % align;
+		if (sz + align_offset <= b->second.size){
+			// The actual offset of the block we're allocating, accounting for alignment
+			offset = b->second.offset + align_offset;
+			const Block block = b->second;
+			// We have to re-insert since the block's offset will change
+			// even if we still have some free space left
+			freeb.erase(b);
+			used.insert(std::make_pair(offset, Block { offset, sz }));
+			size_t rem = block.size - sz - align_offset;
+			if (rem != 0){
+				freeb.insert(std::make_pair(offset + sz, Block { offset + sz, rem }));
+			}
+			// If we left some in front of the block due to alignment requirements insert that block too
+			if (align_offset != 0){
+				freeb.insert(std::make_pair(block.offset, Block { block.offset, align_offset }));
+			}
+			total_free -= sz;
+			return true;
+		}
+	}
+	return false;
+}
+bool glt::FirstFitEngine::grow(size_t offset, size_t new_sz){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	if (new_sz <= u->second.size){
+		return true;
+	}
+	// See if the block after the one used is available
+	auto fnd = freeb.find(offset + u->second.size);
+	if (fnd != freeb.end() && new_sz <= u->second.size + fnd->second.size){
+		const Block block = fnd->second;
+		freeb.erase(fnd);
+		size_t amt = new_sz - u->second.size;
+		u->second.size += amt;
+		if (amt != block.size){
+			freeb.insert(std::make_pair(block.offset + amt, Block { block.offset + amt, block.size - amt }));
+		}
+		total_free -= amt;
+		return true;
+	}
+	return false;
+}
+bool glt::FirstFitEngine::grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	const size_t old_end = offset + u->second.size;
+	if (new_sz <= u->second.size){
+		return false;
+	}
+	// Find the free blocks directly before and after the allocation
+	auto prev = freeb.lower_bound(offset);
+	if (prev == freeb.begin()){
+		return false;
+	}
+	--prev;
+	if (prev->second.offset + prev->second.size != offset){
+		return false;
+	}
+	auto next = freeb.find(old_end);
+	const size_t end = next != freeb.end() ? old_end + next->second.size : old_end;
+	// Start as low as we can to move the data as far as possible, which takes the fewest
+	// non-overlapping copies. Any space left past the new end goes back to the free list
+	const size_t start = align_up(prev->second.offset, align);
+	if (start >= offset || offset - start < min_shift || start + new_sz > end){
+		return false;
+	}
+	const Block before = prev->second;
+	freeb.erase(prev);
+	if (next != freeb.end()){
+		freeb.erase(next);
+	}
+	if (start != before.offset){
+		freeb.insert(std::make_pair(before.offset, Block { before.offset, start - before.offset }));
+	}
+	if (start + new_sz != end){
+		freeb.insert(std::make_pair(start + new_sz, Block { start + new_sz, end - start - new_sz }));
+	}
+	total_free -= new_sz - u->second.size;
+	used.erase(u);
+	used.insert(std::make_pair(start, Block { start, new_sz }));
+	new_offset = start;
+	return true;
+}
+bool glt::FirstFitEngine::split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails){
+	auto u = used.find(offset);
+	assert(u != used.end() && new_sz != 0);
+	if (new_sz >= u->second.size){
+		return false;
+	}
+	const Block tail { offset + new_sz, u->second.size - new_sz };
+	u->second.size = new_sz;
+	used.insert(std::make_pair(tail.offset, tail));
+	tails.push_back(tail);
+	return true;
+}
+void glt::FirstFitEngine::free(size_t offset){
+	auto fnd = used.find(offset);
+	assert(fnd != used.end());
+	Block rel = fnd->second;
+	used.erase(fnd);
+	total_free += rel.size;
+	// Merge with the free block directly after the released one
+	auto next = freeb.find(rel.offset + rel.size);
+	if (next != freeb.end()){
+		rel.size += next->second.size;
+		freeb.erase(next);
+	}
+	// And with the free block directly before it
+	auto it = freeb.insert(std::make_pair(rel.offset, rel)).first;
+	if (it != freeb.begin()){
+		auto prev = std::prev(it);
+		if (prev->second.offset + prev->second.size == rel.offset){
+			prev->second.size += rel.size;
+			freeb.erase(it);
+		}
+	}
+}
+size_t glt::FirstFitEngine::free_bytes() const {
+	return total_free;
+}
+size_t glt::FirstFitEngine::largest_free() const {
+	size_t largest = 0;
+	for (const auto &f : freeb){
+		largest = std::max(largest, f.second.size);
+	}
+	return largest;
+}
+void glt::FirstFitEngine::used_blocks(std::vector<Block> &blocks) const {
+	for (const auto &u : used){
+		blocks.push_back(u.second);
+	}
+}
+void glt::FirstFitEngine::print(std::ostream &os) const {
+	os << "\tfree blocks:\n";
+	for (const auto &f : freeb){
+		os << "\t\t" << f.second << "\n";
+	}
+	os << "\tused blocks:\n";
+	for (const auto &u : used){
+		os << "\t\t" << u.second << "\n";
+	}
+}
+
+// Find the first and second level bin for a block of size sz
+static void tlsf_mapping(size_t sz, int sl_log2, int &fl, int &sl){
+	if (sz < (size_t{1} << sl_log2)){
+		fl = 0;
+		sl = static_cast<int>(sz);
+	}
+	else {
+		int f = find_last_set(sz);
+		fl = f - sl_log2 + 1;
+		sl = static_cast<int>(sz >> (f - sl_log2)) ^ (1 << sl_log2);
+	}
+}
+const uint32_t glt::TLSFEngine::NIL;
+const int glt::TLSFEngine::SL_LOG2;
+const int glt::TLSFEngine::SL_COUNT;
+const int glt::TLSFEngine::FL_COUNT;
+glt::TLSFEngine::TLSFEngine(size_t size) : fl_bitmap(0), total_free(size){
+	std::fill(std::begin(sl_bitmap), std::end(sl_bitmap), 0);
+	for (auto &fl : heads){
+		std::fill(std::begin(fl), std::end(fl), NIL);
+	}
+	uint32_t n = new_node();
+	nodes[n] = Node { 0, size, NIL, NIL, NIL, NIL, true };
+	insert_free(n);
+}
+bool glt::TLSFEngine::alloc(size_t sz, size_t align, size_t &offset){
+	sz = std::max(sz, size_t{1});
+	// Search for a block big enough to hold the allocation at any alignment
+	// and round up to the next bin so any block found in it is large enough
+	size_t search = sz + (align > 1 ? align - 1 : 0);
+	if (search >= SL_COUNT){
+		search += (size_t{1} << (find_last_set(search) - SL_LOG2)) - 1;
+	}
+	int fl, sl;
+	tlsf_mapping(search, SL_LOG2, fl, sl);
+	if (fl >= FL_COUNT){
+		return false;
+	}
+	uint32_t n = find_suitable(fl, sl);
+	if (n == NIL){
+		return false;
+	}
+	remove_free(n);
+	// Give back any space skipped over to meet the alignment
+	const size_t pad = align_up(nodes[n].offset, align) - nodes[n].offset;
+	if (pad != 0){
+		uint32_t rest = split(n, pad);
+		insert_free(n);
+		n = rest;
+	}
+	if (nodes[n].size > sz){
+		insert_free(split(n, sz));
+	}
+	nodes[n].free = false;
+	offset = nodes[n].offset;
+	used[offset] = n;
+	total_free -= sz;
+	return true;
+}
+bool glt::TLSFEngine::grow(size_t offset, size_t new_sz){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	const uint32_t n = u->second;
+	if (new_sz <= nodes[n].size){
+		return true;
+	}
+	const uint32_t next = nodes[n].next_phys;
+	if (next == NIL || !nodes[next].free || nodes[n].size + nodes[next].size < new_sz){
+		return false;
+	}
+	remove_free(next);
+	const size_t amt = new_sz - nodes[n].size;
+	if (amt == nodes[next].size){
+		absorb(n, next);
+	}
+	else {
+		nodes[n].size += amt;
+		nodes[next].offset += amt;
+		nodes[next].size -= amt;
+		insert_free(next);
+	}
+	total_free -= amt;
+	return true;
+}
+bool glt::TLSFEngine::grow_back(size_t offset, size_t new_sz, size_t align, size_t min_shift, size_t &new_offset){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	uint32_t n = u->second;
+	const size_t old_size = nodes[n].size;
+	const size_t old_end = offset + old_size;
+	const uint32_t prev = nodes[n].prev_phys;
+	if (new_sz <= old_size || prev == NIL || !nodes[prev].free){
+		return false;
+	}
+	const uint32_t next = nodes[n].next_phys;
+	const bool next_free = next != NIL && nodes[next].free;
+	const size_t end = next_free ? old_end + nodes[next].size : old_end;
+	// Start as low as we can to move the data as far as possible, which takes the fewest
+	// non-overlapping copies. Any space left past the new end goes back to the free list
+	const size_t start = align_up(nodes[prev].offset, align);
+	if (start >= offset || offset - start < min_shift || start + new_sz > end){
+		return false;
+	}
+	// Merge the neighbours and the allocation into one node then cut the new allocation out of it
+	remove_free(prev);
+	absorb(prev, n);
+	n = prev;
+	if (next_free){
+		remove_free(next);
+		absorb(n, next);
+	}
+	if (start != nodes[n].offset){
+		const uint32_t rest = split(n, start - nodes[n].offset);
+		insert_free(n);
+		n = rest;
+	}
+	if (nodes[n].size > new_sz){
+		insert_free(split(n, new_sz));
+	}
+	nodes[n].free = false;
+	used.erase(u);
+	used[start] = n;
+	total_free -= new_sz - old_size;
+	new_offset = start;
+	return true;
+}
+bool glt::TLSFEngine::split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails){
+	auto u = used.find(offset);
+	assert(u != used.end() && new_sz != 0);
+	const uint32_t n = u->second;
+	if (new_sz >= nodes[n].size){
+		return false;
+	}
+	const uint32_t tail = split(n, new_sz);
+	nodes[tail].free = false;
+	used[nodes[tail].offset] = tail;
+	tails.push_back(Block { nodes[tail].offset, nodes[tail].size });
+	return true;
+}
+void glt::TLSFEngine::free(size_t offset){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	uint32_t n = u->second;
+	used.erase(u);
+	total_free += nodes[n].size;
+	nodes[n].free = true;
+	// Coalesce with free physical neighbours on either side
+	const uint32_t prev = nodes[n].prev_phys;
+	if (prev != NIL && nodes[prev].free){
+		remove_free(prev);
+		absorb(prev, n);
+		n = prev;
+	}
+	const uint32_t next = nodes[n].next_phys;
+	if (next != NIL && nodes[next].free){
+		remove_free(next);
+		absorb(n, next);
+	}
+	insert_free(n);
+}
+size_t glt::TLSFEngine::free_bytes() const {
+	return total_free;
+}
+size_t glt::TLSFEngine::largest_free() const {
+	if (fl_bitmap == 0){
+		return 0;
+	}
+	// The largest block is somewhere in the highest non-empty bin
+	const int fl = find_last_set(fl_bitmap);
+	const int sl = find_last_set(sl_bitmap[fl]);
+	size_t largest = 0;
+	for (uint32_t n = heads[fl][sl]; n != NIL; n = nodes[n].next_free){
+		largest = std::max(largest, nodes[n].size);
+	}
+	return largest;
+}
+void glt::TLSFEngine::used_blocks(std::vector<Block> &blocks) const {
+	for (const auto &u : used){
+		blocks.push_back(Block { nodes[u.second].offset, nodes[u.second].size });
+	}
+}
+void glt::TLSFEngine::print(std::ostream &os) const {
+	// Find the first block in the buffer and walk the physical links
+	uint32_t n = 0;
+	while (nodes[n].prev_phys != NIL){
+		n = nodes[n].prev_phys;
+	}
+	std::vector<Block> freeb, usedb;
+	for (; n != NIL; n = nodes[n].next_phys){
+		const Block b { nodes[n].offset, nodes[n].size };
+		if (nodes[n].free){
+			freeb.push_back(b);
+		}
+		else {
+			usedb.push_back(b);
+		}
+	}
+	os << "\tfree blocks:\n";
+	for (const auto &f : freeb){
+		os << "\t\t" << f << "\n";
+	}
+	os << "\tused blocks:\n";
+	for (const auto &u : usedb){
+		os << "\t\t" << u << "\n";
+	}
+}
+uint32_t glt::TLSFEngine::new_node(){
+	if (!unused_nodes.empty()){
+		uint32_t n = unused_nodes.back();
+		unused_nodes.pop_back();
+		return n;
+	}
+	nodes.push_back(Node {});
+	return static_cast<uint32_t>(nodes.size() - 1);
+}
+void glt::TLSFEngine::release_node(uint32_t n){
+	unused_nodes.push_back(n);
+}
+uint32_t glt::TLSFEngine::split(uint32_t n, size_t sz){
+	assert(sz < nodes[n].size);
+	const uint32_t m = new_node();
+	nodes[m] = Node { nodes[n].offset + sz, nodes[n].size - sz, n, nodes[n].next_phys, NIL, NIL, true };
+	if (nodes[m].next_phys != NIL){
+		nodes[nodes[m].next_phys].prev_phys = m;
+	}
+	nodes[n].next_phys = m;
+	nodes[n].size = sz;
+	return m;
+}
+void glt::TLSFEngine::absorb(uint32_t a, uint32_t b){
+	assert(nodes[a].next_phys == b);
+	nodes[a].size += nodes[b].size;
+	nodes[a].next_phys = nodes[b].next_phys;
+	if (nodes[a].next_phys != NIL){
+		nodes[nodes[a].next_phys].prev_phys = a;
+	}
+	release_node(b);
+}
+void glt::TLSFEngine::insert_free(uint32_t n){
+	int fl, sl;
+	tlsf_mapping(nodes[n].size, SL_LOG2, fl, sl);
+	nodes[n].free = true;
+	nodes[n].prev_free = NIL;
+	nodes[n].next_free = heads[fl][sl];
+	if (heads[fl][sl] != NIL){
+		nodes[heads[fl][sl]].prev_free = n;
+	}
+	heads[fl][sl] = n;
+	fl_bitmap |= uint64_t{1} << fl;
+	sl_bitmap[fl] |= 1u << sl;
+}
+void glt::TLSFEngine::remove_free(uint32_t n){
+	int fl, sl;
+	tlsf_mapping(nodes[n].size, SL_LOG2, fl, sl);
+	const uint32_t prev = nodes[n].prev_free;
+	const uint32_t next = nodes[n].next_free;
+	if (prev != NIL){
+		nodes[prev].next_free = next;
+	}
+	if (next != NIL){
+		nodes[next].prev_free = prev;
+	}
+	if (heads[fl][sl] == n){
+		heads[fl][sl] = next;
+		if (next == NIL){
+			sl_bitmap[fl] &= ~(1u << sl);
+			if (sl_bitmap[fl] == 0){
+				fl_bitmap &= ~(uint64_t{1} << fl);
+			}
+		}
+	}
+	nodes[n].prev_free = NIL;
+	nodes[n].next_free = NIL;
+}
+uint32_t glt::TLSFEngine::find_suitable(int fl, int sl) const {
+	uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+	if (sl_map == 0){
+		// Nothing left in this first level bin, move up to the next non-empty one
+		const uint64_t fl_map = fl + 1 < FL_COUNT ? fl_bitmap & (~uint64_t{0} << (fl + 1)) : 0;
+		if (fl_map == 0){
+			return NIL;
+		}
+		fl = find_first_set(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+	return heads[fl][find_first_set(sl_map)];
+}
+
+const size_t glt::BuddyEngine::MIN_BLOCK;
+glt::BuddyEngine::BuddyEngine(size_t size) : total_free(0){
+	// Carve the region into the largest power of two blocks we can fit, walking
+	// up from the start so each block is aligned to its size. Any blocks past
+	// the end of the region never exist so they're never free to merge with
+	size_t offset = 0;
+	for (size_t rem = size / MIN_BLOCK; rem != 0;){
+		int order = find_last_set(rem);
+		if (free_lists.size() <= static_cast<size_t>(order)){
+			free_lists.resize(order + 1);
+		}
+		free_lists[order].insert(offset);
+		offset += MIN_BLOCK << order;
+		total_free += MIN_BLOCK << order;
+		rem -= size_t{1} << order;
+	}
+}
+bool glt::BuddyEngine::alloc(size_t sz, size_t align, size_t &offset){
+	// Blocks are aligned to their size so power of two alignments can be met by
+	// picking a large enough block, others need room to shift the allocation within it
+	const bool pow2_align = (align & (align - 1)) == 0;
+	size_t need = pow2_align ? std::max(sz, align) : sz + align - 1;
+	need = std::max(need, MIN_BLOCK);
+	int order = find_last_set((need + MIN_BLOCK - 1) / MIN_BLOCK);
+	if ((MIN_BLOCK << order) < need){
+		++order;
+	}
+	int found = order;
+	for (; static_cast<size_t>(found) < free_lists.size() && free_lists[found].empty(); ++found);
+	if (static_cast<size_t>(found) >= free_lists.size()){
+		return false;
+	}
+	size_t block = *free_lists[found].begin();
+	free_lists[found].erase(free_lists[found].begin());
+	// Split the block down to the order we need, freeing the upper halves
+	while (found > order){
+		--found;
+		free_lists[found].insert(block + (MIN_BLOCK << found));
+	}
+	offset = align_up(block, align);
+	used[offset] = Alloc { block, order };
+	total_free -= MIN_BLOCK << order;
+	return true;
+}
+bool glt::BuddyEngine::grow(size_t offset, size_t new_sz){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	return offset + new_sz <= u->second.block + (MIN_BLOCK << u->second.order);
+}
+bool glt::BuddyEngine::grow_back(size_t, size_t, size_t, size_t, size_t&){
+	// Blocks can only merge with their buddy, so there's no growing into arbitrary space before them
+	return false;
+}
+bool glt::BuddyEngine::split_tail(size_t offset, size_t new_sz, std::vector<Block> &tails){
+	auto u = used.find(offset);
+	assert(u != used.end() && new_sz != 0);
+	Alloc &a = u->second;
+	const size_t first = tails.size();
+	// Halve the block while the allocation still fits in the lower half, the upper
+	// halves become separate allocations
+	while (a.order > 0 && offset + new_sz <= a.block + (MIN_BLOCK << (a.order - 1))){
+		--a.order;
+		const size_t upper = a.block + (MIN_BLOCK << a.order);
+		used[upper] = Alloc { upper, a.order };
+		tails.push_back(Block { upper, MIN_BLOCK << a.order });
+	}
+	return tails.size() != first;
+}
+void glt::BuddyEngine::free(size_t offset){
+	auto u = used.find(offset);
+	assert(u != used.end());
+	size_t block = u->second.block;
+	int order = u->second.order;
+	used.erase(u);
+	total_free += MIN_BLOCK << order;
+	// Merge with our buddy for as long as it's free as well
+	while (static_cast<size_t>(order) + 1 < free_lists.size()){
+		const size_t buddy = block ^ (MIN_BLOCK << order);
+		if (free_lists[order].erase(buddy) == 0){
+			break;
+		}
+		block = std::min(block, buddy);
+		++order;
+	}
+	free_lists[order].insert(block);
+}
+size_t glt::BuddyEngine::free_bytes() const {
+	return total_free;
+}
+size_t glt::BuddyEngine::largest_free() const {
+	for (size_t i = free_lists.size(); i > 0; --i){
+		if (!free_lists[i - 1].empty()){
+			return MIN_BLOCK << (i - 1);
+		}
+	}
+	return 0;
+}
+void glt::BuddyEngine::used_blocks(std::vector<Block> &blocks) const {
+	for (const auto &u : used){
+		const size_t end = u.second.block + (MIN_BLOCK << u.second.order);
+		blocks.push_back(Block { u.first, end - u.first });
+	}
+}
+void glt::BuddyEngine::print(std::ostream &os) const {
+	std::map<size_t, Block> freeb, usedb;
+	for (size_t i = 0; i < free_lists.size(); ++i){
+		for (const auto &f : free_lists[i]){
+			freeb[f] = Block { f, MIN_BLOCK << i };
+		}
+	}
+	for (const auto &u : used){
+		usedb[u.second.block] = Block { u.second.block, MIN_BLOCK << u.second.order };
+	}
+	os << "\tfree blocks:\n";
+	for (const auto &f : freeb){
+		os << "\t\t" << f.second << "\n";
+	}
+	os << "\tused blocks:\n";
+	for (const auto &u : usedb){
+		os << "\t\t" << u.second << "\n";
+	}
+}
+
+std::ostream& operator<<(std::ostream &os, const Block &b){
+	os << "Block { offset: " << b.offset << ", size: " << b.size << " }";
+	return os;
+}
+
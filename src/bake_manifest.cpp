@@ -0,0 +1,77 @@
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <mutex>
+#include "glt/util.h"
+#include "glt/bake_manifest.h"
+
+static const std::string MANIFEST_HEADER = "glt_bake manifest 1";
+
+static std::mutex manifest_mutex;
+static std::unordered_map<std::string, std::string> baked_files;
+
+// Get the directory of the file including the trailing separator, or empty if it has none
+static std::string dir_of(const std::string &file){
+	const size_t sep = file.find_last_of("/\\");
+	return sep == std::string::npos ? "" : file.substr(0, sep + 1);
+}
+
+bool glt::write_bake_manifest(const std::string &manifest_file, const std::vector<BakeEntry> &entries){
+	const std::string dir = dir_of(manifest_file);
+	auto relative = [&](const std::string &path){
+		if (!dir.empty() && path.compare(0, dir.size(), dir) == 0){
+			return path.substr(dir.size());
+		}
+		return path;
+	};
+	std::ofstream fout(manifest_file.c_str());
+	if (!fout){
+		std::cout << "Failed to open bake manifest " << manifest_file << " for writing\n";
+		return false;
+	}
+	// One tab separated source and baked file per line
+	fout << MANIFEST_HEADER << "\n";
+	for (const auto &e : entries){
+		fout << relative(e.source) << "\t" << relative(e.baked) << "\n";
+	}
+	if (!fout){
+		std::cout << "Failed to write bake manifest " << manifest_file << "\n";
+		return false;
+	}
+	return true;
+}
+bool glt::load_bake_manifest(const std::string &manifest_file){
+	std::ifstream fin(manifest_file.c_str());
+	std::string line;
+	if (!fin || !std::getline(fin, line) || line != MANIFEST_HEADER){
+		std::cout << "Failed to read bake manifest " << manifest_file << "\n";
+		return false;
+	}
+	const std::string dir = dir_of(manifest_file);
+	auto resolve = [&](const std::string &path){
+		if (path.empty() || path[0] == '/' || path[0] == PATH_SEP || (path.size() > 1 && path[1] == ':')){
+			return path;
+		}
+		return dir + path;
+	};
+	std::unordered_map<std::string, std::string> entries;
+	while (std::getline(fin, line)){
+		const size_t tab = line.find('\t');
+		if (tab == std::string::npos){
+			continue;
+		}
+		entries[resolve(line.substr(0, tab))] = resolve(line.substr(tab + 1));
+	}
+	std::lock_guard<std::mutex> lock(manifest_mutex);
+	for (auto &e : entries){
+		baked_files[e.first] = std::move(e.second);
+	}
+	std::cout << "registered " << entries.size() << " baked file(s) from " << manifest_file << "\n";
+	return true;
+}
+std::string glt::baked_file(const std::string &source_file){
+	std::lock_guard<std::mutex> lock(manifest_mutex);
+	auto fnd = baked_files.find(source_file);
+	return fnd == baked_files.end() ? "" : fnd->second;
+}
+
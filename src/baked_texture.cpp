@@ -0,0 +1,301 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include "stb_image.h"
+#include "glt/bake_manifest.h"
+#include "glt/baked_texture.h"
+
+using namespace glt;
+
+static const char TEXTURE_MAGIC[8] = { 'G', 'L', 'T', 'T', 'E', 'X', '\0', '\0' };
+// Bump whenever the layout of baked textures or the data stored in them changes
+static const uint32_t TEXTURE_VERSION = 1;
+// The most levels a texture can have, enough for 2^31 x 2^31 images
+static const uint32_t MAX_LEVELS = 32;
+
+// The baked texture starts with the header followed by the level records,
+// offsets are from the start of the file
+struct TextureHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t internal_format, format;
+	uint32_t width, height, channels, levels, compressed;
+	FileKey source;
+	uint64_t file_size;
+};
+struct LevelRecord {
+	uint64_t offset, size;
+	uint32_t width, height;
+};
+
+static TextureHeader read_header(const char *data){
+	TextureHeader h;
+	std::memcpy(&h, data, sizeof(h));
+	return h;
+}
+static LevelRecord read_level(const char *data, int i){
+	LevelRecord l;
+	std::memcpy(&l, data + sizeof(TextureHeader) + i * sizeof(LevelRecord), sizeof(l));
+	return l;
+}
+static GLenum pixel_format(int channels){
+	switch (channels){
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+		default: return GL_RGBA;
+	}
+}
+static GLenum sized_format(int channels, bool compressed){
+	switch (channels){
+		case 1: return compressed ? GL_COMPRESSED_RED_RGTC1 : GL_R8;
+		case 2: return compressed ? GL_COMPRESSED_RG_RGTC2 : GL_RG8;
+		case 3: return GL_RGB8;
+		default: return GL_RGBA8;
+	}
+}
+// Size in bytes of a level, RGTC stores each channel of a 4x4 block in 8 bytes
+static uint64_t level_size(uint32_t width, uint32_t height, uint32_t channels, bool compressed){
+	if (compressed){
+		return static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * 8 * channels;
+	}
+	return static_cast<uint64_t>(width) * height * channels;
+}
+/*
+ * Downsample the level by 2x with a box filter, odd rows and columns at the edge are dropped
+ * as done by most glGenerateMipmap implementations
+ */
+static std::vector<unsigned char> downsample(const std::vector<unsigned char> &img, int width, int height,
+		int channels, int out_width, int out_height)
+{
+	std::vector<unsigned char> out(static_cast<size_t>(out_width) * out_height * channels);
+	for (int y = 0; y < out_height; ++y){
+		const int y0 = std::min(2 * y, height - 1);
+		const int y1 = std::min(2 * y + 1, height - 1);
+		for (int x = 0; x < out_width; ++x){
+			const int x0 = std::min(2 * x, width - 1);
+			const int x1 = std::min(2 * x + 1, width - 1);
+			for (int c = 0; c < channels; ++c){
+				const int sum = img[(y0 * width + x0) * channels + c] + img[(y0 * width + x1) * channels + c]
+					+ img[(y1 * width + x0) * channels + c] + img[(y1 * width + x1) * channels + c];
+				out[(y * out_width + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+	return out;
+}
+/*
+ * Encode a 4x4 block of one channel as an RGTC block: the max and min values followed by
+ * a 3 bit index per texel into the 8 values interpolated between them
+ */
+static void encode_rgtc_block(const unsigned char vals[16], unsigned char out[8]){
+	const unsigned char hi = *std::max_element(vals, vals + 16);
+	const unsigned char lo = *std::min_element(vals, vals + 16);
+	out[0] = hi;
+	out[1] = lo;
+	uint64_t bits = 0;
+	if (hi != lo){
+		int palette[8] = { hi, lo };
+		for (int i = 2; i < 8; ++i){
+			palette[i] = ((8 - i) * hi + (i - 1) * lo + 3) / 7;
+		}
+		for (int i = 0; i < 16; ++i){
+			int best = 0;
+			for (int j = 1; j < 8; ++j){
+				if (std::abs(palette[j] - vals[i]) < std::abs(palette[best] - vals[i])){
+					best = j;
+				}
+			}
+			bits |= static_cast<uint64_t>(best) << (3 * i);
+		}
+	}
+	for (int i = 0; i < 6; ++i){
+		out[2 + i] = static_cast<unsigned char>(bits >> (8 * i));
+	}
+}
+// Compress a 1 or 2 channel level to RGTC1 or RGTC2, edge blocks repeat the last row and column
+static std::vector<unsigned char> compress_rgtc(const std::vector<unsigned char> &img, int width, int height,
+		int channels)
+{
+	std::vector<unsigned char> out(level_size(width, height, channels, true));
+	unsigned char *block = out.data();
+	for (int by = 0; by < height; by += 4){
+		for (int bx = 0; bx < width; bx += 4){
+			for (int c = 0; c < channels; ++c, block += 8){
+				unsigned char vals[16];
+				for (int i = 0; i < 16; ++i){
+					const int x = std::min(bx + i % 4, width - 1);
+					const int y = std::min(by + i / 4, height - 1);
+					vals[i] = img[(y * width + x) * channels + c];
+				}
+				encode_rgtc_block(vals, block);
+			}
+		}
+	}
+	return out;
+}
+
+int glt::mip_levels(int width, int height){
+	int levels = 1;
+	for (int sz = std::max(width, height); sz > 1; sz /= 2){
+		++levels;
+	}
+	return levels;
+}
+std::string glt::baked_texture_path(const std::string &image_file){
+	return image_file + ".glttex";
+}
+bool glt::bake_texture(const std::string &image_file, bool compress, const std::string &out_file){
+	int width, height, channels;
+	unsigned char *img = stbi_load(image_file.c_str(), &width, &height, &channels, 0);
+	if (!img){
+		std::cout << "bake_texture error loading " << image_file << " - " << stbi_failure_reason() << "\n";
+		return false;
+	}
+	// Flip the image so it's right side up for GL
+	const size_t row = static_cast<size_t>(width) * channels;
+	std::vector<unsigned char> level(static_cast<size_t>(height) * row);
+	for (int y = 0; y < height; ++y){
+		std::copy(img + (height - y - 1) * row, img + (height - y) * row, level.begin() + y * row);
+	}
+	stbi_image_free(img);
+
+	const bool compressed = compress && channels <= 2;
+	TextureHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC));
+	h.version = TEXTURE_VERSION;
+	h.internal_format = sized_format(channels, compressed);
+	h.format = pixel_format(channels);
+	h.width = width;
+	h.height = height;
+	h.channels = channels;
+	h.levels = mip_levels(width, height);
+	h.compressed = compressed ? 1 : 0;
+	if (!make_file_key(image_file, h.source)){
+		std::cout << "bake_texture error: failed to read " << image_file << " to key it\n";
+		return false;
+	}
+
+	std::vector<LevelRecord> records(h.levels);
+	std::vector<char> bytes(sizeof(TextureHeader) + h.levels * sizeof(LevelRecord), 0);
+	int w = width, ht = height;
+	for (uint32_t i = 0; i < h.levels; ++i){
+		if (i > 0){
+			const int nw = std::max(w / 2, 1);
+			const int nh = std::max(ht / 2, 1);
+			level = downsample(level, w, ht, channels, nw, nh);
+			w = nw;
+			ht = nh;
+		}
+		const std::vector<unsigned char> packed = compressed ? compress_rgtc(level, w, ht, channels) : level;
+		// Keep each level 16 byte aligned for copying out of the mapping
+		records[i].offset = (bytes.size() + 15) / 16 * 16;
+		records[i].size = packed.size();
+		records[i].width = w;
+		records[i].height = ht;
+		bytes.resize(records[i].offset, 0);
+		bytes.insert(bytes.end(), packed.begin(), packed.end());
+	}
+	h.file_size = bytes.size();
+	std::memcpy(bytes.data(), &h, sizeof(h));
+	std::memcpy(bytes.data() + sizeof(h), records.data(), records.size() * sizeof(LevelRecord));
+	const std::string path = out_file.empty() ? baked_texture_path(image_file) : out_file;
+	return replace_file(path, bytes.data(), bytes.size());
+}
+
+bool glt::BakedTexture::open(const std::string &image_file){
+	std::string path = baked_file(image_file);
+	if (path.empty()){
+		path = baked_texture_path(image_file);
+	}
+	FileStat st;
+	if (!stat_file(path, st) || !mapping.open(path)){
+		mapping.close();
+		return false;
+	}
+	bool touched = false;
+	if (!validate(image_file, touched)){
+		std::cout << "Baked texture " << path << " is out of date\n";
+		mapping.close();
+		return false;
+	}
+	// The file can't be written while it's mapped, so unmap it to update the key then map it again
+	if (touched){
+		mapping.close();
+		update_file_key(path, offsetof(TextureHeader, source), image_file);
+		if (!mapping.open(path) || !validate(image_file, touched)){
+			mapping.close();
+			return false;
+		}
+	}
+	return true;
+}
+bool glt::BakedTexture::validate(const std::string &image_file, bool &touched){
+	const char *data = mapping.data();
+	const size_t size = mapping.size();
+	if (size < sizeof(TextureHeader)){
+		return false;
+	}
+	const TextureHeader h = read_header(data);
+	if (std::memcmp(h.magic, TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC)) != 0 || h.version != TEXTURE_VERSION
+			|| h.file_size != size || h.channels < 1 || h.channels > 4 || h.levels < 1 || h.levels > MAX_LEVELS
+			|| h.internal_format != sized_format(h.channels, h.compressed != 0) || h.format != pixel_format(h.channels)
+			|| h.width < 1 || h.height < 1 || size < sizeof(TextureHeader) + h.levels * sizeof(LevelRecord))
+	{
+		return false;
+	}
+	// The texture arrays are allocated with a full mip chain, so a baked texture without one would
+	// leave them mip-incomplete
+	if (h.levels != static_cast<uint32_t>(mip_levels(h.width, h.height))){
+		return false;
+	}
+	// Check the levels are where they claim to be and sized correctly so the loaders can trust them
+	for (uint32_t i = 0; i < h.levels; ++i){
+		const LevelRecord l = read_level(data, i);
+		if (l.width != std::max(h.width >> i, 1u) || l.height != std::max(h.height >> i, 1u)
+				|| l.size != level_size(l.width, l.height, h.channels, h.compressed != 0)
+				|| l.offset > size || l.size > size - l.offset)
+		{
+			return false;
+		}
+	}
+	return file_key_matches(image_file, h.source, touched);
+}
+bool glt::BakedTexture::is_open() const {
+	return mapping.is_open();
+}
+int glt::BakedTexture::width() const {
+	return read_header(mapping.data()).width;
+}
+int glt::BakedTexture::height() const {
+	return read_header(mapping.data()).height;
+}
+int glt::BakedTexture::channels() const {
+	return read_header(mapping.data()).channels;
+}
+int glt::BakedTexture::levels() const {
+	return read_header(mapping.data()).levels;
+}
+bool glt::BakedTexture::compressed() const {
+	return read_header(mapping.data()).compressed != 0;
+}
+GLenum glt::BakedTexture::internal_format() const {
+	return read_header(mapping.data()).internal_format;
+}
+GLenum glt::BakedTexture::format() const {
+	return read_header(mapping.data()).format;
+}
+TextureLevel glt::BakedTexture::level(int i) const {
+	const LevelRecord l = read_level(mapping.data(), i);
+	TextureLevel t;
+	t.data = mapping.data() + l.offset;
+	t.size = l.size;
+	t.width = l.width;
+	t.height = l.height;
+	return t;
+}
+
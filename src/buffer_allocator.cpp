@@ -1,113 +1,230 @@
 #include <vector>
-#include <map>
 #include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <iterator>
+#include <chrono>
+#include <cstring>
+#include <unordered_set>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <future>
 #include "glt/gl_core_4_5.h"
 #include "glt/buffer_allocator.h"
 
 using namespace glt;
 
-glt::SubBuffer::SubBuffer(size_t offset, size_t size, GLuint buf)
-	: offset(offset), size(size), buffer(buf)
+// The most device-side copies we'll use to move data down within a buffer. Moving a block
+// into space overlapping it has to be done in pieces no larger than the distance moved
+static const size_t MAX_MOVE_COPIES = 4;
+// The largest offset alignment GL will require of us for any binding target
+static const size_t MAX_OFFSET_ALIGN = 256;
+
+// Key used to look up the handle owning an allocation
+static uint64_t handle_key(const SubBuffer &b){
+	return (static_cast<uint64_t>(b.buffer) << 40) | b.offset;
+}
+// We don't know the alignment a block was allocated with so keep the alignment
+// its offset satisfies, up to the largest alignment GL will require of us
+static size_t offset_alignment(size_t offset){
+	return offset == 0 ? MAX_OFFSET_ALIGN : std::min(offset & (~offset + 1), MAX_OFFSET_ALIGN);
+}
+// Get the alignment to keep when moving a block within an arena, blocks in the packed
+// arena never need more than PACKED_ALIGN and aligning them further only adds padding
+static size_t arena_alignment(AlignClass arena, size_t offset){
+	const size_t align = offset_alignment(offset);
+	return arena == AlignClass::PACKED ? std::min(align, PACKED_ALIGN) : align;
+}
+// Get the size of the block to hold sz bytes with some alignment in the arena
+static size_t arena_block_size(AlignClass arena, size_t sz, size_t align){
+	return arena == AlignClass::PACKED ? sz : (sz + align - 1) / align * align;
+}
+// Gaps smaller than this in the arena's buffers are only left behind by alignment padding
+static size_t arena_min_gap(AlignClass arena){
+	return arena == AlignClass::PACKED ? PACKED_ALIGN : MAX_OFFSET_ALIGN;
+}
+// Move size bytes of data down from old_offset to new_offset in the buffer, in
+// pieces small enough that the source and destination of each copy don't overlap
+static void move_down(BufferStorage *storage, GLuint buffer, size_t old_offset, size_t new_offset, size_t size){
+	const size_t shift = old_offset - new_offset;
+	for (size_t i = 0; i < size; i += shift){
+		storage->copy(buffer, old_offset + i, buffer, new_offset + i, std::min(shift, size - i));
+	}
+}
+static const char* arena_name(AlignClass arena){
+	return arena == AlignClass::PACKED ? "packed" : "aligned";
+}
+static const char* usage_name(BufferUsage usage){
+	switch (usage){
+		case BufferUsage::STATIC: return "STATIC";
+		case BufferUsage::STREAM: return "STREAM";
+		case BufferUsage::READBACK: return "READBACK";
+		default: return "DYNAMIC";
+	}
+}
+// Write the string out as a quoted JSON string, escaping characters as needed
+static void write_json_string(std::ostream &os, const std::string &str){
+	os << "\"";
+	for (const char c : str){
+		switch (c){
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\t': os << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20){
+					const char *hex = "0123456789abcdef";
+					os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+				}
+				else {
+					os << c;
+				}
+		}
+	}
+	os << "\"";
+}
+void glt::copy_sub_buffer(const SubBuffer &src, const SubBuffer &dst){
+	gl_buffer_storage()->copy(src.buffer, src.offset, dst.buffer, dst.offset, src.size);
+}
+
+glt::SubBuffer::SubBuffer(size_t offset, size_t size, GLuint buf, char *mapping, bool coherent)
+	: offset(offset), size(size), buffer(buf), mapping(mapping), coherent(coherent)
 {}
-void* glt::SubBuffer::map(GLenum target, GLenum access){
+void* glt::SubBuffer::map(GLenum target, GLenum access) const {
 	assert(size != 0);
+	if (mapping){
+		return mapping + offset;
+	}
 	// TODO: Direct state access?
 	glBindBuffer(target, buffer);
 	return glMapBufferRange(target, offset, size, access);
 }
-void glt::SubBuffer::unmap(GLenum target){
+void glt::SubBuffer::unmap(GLenum target) const {
+	if (mapping){
+		flush();
+		return;
+	}
 	glBindBuffer(target, buffer);
 	glUnmapBuffer(target);
 }
-
-glt::Buffer::Buffer(size_t size) : size(size){
-	glGenBuffers(1, &buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, buffer);
-	if (ogl_IsVersionGEQ(4, 4)){
-		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT);
+void glt::SubBuffer::flush(size_t flush_offset, size_t flush_size) const {
+	if (!mapping || coherent){
+		return;
+	}
+	assert(flush_offset + flush_size <= size);
+	if (flush_size == 0){
+		flush_size = size - flush_offset;
+	}
+	if (ogl_IsVersionGEQ(4, 5)){
+		glFlushMappedNamedBufferRange(buffer, offset + flush_offset, flush_size);
 	}
 	else {
-		// Nvidia seems to put buffer storage created buffers with write | read as dynamic draw so we'll
-		// use that as our fallback usage as well
-		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, offset + flush_offset, flush_size);
 	}
-	freeb.insert(std::make_pair(0, Block { 0, size }));
 }
-glt::Buffer::Buffer(Buffer &&b) : size(b.size), buffer(b.buffer), freeb(std::move(b.freeb)), used(std::move(b.used)){
+
+glt::Buffer::Buffer(size_t size, AllocStrategy strategy, bool coherent, BufferUsage usage,
+		BufferStorage *storage)
+	: size(size), engine(make_alloc_engine(strategy, size)), mapping(nullptr), coherent(coherent),
+	usage_hint(usage), live(0), idle_frames(0), storage(storage ? storage : gl_buffer_storage()),
+	arena(AlignClass::PACKED)
+{
+	// Readback storage is always mapped coherently so GPU writes are visible once
+	// a fence has passed, without needing a client mapped buffer barrier
+	if (usage == BufferUsage::READBACK){
+		this->coherent = true;
+	}
+	buffer = this->storage->create(size, usage, this->coherent, mapping);
+}
+glt::Buffer::Buffer(Buffer &&b) : size(b.size), buffer(b.buffer), engine(std::move(b.engine)),
+	mapping(b.mapping), coherent(b.coherent), usage_hint(b.usage_hint), live(b.live),
+	idle_frames(b.idle_frames), storage(b.storage), arena(b.arena)
+{
+	b.size = 0;
+	b.buffer = 0;
+	b.mapping = nullptr;
+}
+Buffer& glt::Buffer::operator=(Buffer &&b){
+	if (size != 0){
+		storage->destroy(buffer);
+	}
+	size = b.size;
+	buffer = b.buffer;
+	engine = std::move(b.engine);
+	mapping = b.mapping;
+	coherent = b.coherent;
+	usage_hint = b.usage_hint;
+	live = b.live;
+	idle_frames = b.idle_frames;
+	storage = b.storage;
+	arena = b.arena;
 	b.size = 0;
 	b.buffer = 0;
+	b.mapping = nullptr;
+	return *this;
 }
 glt::Buffer::~Buffer(){
 	if (size != 0){
-		glDeleteBuffers(1, &buffer);
+		storage->destroy(buffer);
 	}
 }
-bool glt::Buffer::contains(SubBuffer &b) const {
+bool glt::Buffer::contains(const SubBuffer &b) const {
 	return buffer == b.buffer;
 }
 bool glt::Buffer::alloc(size_t sz, SubBuffer &buf, size_t align){
-	if (freeb.empty()){
+	size_t offset = 0;
+	if (!engine->alloc(sz, align, offset)){
 		return false;
 	}
-	for (auto b = freeb.begin(); b != freeb.end(); ++b){
-		// Account for alignment requirements of allocation requests
-		size_t align_offset = b->second.offset % align == 0 ? 0
-			: align - b->second.offset % align;
-		if (sz + align_offset <= b->second.size){
-			// The actual offset of the block we're allocating, accounting for alignment
-			size_t offset = b->second.offset + align_offset;
-			buf = SubBuffer(offset, sz, buffer);
-			size_t rem = b->second.size - sz;
-			Block block = b->second;
-			// We have to re-insert since the block's offset will change
-			// even if we still have some free space left
-			freeb.erase(b);
-			if (rem == 0){
-				used.insert(std::make_pair(block.offset, block));
-			}
-			else {
-				used.insert(std::make_pair(offset, Block { offset, sz }));
-				freeb.insert(std::make_pair(block.offset + sz + align_offset,
-							Block { block.offset + sz + align_offset, block.size - sz - align_offset }));
-				// If we left some in front of the block due to alignment requirements insert that block too
-				if (align_offset != 0){
-					freeb.insert(std::make_pair(block.offset, Block { block.offset, align_offset }));
-				}
-			}
-			return true;
-		}
+	buf = SubBuffer(offset, sz, buffer, mapping, coherent);
+	++live;
+	return true;
+}
+bool glt::Buffer::grow(SubBuffer &b, size_t new_sz){
+	if (!contains(b) || !engine->grow(b.offset, new_sz)){
+		return false;
 	}
-	return false;
+	b.size = new_sz;
+	return true;
+}
+bool glt::Buffer::grow_back(SubBuffer &b, size_t new_sz, size_t align){
+	size_t new_offset = 0;
+	const size_t min_shift = (b.size + MAX_MOVE_COPIES - 1) / MAX_MOVE_COPIES;
+	if (!contains(b) || !engine->grow_back(b.offset, new_sz, align, min_shift, new_offset)){
+		return false;
+	}
+	move_down(storage, buffer, b.offset, new_offset, b.size);
+	b.offset = new_offset;
+	b.size = new_sz;
+	return true;
+}
+bool glt::Buffer::shrink(SubBuffer &b, size_t new_sz){
+	std::vector<Block> tails;
+	if (!contains(b) || !engine->split_tail(b.offset, new_sz, tails)){
+		return false;
+	}
+	for (const auto &t : tails){
+		engine->free(t.offset);
+	}
+	b.size = new_sz;
+	return true;
 }
 bool glt::Buffer::realloc(SubBuffer &b, size_t new_sz){
-	if (freeb.empty() || !contains(b)){
+	if (!contains(b)){
 		return false;
 	}
-	auto u = used.find(b.offset);
-	// See if the block after the one used by buf is available
-	auto fnd = freeb.find(b.offset + b.size);
-	if (fnd != freeb.end() && new_sz <= b.size + fnd->second.size){
-		const Block block = fnd->second;
-		freeb.erase(fnd);
-		size_t amt = new_sz - b.size;
-		u->second.size += amt;
-		if (amt != block.size){
-			freeb.insert(std::make_pair(block.offset + amt, Block { block.offset + amt, block.size - amt }));
-		}
-		b.size = new_sz;
+	// See if the block used by buf can be expanded in place
+	if (grow(b, new_sz) || grow_back(b, new_sz, arena_alignment(arena, b.offset))){
 		return true;
 	}
 	// We can't expand the used block so try to find a free block in the buffer to copy over to
 	SubBuffer c;
 	if (alloc(new_sz, c)){
 		// Enqueue device-side copy to move the data over to the new sub-buffer
-		// TODO: DSA?
-		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
-		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
-		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, b.offset, c.offset, b.size);
+		storage->copy(b.buffer, b.offset, c.buffer, c.offset, b.size);
 		free(b);
 		b = c;
 		return true;
@@ -115,39 +232,198 @@ bool glt::Buffer::realloc(SubBuffer &b, size_t new_sz){
 	return false;
 }
 void glt::Buffer::free(SubBuffer &buf){
-	assert(contains(buf) && !used.empty());
-	auto fnd = used.find(buf.offset);
-	assert(fnd != used.end());
-	Block rel = fnd->second;
-	used.erase(fnd);
-	freeb.insert(std::make_pair(rel.offset, rel));
-	// Step through the free blocks and merge neighbors
-	for (auto it = freeb.begin(); it != std::prev(freeb.end());){
-		auto next = std::next(it);
-		// Consecutive free blocks to be merged
-		if (it->second.offset + it->second.size == next->second.offset){
-			it->second.size += next->second.size;
-			freeb.erase(next);
-		}
-		else {
-			++it;
+	assert(contains(buf) && live != 0);
+	engine->free(buf.offset);
+	--live;
+}
+size_t glt::Buffer::capacity() const {
+	return size;
+}
+size_t glt::Buffer::free_bytes() const {
+	return engine->free_bytes();
+}
+size_t glt::Buffer::largest_free_block() const {
+	return engine->largest_free();
+}
+bool glt::Buffer::empty() const {
+	return live == 0;
+}
+BufferUsage glt::Buffer::usage() const {
+	return usage_hint;
+}
+size_t glt::Buffer::padding_bytes(size_t min_gap) const {
+	std::vector<Block> used;
+	engine->used_blocks(used);
+	std::sort(used.begin(), used.end(), [](const Block &a, const Block &b){ return a.offset < b.offset; });
+	size_t padding = 0, prev_end = 0;
+	for (const auto &blk : used){
+		const size_t gap = blk.offset - prev_end;
+		if (gap != 0 && gap < min_gap){
+			padding += gap;
 		}
+		prev_end = blk.offset + blk.size;
+	}
+	return padding;
+}
+
+AlignClass glt::align_class(size_t align){
+	return align <= PACKED_ALIGN ? AlignClass::PACKED : AlignClass::ALIGNED;
+}
+
+glt::ArenaStats::ArenaStats() : buffers(0), capacity(0), free_bytes(0), padding(0){}
+
+glt::ReallocPolicy::ReallocPolicy() : shrink(true), grow_backward(true), growth_factor(1){}
+
+glt::PoolStats::PoolStats() : buffers(0), capacity(0), free_bytes(0), largest_free(0), high_water(0),
+	allocs(0), reallocs(0), frees(0), buffers_created(0), evictions(0), restores(0)
+{
+	std::fill(std::begin(alloc_latency), std::end(alloc_latency), 0);
+}
+size_t glt::PoolStats::used_bytes() const {
+	return capacity - free_bytes;
+}
+double glt::PoolStats::fragmentation() const {
+	if (free_bytes == 0){
+		return 0;
 	}
+	return 1.0 - static_cast<double>(largest_free) / free_bytes;
 }
 
-glt::BufferAllocator::BufferAllocator(size_t capacity) : capacity(capacity){
-	buffers.emplace_back(capacity);
+const size_t BufferAllocator::TABLE_COPIES;
+
+glt::BufferAllocator::BufferAllocator(size_t capacity, AllocStrategy strategy, bool coherent,
+		BufferStorage *storage)
+	: capacity(capacity), strategy(strategy), coherent(coherent), deferred_free(false), release_delay(60),
+	storage(storage ? storage : gl_buffer_storage()), table_copy(0), table_dirty(false), high_water(0),
+	budget(0), trace(nullptr), gl_thread(std::this_thread::get_id())
+{
+	std::fill(std::begin(table_fences), std::end(table_fences), nullptr);
+	std::unique_lock<std::recursive_mutex> l(lock);
+	add_buffer(l, capacity, BufferUsage::DYNAMIC);
+}
+glt::BufferAllocator::~BufferAllocator(){
+	for (auto &r : retired){
+		storage->delete_fence(r.fence);
+	}
+	for (auto &f : table_fences){
+		if (f){
+			storage->delete_fence(f);
+		}
+	}
+}
+SubBuffer glt::BufferAllocator::alloc(size_t sz, size_t align, BufferUsage usage){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	const SubBuffer buf = alloc(l, sz, align, usage);
+	if (trace){
+		*trace << "a " << handle_key(buf) << " " << sz << " " << align << " "
+			<< static_cast<int>(usage) << "\n";
+	}
+	return buf;
+}
+SubBuffer glt::BufferAllocator::alloc_for(GLenum target, size_t sz, BufferUsage usage){
+	return alloc(sz, target_alignment(target), usage);
+}
+size_t glt::BufferAllocator::target_alignment(GLenum target){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	auto fnd = target_align.find(target);
+	if (fnd != target_align.end()){
+		return fnd->second;
+	}
+	size_t align = 0;
+	run_on_gl_thread(l, [&](){ align = storage->offset_alignment(target); });
+	target_align[target] = align;
+	return align;
+}
+void glt::BufferAllocator::alloc_batch(size_t n, size_t sz, size_t align, BufferUsage usage,
+		std::vector<SubBuffer> &out)
+{
+	std::unique_lock<std::recursive_mutex> l(lock);
+	for (size_t i = 0; i < n; ++i){
+		const SubBuffer buf = alloc(l, sz, align, usage);
+		if (buf.size == 0){
+			return;
+		}
+		out.push_back(buf);
+		pinned.insert(handle_key(buf));
+		if (trace){
+			*trace << "a " << handle_key(buf) << " " << sz << " " << align << " "
+				<< static_cast<int>(usage) << "\n";
+		}
+	}
+}
+SubBuffer glt::BufferAllocator::alloc(std::unique_lock<std::recursive_mutex> &l, size_t sz,
+		size_t align, BufferUsage usage)
+{
+	using namespace std::chrono;
+	const auto start = high_resolution_clock::now();
+	const SubBuffer buf = alloc_block(l, sz, align, usage);
+	const uint64_t ns = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+	size_t bucket = 0;
+	for (; bucket + 1 < LATENCY_BUCKETS && ns >= (uint64_t{128} << bucket); ++bucket);
+	PoolStats &pool = pools[static_cast<size_t>(usage)];
+	++pool.allocs;
+	++pool.alloc_latency[bucket];
+	update_high_water(usage);
+	return buf;
 }
-SubBuffer glt::BufferAllocator::alloc(size_t sz, size_t align){
+SubBuffer glt::BufferAllocator::alloc_block(std::unique_lock<std::recursive_mutex> &l, size_t sz,
+		size_t align, BufferUsage usage)
+{
+	const AlignClass arena = align_class(align);
+	const size_t block = arena_block_size(arena, sz, align);
 	SubBuffer buf;
+	// Empty buffers are taken over by whichever arena needs them
+	auto try_alloc = [&](Buffer &b){
+		if (b.usage() != usage || (b.arena != arena && !b.empty()) || !b.alloc(block, buf, align)){
+			return false;
+		}
+		b.arena = arena;
+		buf.size = sz;
+		return true;
+	};
 	for (auto &b : buffers){
-		if (b.alloc(sz, buf, align)){
+		if (try_alloc(b)){
 			return buf;
 		}
 	}
-	size_t new_size = std::max(capacity, sz);
-	buffers.emplace_back(new_size);
-	if (buffers.back().alloc(sz, buf, align)){
+	// Before making a new buffer see if any frees the GPU is done with will give us room,
+	// checking the fences is GL work so other threads leave this to end_frame
+	if (std::this_thread::get_id() == gl_thread && collect_retired()){
+		for (auto &b : buffers){
+			if (try_alloc(b)){
+				return buf;
+			}
+		}
+	}
+	size_t new_size = std::max(capacity, min_region_size(strategy, block, align));
+	// Don't evict anything if no amount of evicting would make room
+	if (budget != 0 && allocated_bytes() + new_size > budget && !budget_can_fit(block, new_size, usage)){
+		std::cout << "BufferAllocator error: allocation of " << sz << " bytes can't fit in the budget of "
+			<< budget << " bytes\n";
+		return SubBuffer{};
+	}
+	// To stay in the budget release the empty buffers past each usage's spare then start evicting,
+	// the space freed by an eviction may be enough to fit the allocation in an existing buffer.
+	// The spares are only given up once there's nothing left to evict
+	while (budget != 0 && allocated_bytes() + new_size > budget){
+		if (drop_empty_buffers(l, true, false)){
+			continue;
+		}
+		if (!evict_lru(l)){
+			if (drop_empty_buffers(l, false, false)){
+				continue;
+			}
+			std::cout << "BufferAllocator error: allocation of " << sz << " bytes would exceed the budget of "
+				<< budget << " bytes and there's nothing left to evict\n";
+			return SubBuffer{};
+		}
+		for (auto &b : buffers){
+			if (try_alloc(b)){
+				return buf;
+			}
+		}
+	}
+	if (try_alloc(add_buffer(l, new_size, usage))){
 		return buf;
 	}
 	std::cout << "Failed to allocate enough room still?\n";
@@ -155,36 +431,1017 @@ SubBuffer glt::BufferAllocator::alloc(size_t sz, size_t align){
 	return SubBuffer{};
 }
 void glt::BufferAllocator::realloc(SubBuffer &b, size_t new_sz){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	const uint64_t key = handle_key(b);
+	realloc(l, b, new_sz);
+	if (trace){
+		*trace << "r " << key << " " << new_sz << " " << handle_key(b) << "\n";
+	}
+}
+void glt::BufferAllocator::realloc(std::unique_lock<std::recursive_mutex> &l, SubBuffer &b, size_t new_sz){
 	// First try to realloc within the buffer that this buffer was allocated from
-	auto it = std::find_if(buffers.begin(), buffers.end(), [&](const Buffer &buf){ return buf.contains(b); });
-	if (it == buffers.end()){
+	Buffer *parent = find_parent(b);
+	if (!parent){
 		std::cout << "Error: attempt to re-alloc buffer not in this allocator\n";
 		return;
 	}
-	// If we need to push on a new buffer we may invalidate our iterator so grab the index instead
-	size_t parent = std::distance(buffers.begin(), it);
-	// If the parent can't meet the realloc we need to find a new home and copy the data over
-	if (!buffers[parent].realloc(b, new_sz)){
-		SubBuffer new_buf = alloc(new_sz);
-		// Enqueue device-side copy to move the data over to the new sub-buffer
-		// TODO: DSA?
-		glBindBuffer(GL_COPY_READ_BUFFER, b.buffer);
-		glBindBuffer(GL_COPY_WRITE_BUFFER, new_buf.buffer);
-		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, b.offset, new_buf.offset, b.size);
-		buffers[parent].free(b);
-		b = new_buf;
+	const BufferUsage usage = parent->usage();
+	++pools[static_cast<size_t>(usage)].reallocs;
+	const ReallocPolicy &policy = realloc_policy;
+	const AlignClass arena = parent->arena;
+	const size_t align = arena_alignment(arena, b.offset);
+	if (new_sz <= b.size){
+		// When over-allocating keep the same slack we'd give the sub buffer if it was growing
+		const size_t keep = std::max(new_sz, static_cast<size_t>(new_sz * policy.growth_factor));
+		if (policy.shrink){
+			shrink(*parent, b, new_sz, keep);
+		}
+		else {
+			b.size = new_sz;
+		}
+		return;
+	}
+	// Try growing to the over-allocated capacity first, then just what was asked for. As when
+	// shrinking the sub buffer is new_sz bytes to the caller, the slack is only known to the
+	// engine so later growth into it happens in place
+	const size_t target = std::max(new_sz, static_cast<size_t>(b.size * policy.growth_factor));
+	if (parent->grow(b, arena_block_size(arena, target, align))
+			|| (target != new_sz && parent->grow(b, arena_block_size(arena, new_sz, align))))
+	{
+		b.size = new_sz;
+		update_high_water(usage);
+		return;
+	}
+	// Growing backward frees the top of the old range before its data has been moved down, so
+	// it's only done when the copy runs inline. Off the GL thread the lock is dropped while the
+	// copy is queued and another thread could allocate and write over the range first
+	if (policy.grow_backward && std::this_thread::get_id() == gl_thread){
+		const size_t min_shift = (b.size + MAX_MOVE_COPIES - 1) / MAX_MOVE_COPIES;
+		size_t new_offset = 0;
+		bool moved = parent->engine->grow_back(b.offset, arena_block_size(arena, target, align), align,
+				min_shift, new_offset);
+		if (!moved && target != new_sz){
+			moved = parent->engine->grow_back(b.offset, arena_block_size(arena, new_sz, align), align,
+					min_shift, new_offset);
+		}
+		if (moved){
+			const SubBuffer old = b;
+			const GLuint buffer = parent->buffer;
+			b = SubBuffer(new_offset, new_sz, buffer, parent->mapping, parent->coherent);
+			run_on_gl_thread(l, [&](){ move_down(storage, buffer, old.offset, new_offset, old.size); });
+			move_tag(old, b);
+			update_high_water(usage);
+			return;
+		}
+	}
+	// If the parent can't expand the buffer in place we need to find a new home and copy the
+	// data over, preferring somewhere else in the parent buffer. Grabbing a new buffer
+	// may invalidate the parent pointer so it's not used after this. The lock may be dropped
+	// while a new buffer is made or the copy runs so the block is pinned until it's been
+	// copied, keeping defragment from relocating it out from under us
+	const uint64_t key = handle_key(b);
+	pinned.insert(key);
+	SubBuffer new_buf;
+	if (!parent->alloc(arena_block_size(arena, target, align), new_buf, align)){
+		new_buf = alloc(l, target, align, usage);
+		if (new_buf.size == 0){
+			pinned.erase(pinned.find(key));
+			std::cout << "BufferAllocator error: failed to move sub buffer to realloc it\n";
+			return;
+		}
+	}
+	new_buf.size = new_sz;
+	// Enqueue device-side copy to move the data over to the new sub-buffer. The old
+	// block is released through free so it's deferred until the copy completes if needed
+	const SubBuffer old = b;
+	run_on_gl_thread(l, [&](){ storage->copy(old.buffer, old.offset, new_buf.buffer, new_buf.offset, old.size); });
+	pinned.erase(pinned.find(key));
+	move_tag(old, new_buf);
+	free_block(b);
+	b = new_buf;
+}
+void glt::BufferAllocator::trim(SubBuffer &b, size_t new_sz){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	Buffer *parent = find_parent(b);
+	if (!parent || new_sz > b.size){
+		std::cout << "Error: attempt to trim buffer not in this allocator or to a larger size\n";
+		return;
+	}
+	const uint64_t key = handle_key(b);
+	++pools[static_cast<size_t>(parent->usage())].reallocs;
+	shrink(*parent, b, new_sz, new_sz);
+	if (trace){
+		*trace << "r " << key << " " << new_sz << " " << handle_key(b) << "\n";
+	}
+}
+void glt::BufferAllocator::shrink(Buffer &parent, SubBuffer &b, size_t new_sz, size_t keep){
+	// The sub buffer is always new_sz bytes to the caller, any slack kept past it is only known
+	// to the engine so growing back into it later is free
+	b.size = new_sz;
+	const AlignClass arena = parent.arena;
+	const size_t block = arena_block_size(arena, keep, arena_alignment(arena, b.offset));
+	std::vector<Block> tails;
+	if (block == 0 || !parent.engine->split_tail(b.offset, block, tails)){
+		return;
+	}
+	// The tails are released like any other free so they're deferred if the GPU may still be using them
+	parent.live += tails.size();
+	for (const auto &t : tails){
+		SubBuffer tail(t.offset, t.size, parent.buffer, parent.mapping, parent.coherent);
+		if (deferred_free){
+			pending.push_back(tail);
+		}
+		else {
+			release(tail);
+		}
 	}
-
 }
 void glt::BufferAllocator::free(SubBuffer &buf){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	if (trace){
+		*trace << "f " << handle_key(buf) << "\n";
+	}
+	free_block(buf);
+}
+void glt::BufferAllocator::free_block(SubBuffer &buf){
+	const Buffer *parent = find_parent(buf);
+	if (parent){
+		++pools[static_cast<size_t>(parent->usage())].frees;
+	}
+	if (deferred_free){
+		pending.push_back(buf);
+		buf.size = 0;
+		return;
+	}
+	release(buf);
+}
+void glt::BufferAllocator::free_batch(size_t n, SubBuffer *bufs){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	for (size_t i = 0; i < n; ++i){
+		auto pin = pinned.find(handle_key(bufs[i]));
+		if (pin != pinned.end()){
+			pinned.erase(pin);
+		}
+		free(bufs[i]);
+	}
+}
+void glt::BufferAllocator::set_realloc_policy(const ReallocPolicy &policy){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	realloc_policy = policy;
+}
+void glt::BufferAllocator::set_deferred_free(bool deferred){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	deferred_free = deferred;
+}
+bool glt::BufferAllocator::deferred_freeing() const {
+	return deferred_free;
+}
+void glt::BufferAllocator::end_frame(){
+	assert(std::this_thread::get_id() == gl_thread);
+	run_gl_tasks();
+	std::unique_lock<std::recursive_mutex> l(lock);
+	if (!pending.empty()){
+		retired.push_back(RetireList { storage->fence(), std::move(pending) });
+		pending.clear();
+	}
+	collect_retired();
+	release_empty_buffers(l);
+	update_labels();
+}
+void glt::BufferAllocator::set_relocation_callback(const std::function<void(const SubBuffer&, const SubBuffer&)> &callback){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	relocate = callback;
+}
+size_t glt::BufferAllocator::defragment(size_t byte_budget, double time_budget_ms){
+	assert(std::this_thread::get_id() == gl_thread);
+	std::lock_guard<std::recursive_mutex> l(lock);
+	using namespace std::chrono;
+	const auto start = high_resolution_clock::now();
+	// Find the least occupied buffer that still has something in it to evacuate
+	size_t src = buffers.size();
+	size_t in_use = 0;
+	double min_occupancy = 2;
+	for (size_t i = 0; i < buffers.size(); ++i){
+		if (buffers[i].empty()){
+			continue;
+		}
+		++in_use;
+		const double occupancy = 1.0 - static_cast<double>(buffers[i].free_bytes()) / buffers[i].capacity();
+		if (occupancy < min_occupancy){
+			min_occupancy = occupancy;
+			src = i;
+		}
+	}
+	if (src == buffers.size()){
+		return 0;
+	}
+	std::vector<Block> live;
+	buffers[src].engine->used_blocks(live);
+	// Sub buffers waiting on a deferred free are dead and will be released anyway
+	std::unordered_set<size_t> dead;
+	for (const auto &p : pending){
+		if (buffers[src].contains(p)){
+			dead.insert(p.offset);
+		}
+	}
+	for (const auto &r : retired){
+		for (const auto &b : r.buffers){
+			if (buffers[src].contains(b)){
+				dead.insert(b.offset);
+			}
+		}
+	}
+	// Move the blocks at the end of the buffer first so compacting within it works towards the front
+	std::sort(live.begin(), live.end(), [](const Block &a, const Block &b){ return a.offset > b.offset; });
+	size_t moved = 0;
+	for (const auto &blk : live){
+		const double elapsed = duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - start).count();
+		if (moved >= byte_budget || (time_budget_ms > 0 && elapsed >= time_budget_ms)){
+			break;
+		}
+		Buffer &parent = buffers[src];
+		SubBuffer from(blk.offset, blk.size, parent.buffer, parent.mapping, parent.coherent);
+		if (dead.count(blk.offset) || pinned.count(handle_key(from))){
+			continue;
+		}
+		const BufferUsage usage = parent.usage();
+		const size_t align = arena_alignment(parent.arena, blk.offset);
+		SubBuffer to;
+		bool found = false;
+		if (in_use > 1){
+			for (size_t i = 0; i < buffers.size() && !found; ++i){
+				if (i != src && !buffers[i].empty() && buffers[i].usage() == usage
+						&& buffers[i].arena == parent.arena)
+				{
+					found = buffers[i].alloc(blk.size, to, align);
+				}
+			}
+		}
+		if (!found && parent.alloc(blk.size, to, align)){
+			found = to.offset < from.offset;
+			if (!found){
+				parent.free(to);
+			}
+		}
+		if (!found){
+			continue;
+		}
+		storage->copy(from.buffer, from.offset, to.buffer, to.offset, from.size);
+		const SubBuffer old = from;
+		free_block(from);
+		update_handle(old, to);
+		move_tag(old, to);
+		if (relocate){
+			relocate(old, to);
+		}
+		moved += blk.size;
+	}
+	return moved;
+}
+void glt::BufferAllocator::set_release_delay(size_t frames){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	release_delay = frames;
+}
+bool glt::BufferAllocator::collect_retired(){
+	bool freed = false;
+	// Fences signal in order so we can stop at the first frame still in flight
+	while (!retired.empty()){
+		RetireList &r = retired.front();
+		if (!storage->signaled(r.fence)){
+			break;
+		}
+		storage->delete_fence(r.fence);
+		for (auto &b : r.buffers){
+			release(b);
+		}
+		retired.pop_front();
+		freed = true;
+	}
+	return freed;
+}
+BufferHandle glt::BufferAllocator::alloc_handle(size_t sz, size_t align, BufferUsage usage){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	const SubBuffer buf = alloc(l, sz, align, usage);
+	if (buf.size == 0){
+		return INVALID_HANDLE;
+	}
+	if (trace){
+		*trace << "a " << handle_key(buf) << " " << sz << " " << align << " "
+			<< static_cast<int>(usage) << "\n";
+	}
+	BufferHandle h;
+	if (!free_handles.empty()){
+		h = free_handles.back();
+		free_handles.pop_back();
+		handles[h] = buf;
+	}
+	else {
+		h = static_cast<BufferHandle>(handles.size());
+		handles.push_back(buf);
+	}
+	handle_owners[handle_key(buf)] = h;
+	table_dirty = true;
+	return h;
+}
+const SubBuffer& glt::BufferAllocator::get(BufferHandle h) const {
+	std::lock_guard<std::recursive_mutex> l(lock);
+	assert(h < handles.size());
+	return handles[h];
+}
+void glt::BufferAllocator::realloc(BufferHandle h, size_t new_sz){
+	// The sub buffer has to be back on the GPU to be moved or grown there. This is done before
+	// taking the lock as restoring may need to drop it to wait on the GL thread
+	if (is_evicted(h) && !touch(h)){
+		return;
+	}
+	std::unique_lock<std::recursive_mutex> l(lock);
+	assert(h < handles.size());
+	// The sub buffer is pinned for the whole realloc so evicting to make room for it can't pick
+	// it, and it's worked on as a copy since the lock may be dropped along the way
+	SubBuffer b = handles[h];
+	const uint64_t key = handle_key(b);
+	pinned.insert(key);
+	realloc(l, b, new_sz);
+	pinned.erase(pinned.find(key));
+	handles[h] = b;
+	if (trace){
+		*trace << "r " << key << " " << new_sz << " " << handle_key(b) << "\n";
+	}
+	handle_owners.erase(key);
+	handle_owners[handle_key(b)] = h;
+	table_dirty = true;
+}
+void glt::BufferAllocator::free(BufferHandle h){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	assert(h < handles.size() && handles[h].size != 0);
+	auto pos = lru_pos.find(h);
+	if (pos != lru_pos.end()){
+		lru.erase(pos->second);
+		lru_pos.erase(pos);
+	}
+	// An evicted sub buffer's space was already freed, only the host copy is left. A sub buffer
+	// being restored by touch has buffer 0 until it's back and touch will see it's been freed
+	if (evicted.erase(h) || handles[h].buffer == 0){
+		handles[h].size = 0;
+	}
+	else {
+		handle_owners.erase(handle_key(handles[h]));
+		if (trace){
+			*trace << "f " << handle_key(handles[h]) << "\n";
+		}
+		free_block(handles[h]);
+	}
+	free_handles.push_back(h);
+	table_dirty = true;
+}
+void glt::BufferAllocator::set_budget(size_t bytes){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	budget = bytes;
+}
+size_t glt::BufferAllocator::allocated_bytes() const {
+	std::lock_guard<std::recursive_mutex> l(lock);
+	size_t bytes = 0;
+	for (const auto &b : buffers){
+		bytes += b.capacity();
+	}
+	return bytes;
+}
+void glt::BufferAllocator::set_evictable(BufferHandle h, bool evictable){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	assert(h < handles.size() && handles[h].size != 0);
+	auto pos = lru_pos.find(h);
+	if (evictable && pos == lru_pos.end() && !evicted.count(h)){
+		lru_pos[h] = lru.insert(lru.end(), h);
+	}
+	else if (!evictable && pos != lru_pos.end()){
+		lru.erase(pos->second);
+		lru_pos.erase(pos);
+	}
+}
+bool glt::BufferAllocator::touch(BufferHandle h){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	assert(h < handles.size() && handles[h].size != 0);
+	auto pos = lru_pos.find(h);
+	if (pos != lru_pos.end()){
+		lru.splice(lru.end(), lru, pos->second);
+		return true;
+	}
+	auto ev = evicted.find(h);
+	if (ev == evicted.end()){
+		return true;
+	}
+	// Take the shadow out of the map before allocating, making room may evict other handles into
+	// the map or drop the lock to wait on the GL thread. It's put back if the handle can't be restored
+	Shadow shadow = std::move(ev->second);
+	evicted.erase(ev);
+	const size_t size = handles[h].size;
+	const size_t align = shadow.align;
+	const BufferUsage usage = shadow.usage;
+	// The handle still refers to the placeholder for its evicted sub buffer until it's restored,
+	// if it doesn't after the lock's been dropped it was freed in the meantime
+	auto still_evicted = [&](){
+		return !evicted.count(h) && handles[h].buffer == 0 && handles[h].size == size;
+	};
+	const SubBuffer buf = alloc(l, size, align, usage);
+	if (buf.size == 0){
+		if (still_evicted()){
+			evicted[h] = std::move(shadow);
+		}
+		return false;
+	}
+	upload(l, buf, shadow.data.data(), size, 0);
+	if (!still_evicted()){
+		SubBuffer unused = buf;
+		free_block(unused);
+		return false;
+	}
+	if (trace){
+		*trace << "a " << handle_key(buf) << " " << size << " " << align << " "
+			<< static_cast<int>(usage) << "\n";
+	}
+	handles[h] = buf;
+	handle_owners[handle_key(buf)] = h;
+	// It may have been made evictable again while the lock was dropped
+	pos = lru_pos.find(h);
+	if (pos != lru_pos.end()){
+		lru.splice(lru.end(), lru, pos->second);
+	}
+	else {
+		lru_pos[h] = lru.insert(lru.end(), h);
+	}
+	table_dirty = true;
+	++pools[static_cast<size_t>(usage)].restores;
+	if (restored){
+		restored(h, buf);
+	}
+	return true;
+}
+bool glt::BufferAllocator::is_evicted(BufferHandle h) const {
+	std::lock_guard<std::recursive_mutex> l(lock);
+	return evicted.count(h) != 0;
+}
+void glt::BufferAllocator::set_restore_callback(const std::function<void(BufferHandle, const SubBuffer&)> &callback){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	restored = callback;
+}
+const SubBuffer& glt::BufferAllocator::handle_table(){
+	assert(std::this_thread::get_id() == gl_thread);
+	std::lock_guard<std::recursive_mutex> l(lock);
+	if (!table_dirty){
+		return table;
+	}
+	const size_t table_size = std::max(handles.size(), size_t{1}) * sizeof(HandleEntry);
+	if (!table_buffer || table.size < table_size){
+		// Grow geometrically so adding handles doesn't reallocate the table each time. Each copy
+		// is bound as an SSBO range so they're padded to start at the required alignment
+		size_t new_size = table_buffer ? table.size : 64 * sizeof(HandleEntry);
+		for (; new_size < table_size; new_size *= 2);
+		const size_t align = storage->offset_alignment(GL_SHADER_STORAGE_BUFFER);
+		new_size = (new_size + align - 1) / align * align;
+		// The old copies go with their buffer, GL keeps it alive until draws using it are done
+		for (auto &f : table_fences){
+			if (f){
+				storage->delete_fence(f);
+				f = nullptr;
+			}
+		}
+		table_buffer.reset(new Buffer(new_size * TABLE_COPIES, AllocStrategy::FIRST_FIT, coherent,
+					BufferUsage::DYNAMIC, storage));
+		for (auto &c : table_copies){
+			table_buffer->alloc(new_size, c, align);
+		}
+		table_copy = 0;
+	}
+	else {
+		// Draws since the table was last fetched may still be reading the current copy, so fence
+		// it and write the next one once the GPU is done with it
+		table_fences[table_copy] = storage->fence();
+		table_copy = (table_copy + 1) % TABLE_COPIES;
+		GLsync &fence = table_fences[table_copy];
+		if (fence){
+			GLenum status = GL_ALREADY_SIGNALED;
+			if (!storage->signaled(fence)){
+				do {
+					status = storage->wait(fence, 1000000);
+				} while (status == GL_TIMEOUT_EXPIRED);
+			}
+			if (status == GL_WAIT_FAILED){
+				std::cout << "BufferAllocator error: waiting on handle table fence failed\n";
+			}
+			storage->delete_fence(fence);
+			fence = nullptr;
+		}
+	}
+	table = table_copies[table_copy];
+	HandleEntry *entries = static_cast<HandleEntry*>(table.map(GL_SHADER_STORAGE_BUFFER,
+				GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
+	for (size_t i = 0; i < handles.size(); ++i){
+		const SubBuffer &b = handles[i];
+		entries[i] = HandleEntry { static_cast<GLuint>(b.offset), static_cast<GLuint>(b.size), b.buffer, 0 };
+	}
+	table.unmap(GL_SHADER_STORAGE_BUFFER);
+	table_dirty = false;
+	return table;
+}
+void glt::BufferAllocator::upload(const SubBuffer &dst, const void *data, size_t size, size_t dst_offset){
+	std::unique_lock<std::recursive_mutex> l(lock);
+	upload(l, dst, data, size, dst_offset);
+}
+void glt::BufferAllocator::upload(std::unique_lock<std::recursive_mutex> &l, const SubBuffer &dst,
+		const void *data, size_t size, size_t dst_offset)
+{
+	assert(dst_offset + size <= dst.size);
+	if (dst.mapping){
+		std::memcpy(dst.mapping + dst.offset + dst_offset, data, size);
+		if (!dst.coherent){
+			run_on_gl_thread(l, [&](){ dst.flush(dst_offset, size); });
+		}
+		return;
+	}
+	const SubBuffer staging = alloc(l, size, 1, BufferUsage::STREAM);
+	if (staging.size == 0){
+		std::cout << "BufferAllocator error: failed to allocate staging space for upload\n";
+		return;
+	}
+	GLsync fence = 0;
+	run_on_gl_thread(l, [&](){
+		void *ptr = staging.map(GL_COPY_READ_BUFFER, GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT);
+		std::memcpy(ptr, data, size);
+		staging.unmap(GL_COPY_READ_BUFFER);
+		storage->copy(staging.buffer, staging.offset, dst.buffer, dst.offset + dst_offset, size);
+		fence = storage->fence();
+	});
+	// The staging space can't be re-used until the copy has run, so it's always retired behind
+	// its own fence regardless of whether deferred freeing is enabled
+	++pools[static_cast<size_t>(BufferUsage::STREAM)].frees;
+	retired.push_back(RetireList { fence, std::vector<SubBuffer>{ staging } });
+}
+PoolStats glt::BufferAllocator::pool_stats(BufferUsage usage) const {
+	std::lock_guard<std::recursive_mutex> l(lock);
+	PoolStats stats = pools[static_cast<size_t>(usage)];
+	for (const auto &b : buffers){
+		if (b.usage() == usage){
+			++stats.buffers;
+			stats.capacity += b.capacity();
+			stats.free_bytes += b.free_bytes();
+			stats.largest_free = std::max(stats.largest_free, b.largest_free_block());
+			ArenaStats &arena = stats.arenas[static_cast<size_t>(b.arena)];
+			++arena.buffers;
+			arena.capacity += b.capacity();
+			arena.free_bytes += b.free_bytes();
+			arena.padding += b.padding_bytes(arena_min_gap(b.arena));
+		}
+	}
+	return stats;
+}
+void glt::BufferAllocator::set_tag(const SubBuffer &b, const std::string &tag){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	tags[handle_key(b)] = Tag { tag, b.size };
+	relabel.insert(b.buffer);
+}
+void glt::BufferAllocator::set_trace(std::ostream *os){
+	std::lock_guard<std::recursive_mutex> l(lock);
+	trace = os;
+}
+void glt::BufferAllocator::write_json(std::ostream &os) const {
+	std::lock_guard<std::recursive_mutex> l(lock);
+	size_t total_capacity = 0, total_free = 0;
+	os << "{\"pools\":{";
+	for (size_t i = 0; i < BUFFER_USAGE_COUNT; ++i){
+		const PoolStats p = pool_stats(static_cast<BufferUsage>(i));
+		total_capacity += p.capacity;
+		total_free += p.free_bytes;
+		os << (i == 0 ? "" : ",") << "\"" << usage_name(static_cast<BufferUsage>(i)) << "\":{"
+			<< "\"buffers\":" << p.buffers << ",\"capacity\":" << p.capacity
+			<< ",\"used\":" << p.used_bytes() << ",\"free\":" << p.free_bytes
+			<< ",\"largest_free\":" << p.largest_free << ",\"fragmentation\":" << p.fragmentation()
+			<< ",\"high_water\":" << p.high_water << ",\"allocs\":" << p.allocs
+			<< ",\"reallocs\":" << p.reallocs << ",\"frees\":" << p.frees
+			<< ",\"buffers_created\":" << p.buffers_created << ",\"evictions\":" << p.evictions
+			<< ",\"restores\":" << p.restores << ",\"alloc_latency_ns\":[";
+		for (size_t j = 0; j < LATENCY_BUCKETS; ++j){
+			os << (j == 0 ? "" : ",") << p.alloc_latency[j];
+		}
+		os << "],\"arenas\":{";
+		for (size_t j = 0; j < ALIGN_CLASS_COUNT; ++j){
+			const ArenaStats &a = p.arenas[j];
+			os << (j == 0 ? "" : ",") << "\"" << arena_name(static_cast<AlignClass>(j)) << "\":{"
+				<< "\"buffers\":" << a.buffers << ",\"capacity\":" << a.capacity
+				<< ",\"free\":" << a.free_bytes << ",\"padding\":" << a.padding << "}";
+		}
+		os << "}}";
+	}
+	os << "},\"total\":{\"capacity\":" << total_capacity << ",\"used\":" << total_capacity - total_free
+		<< ",\"free\":" << total_free << ",\"high_water\":" << high_water << ",\"budget\":" << budget
+		<< "},\"tags\":{";
+	std::map<std::string, size_t> tag_bytes;
+	for (const auto &t : tags){
+		tag_bytes[t.second.name] += t.second.size;
+	}
+	bool first = true;
+	for (const auto &t : tag_bytes){
+		os << (first ? "" : ",");
+		write_json_string(os, t.first);
+		os << ":" << t.second;
+		first = false;
+	}
+	os << "}}";
+}
+void glt::BufferAllocator::run_gl_tasks(){
+	assert(std::this_thread::get_id() == gl_thread);
+	for (;;){
+		std::packaged_task<void()> task;
+		{
+			std::lock_guard<std::mutex> l(task_lock);
+			if (gl_tasks.empty()){
+				return;
+			}
+			task = std::move(gl_tasks.front());
+			gl_tasks.pop_front();
+		}
+		task();
+	}
+}
+void glt::BufferAllocator::run_on_gl_thread(std::unique_lock<std::recursive_mutex> &l,
+		const std::function<void()> &fn)
+{
+	if (std::this_thread::get_id() == gl_thread){
+		fn();
+		return;
+	}
+	std::packaged_task<void()> task(fn);
+	std::future<void> done = task.get_future();
+	{
+		std::lock_guard<std::mutex> t(task_lock);
+		gl_tasks.push_back(std::move(task));
+	}
+	l.unlock();
+	done.wait();
+	l.lock();
+}
+void glt::BufferAllocator::release(SubBuffer &buf){
+	Buffer *parent = find_parent(buf);
+	if (!parent){
+		std::cout << "Warning: Found no buffer containing SubBuffer to free from\n";
+		return;
+	}
+	if (!tags.empty() && tags.erase(handle_key(buf))){
+		relabel.insert(buf.buffer);
+	}
+	parent->free(buf);
+	buf.size = 0;
+}
+void glt::BufferAllocator::release_empty_buffers(std::unique_lock<std::recursive_mutex> &l){
 	for (auto &b : buffers){
-		if (b.contains(buf)){
-			b.free(buf);
-			buf.size = 0;
-			return;
+		b.idle_frames = b.empty() ? b.idle_frames + 1 : 0;
+	}
+	drop_empty_buffers(l, true, true);
+}
+bool glt::BufferAllocator::drop_empty_buffers(std::unique_lock<std::recursive_mutex> &l, bool keep_spares,
+		bool wait_delay)
+{
+	bool kept_spare[BUFFER_USAGE_COUNT] = { false };
+	// The buffers are taken out of the allocator here but destroyed on the GL thread
+	std::vector<Buffer> dropped;
+	for (auto it = buffers.begin(); it != buffers.end();){
+		if (!it->empty()){
+			++it;
+			continue;
+		}
+		bool &spare = kept_spare[static_cast<size_t>(it->usage())];
+		if (keep_spares && !spare){
+			spare = true;
+			++it;
+		}
+		else if (!wait_delay || it->idle_frames > release_delay){
+			dropped.push_back(std::move(*it));
+			it = buffers.erase(it);
+		}
+		else {
+			++it;
 		}
 	}
-	std::cout << "Warning: Found no buffer containing SubBuffer to free from\n";
+	if (dropped.empty()){
+		return false;
+	}
+	rebuild_index();
+	run_on_gl_thread(l, [&](){ dropped.clear(); });
+	return true;
+}
+bool glt::BufferAllocator::budget_can_fit(size_t block, size_t new_size, BufferUsage usage) const {
+	// A buffer can only be emptied and released if everything in it can be evicted
+	std::unordered_map<GLuint, size_t> evictable;
+	for (const auto &h : lru){
+		++evictable[handles[h].buffer];
+	}
+	size_t kept = 0;
+	for (const auto &b : buffers){
+		auto fnd = evictable.find(b.buffer);
+		const size_t n = fnd == evictable.end() ? 0 : fnd->second;
+		// Evicting from a big enough buffer of the same usage may make room in it
+		if (n != 0 && b.usage() == usage && b.capacity() >= block){
+			return true;
+		}
+		if (!b.empty() && n != b.live){
+			kept += b.capacity();
+		}
+	}
+	return kept + new_size <= budget;
+}
+void glt::BufferAllocator::rebuild_index(){
+	buffer_index.clear();
+	for (size_t i = 0; i < buffers.size(); ++i){
+		buffer_index[buffers[i].buffer] = i;
+	}
+}
+bool glt::BufferAllocator::evict_lru(std::unique_lock<std::recursive_mutex> &l){
+	// Sub buffers pinned by a realloc are being moved and can't be evicted out from under it,
+	// they keep their place in the list
+	auto is_pinned = [&](BufferHandle h){ return pinned.count(handle_key(handles[h])) != 0; };
+	for (;;){
+		auto it = std::find_if_not(lru.begin(), lru.end(), is_pinned);
+		if (it == lru.end()){
+			return false;
+		}
+		const BufferHandle h = *it;
+		lru.erase(it);
+		lru_pos.erase(h);
+		const SubBuffer b = handles[h];
+		const Buffer *parent = find_parent(b);
+		if (!parent){
+			continue;
+		}
+		Shadow shadow { std::vector<char>(b.size), arena_alignment(parent->arena, b.offset), parent->usage() };
+		// Reading the data back waits for the GPU to be done with it, so the space can be released
+		// right away even if frees are deferred. The lock may be dropped while the GL thread does
+		// the read, if the handle was freed or moved in the meantime we pick another
+		run_on_gl_thread(l, [&](){ storage->read(b.buffer, b.offset, b.size, shadow.data.data()); });
+		if (handles[h].buffer != b.buffer || handles[h].offset != b.offset || handles[h].size != b.size){
+			continue;
+		}
+		// A realloc may have pinned it while the lock was dropped, leave it evictable for later
+		if (is_pinned(h)){
+			if (!lru_pos.count(h)){
+				lru_pos[h] = lru.insert(lru.begin(), h);
+			}
+			continue;
+		}
+		// It may also have been made evictable again in the meantime
+		auto pos = lru_pos.find(h);
+		if (pos != lru_pos.end()){
+			lru.erase(pos->second);
+			lru_pos.erase(pos);
+		}
+		if (trace){
+			*trace << "f " << handle_key(b) << "\n";
+		}
+		++pools[static_cast<size_t>(shadow.usage)].evictions;
+		handle_owners.erase(handle_key(b));
+		release(handles[h]);
+		handles[h] = SubBuffer(0, b.size, 0);
+		evicted[h] = std::move(shadow);
+		table_dirty = true;
+		return true;
+	}
+}
+Buffer& glt::BufferAllocator::add_buffer(std::unique_lock<std::recursive_mutex> &l, size_t size,
+		BufferUsage usage)
+{
+	++pools[static_cast<size_t>(usage)].buffers_created;
+	if (std::this_thread::get_id() == gl_thread){
+		buffers.emplace_back(size, strategy, coherent, usage, storage);
+	}
+	else {
+		// The buffer is made on the GL thread then moved into place once we have the lock back
+		std::unique_ptr<Buffer> made;
+		run_on_gl_thread(l, [&](){ made.reset(new Buffer(size, strategy, coherent, usage, storage)); });
+		buffers.push_back(std::move(*made));
+	}
+	buffer_index[buffers.back().buffer] = buffers.size() - 1;
+	return buffers.back();
+}
+Buffer* glt::BufferAllocator::find_parent(const SubBuffer &buf){
+	auto fnd = buffer_index.find(buf.buffer);
+	if (fnd == buffer_index.end()){
+		return nullptr;
+	}
+	return &buffers[fnd->second];
+}
+void glt::BufferAllocator::update_handle(const SubBuffer &old, const SubBuffer &moved){
+	auto fnd = handle_owners.find(handle_key(old));
+	if (fnd == handle_owners.end()){
+		return;
+	}
+	const BufferHandle h = fnd->second;
+	handle_owners.erase(fnd);
+	// The block moved may be larger than the handle's sub buffer if the engine rounded it up
+	handles[h] = SubBuffer(moved.offset, handles[h].size, moved.buffer, moved.mapping, moved.coherent);
+	handle_owners[handle_key(handles[h])] = h;
+	table_dirty = true;
+}
+void glt::BufferAllocator::move_tag(const SubBuffer &old, const SubBuffer &moved){
+	auto fnd = tags.find(handle_key(old));
+	if (fnd == tags.end()){
+		return;
+	}
+	Tag tag = std::move(fnd->second);
+	tags.erase(fnd);
+	tag.size = std::max(tag.size, moved.size);
+	tags[handle_key(moved)] = std::move(tag);
+	relabel.insert(old.buffer);
+	relabel.insert(moved.buffer);
+}
+void glt::BufferAllocator::update_high_water(BufferUsage usage){
+	size_t pool_used = 0, total_used = 0;
+	for (const auto &b : buffers){
+		const size_t used = b.capacity() - b.free_bytes();
+		total_used += used;
+		if (b.usage() == usage){
+			pool_used += used;
+		}
+	}
+	PoolStats &pool = pools[static_cast<size_t>(usage)];
+	pool.high_water = std::max(pool.high_water, pool_used);
+	high_water = std::max(high_water, total_used);
+}
+void glt::BufferAllocator::update_labels(){
+	for (const auto &name : relabel){
+		Buffer *buf = find_parent(SubBuffer(0, 0, name));
+		if (!buf){
+			continue;
+		}
+		std::set<std::string> names;
+		for (const auto &t : tags){
+			if ((t.first >> 40) == name){
+				names.insert(t.second.name);
+			}
+		}
+		std::string label = std::string("glt ") + usage_name(buf->usage()) + " buffer";
+		for (auto it = names.begin(); it != names.end(); ++it){
+			label += (it == names.begin() ? ": " : ", ") + *it;
+		}
+		storage->label(name, label);
+	}
+	relabel.clear();
+}
+
+const size_t ThreadAllocCache::MIN_CLASS;
+const size_t ThreadAllocCache::MAX_CLASS;
+const size_t ThreadAllocCache::NUM_CLASSES;
+const size_t ThreadAllocCache::MAGAZINE_BYTES;
+
+glt::ThreadAllocCache::ThreadAllocCache(BufferAllocator &allocator, BufferUsage usage, size_t align)
+	: allocator(allocator), usage(usage), align(align)
+{}
+glt::ThreadAllocCache::~ThreadAllocCache(){
+	flush();
+}
+SubBuffer glt::ThreadAllocCache::alloc(size_t sz){
+	if (sz > MAX_CLASS){
+		return allocator.alloc(sz, align, usage);
+	}
+	const size_t cls = size_class(sz);
+	std::vector<SubBuffer> &mag = magazines[cls];
+	if (mag.empty()){
+		allocator.alloc_batch(batch_size(cls), MIN_CLASS << cls, align, usage, mag);
+		if (mag.empty()){
+			return SubBuffer{};
+		}
+	}
+	SubBuffer buf = mag.back();
+	mag.pop_back();
+	return buf;
+}
+void glt::ThreadAllocCache::free(SubBuffer &buf){
+	// Only blocks of exactly a class size can have come from the magazines
+	if (buf.size > MAX_CLASS || buf.size < MIN_CLASS || (buf.size & (buf.size - 1)) != 0){
+		allocator.free(buf);
+		return;
+	}
+	if (allocator.deferred_freeing()){
+		to_free.push_back(buf);
+		buf.size = 0;
+		if (to_free.size() >= batch_size(0)){
+			allocator.free_batch(to_free.size(), to_free.data());
+			to_free.clear();
+		}
+		return;
+	}
+	const size_t cls = size_class(buf.size);
+	std::vector<SubBuffer> &mag = magazines[cls];
+	mag.push_back(buf);
+	buf.size = 0;
+	// Hand a batch back once the magazine is holding on to more than it needs
+	const size_t batch = batch_size(cls);
+	if (mag.size() > 2 * batch){
+		allocator.free_batch(batch, &mag[mag.size() - batch]);
+		mag.resize(mag.size() - batch);
+	}
+}
+void glt::ThreadAllocCache::flush(){
+	for (auto &mag : magazines){
+		if (!mag.empty()){
+			allocator.free_batch(mag.size(), mag.data());
+			mag.clear();
+		}
+	}
+	if (!to_free.empty()){
+		allocator.free_batch(to_free.size(), to_free.data());
+		to_free.clear();
+	}
+}
+size_t glt::ThreadAllocCache::size_class(size_t sz){
+	size_t cls = 0;
+	for (; (MIN_CLASS << cls) < sz; ++cls);
+	return cls;
+}
+size_t glt::ThreadAllocCache::batch_size(size_t cls){
+	return std::max(std::min(MAGAZINE_BYTES / (MIN_CLASS << cls), size_t{32}), size_t{1});
+}
+
+glt::StreamRingStats::StreamRingStats() : allocs(0), frames(0), wraps(0), stalls(0),
+	stall_ms(0), max_stall_ms(0)
+{}
+
+glt::StreamRingBuffer::StreamRingBuffer(size_t size, bool coherent, BufferStorage *storage)
+	: buffer(size, AllocStrategy::FIRST_FIT, coherent, BufferUsage::DYNAMIC, storage),
+	storage(storage ? storage : gl_buffer_storage()), head(0), used(0), frame_bytes(0)
+{
+	buffer.alloc(size, ring);
+}
+glt::StreamRingBuffer::~StreamRingBuffer(){
+	for (auto &f : frames){
+		storage->delete_fence(f.fence);
+	}
+}
+SubBuffer glt::StreamRingBuffer::alloc(size_t sz, size_t align){
+	size_t offset = 0, need = 0;
+	bool wrap = false;
+	// Reclaim space from completed frames until the allocation fits
+	for (;;){
+		// Nothing is in flight so we can start back at the beginning without waiting
+		if (used == 0){
+			head = 0;
+		}
+		// Find where the allocation would go, wrapping back to the start if it won't fit before the end
+		offset = head % align == 0 ? head : head + align - head % align;
+		wrap = offset + sz > ring.size;
+		if (wrap){
+			offset = 0;
+		}
+		// The space consumed includes padding skipped for alignment or wasted at the end of the ring
+		need = (wrap ? ring.size - head : offset - head) + sz;
+		if (used + need <= ring.size){
+			break;
+		}
+		if (frames.empty()){
+			std::cout << "StreamRingBuffer error: allocation of " << sz << " bytes can't fit in the ring"
+				<< " with the " << frame_bytes << " bytes already allocated this frame\n";
+			return SubBuffer{};
+		}
+		retire_frame();
+	}
+	if (wrap){
+		++ring_stats.wraps;
+	}
+	++ring_stats.allocs;
+	head = offset + sz;
+	used += need;
+	frame_bytes += need;
+	return SubBuffer(ring.offset + offset, sz, ring.buffer, ring.mapping, ring.coherent);
+}
+void glt::StreamRingBuffer::end_frame(){
+	++ring_stats.frames;
+	if (frame_bytes == 0){
+		return;
+	}
+	frames.push_back(Frame { storage->fence(), frame_bytes });
+	frame_bytes = 0;
+}
+const StreamRingStats& glt::StreamRingBuffer::stats() const {
+	return ring_stats;
+}
+void glt::StreamRingBuffer::retire_frame(){
+	Frame &f = frames.front();
+	// Check if the frame is already done before counting this as a stall
+	if (!storage->signaled(f.fence)){
+		using namespace std::chrono;
+		auto start = high_resolution_clock::now();
+		GLenum status = GL_TIMEOUT_EXPIRED;
+		do {
+			status = storage->wait(f.fence, 1000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		const double elapsed = duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - start).count();
+		++ring_stats.stalls;
+		ring_stats.stall_ms += elapsed;
+		ring_stats.max_stall_ms = std::max(ring_stats.max_stall_ms, elapsed);
+		if (status == GL_WAIT_FAILED){
+			std::cout << "StreamRingBuffer error: waiting on frame fence failed\n";
+		}
+	}
+	storage->delete_fence(f.fence);
+	used -= f.bytes;
+	frames.pop_front();
 }
 
 std::ostream& operator<<(std::ostream &os, const SubBuffer &b){
@@ -192,24 +1449,15 @@ std::ostream& operator<<(std::ostream &os, const SubBuffer &b){
 		<< ", buffer: " << b.buffer << " }";
 	return os;
 }
-std::ostream& operator<<(std::ostream &os, const Block &b){
-	os << "Block { offset: " << b.offset << ", size: " << b.size << " }";
-	return os;
-}
 std::ostream& operator<<(std::ostream &os, const Buffer &b){
 	os << "Buffer { size: " << b.size << ", buffer: " << b.buffer
-		<< "\n\tfree blocks:\n";
-	for (const auto &f : b.freeb){
-		os << "\t\t" << f.second << "\n";
-	}
-	os << "\tused blocks:\n";
-	for (const auto &u : b.used){
-		os << "\t\t" << u.second << "\n";
-	}
+		<< "\n";
+	b.engine->print(os);
 	os << "\t}";
 	return os;
 }
 std::ostream& operator<<(std::ostream &os, const BufferAllocator &b){
+	std::lock_guard<std::recursive_mutex> l(b.lock);
 	os << "BufferAllocator { buffers:\n";
 	for (const auto &buf : b.buffers){
 		os << "\t" << buf << "\n";
@@ -217,4 +1465,21 @@ std::ostream& operator<<(std::ostream &os, const BufferAllocator &b){
 	os << "}";
 	return os;
 }
+std::ostream& operator<<(std::ostream &os, const StreamRingStats &s){
+	os << "StreamRingStats { allocs: " << s.allocs << ", frames: " << s.frames
+		<< ", wraps: " << s.wraps << ", stalls: " << s.stalls
+		<< ", stall_ms: " << s.stall_ms << ", max_stall_ms: " << s.max_stall_ms << " }";
+	return os;
+}
+std::ostream& operator<<(std::ostream &os, const PoolStats &s){
+	os << "PoolStats { buffers: " << s.buffers << ", capacity: " << s.capacity
+		<< ", free_bytes: " << s.free_bytes << ", largest_free: " << s.largest_free
+		<< ", fragmentation: " << s.fragmentation() << ", high_water: " << s.high_water
+		<< ", allocs: " << s.allocs << ", reallocs: " << s.reallocs
+		<< ", frees: " << s.frees << ", buffers_created: " << s.buffers_created
+		<< ", evictions: " << s.evictions << ", restores: " << s.restores
+		<< ", padding: { packed: " << s.arenas[static_cast<size_t>(AlignClass::PACKED)].padding
+		<< ", aligned: " << s.arenas[static_cast<size_t>(AlignClass::ALIGNED)].padding << " } }";
+	return os;
+}
 
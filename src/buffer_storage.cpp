@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include "glt/buffer_storage.h"
+
+using namespace glt;
+
+BufferStorage* glt::gl_buffer_storage(){
+	static GLBufferStorage storage;
+	return &storage;
+}
+
+GLuint glt::GLBufferStorage::create(size_t size, BufferUsage usage, bool &coherent, char *&mapping){
+	GLuint buffer = 0;
+	mapping = nullptr;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if (ogl_IsVersionGEQ(4, 4)){
+		GLbitfield access = 0;
+		switch (usage){
+			case BufferUsage::STATIC:
+				break;
+			case BufferUsage::STREAM:
+				access = GL_MAP_WRITE_BIT;
+				break;
+			case BufferUsage::READBACK:
+				access = GL_MAP_READ_BIT;
+				break;
+			default:
+				access = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT;
+				break;
+		}
+		if (access == 0){
+			// Static storage is left unmappable so the driver can place it in device memory
+			glBufferStorage(GL_ARRAY_BUFFER, size, NULL, 0);
+		}
+		else {
+			access |= GL_MAP_PERSISTENT_BIT | (coherent ? GL_MAP_COHERENT_BIT : 0);
+			const GLbitfield client_bit = usage == BufferUsage::READBACK ? GL_CLIENT_STORAGE_BIT : 0;
+			glBufferStorage(GL_ARRAY_BUFFER, size, NULL, access | client_bit);
+			// Map the whole buffer once up front so sub buffers can be accessed without
+			// having to map/unmap each time. Non-coherent mappings must flush their writes explicitly
+			const GLbitfield flush_bit = !coherent && (access & GL_MAP_WRITE_BIT) ? GL_MAP_FLUSH_EXPLICIT_BIT : 0;
+			mapping = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, access | flush_bit));
+		}
+	}
+	else {
+		// Nvidia seems to put buffer storage created buffers with write | read as dynamic draw so we'll
+		// use that as our fallback usage as well
+		GLenum gl_usage = GL_DYNAMIC_DRAW;
+		switch (usage){
+			case BufferUsage::STATIC:
+				gl_usage = GL_STATIC_DRAW;
+				break;
+			case BufferUsage::STREAM:
+				gl_usage = GL_STREAM_DRAW;
+				break;
+			case BufferUsage::READBACK:
+				gl_usage = GL_STREAM_READ;
+				break;
+			default:
+				break;
+		}
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, gl_usage);
+	}
+	return buffer;
+}
+void glt::GLBufferStorage::destroy(GLuint buffer){
+	glDeleteBuffers(1, &buffer);
+}
+void glt::GLBufferStorage::copy(GLuint src, size_t src_offset, GLuint dst, size_t dst_offset, size_t size){
+	if (ogl_IsVersionGEQ(4, 5)){
+		glCopyNamedBufferSubData(src, dst, src_offset, dst_offset, size);
+	}
+	else {
+		glBindBuffer(GL_COPY_READ_BUFFER, src);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, size);
+	}
+}
+void glt::GLBufferStorage::read(GLuint buffer, size_t offset, size_t size, void *data){
+	if (ogl_IsVersionGEQ(4, 5)){
+		glGetNamedBufferSubData(buffer, offset, size, data);
+	}
+	else {
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, offset, size, data);
+	}
+}
+GLsync glt::GLBufferStorage::fence(){
+	return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+bool glt::GLBufferStorage::signaled(GLsync fence){
+	const GLenum status = glClientWaitSync(fence, 0, 0);
+	return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+GLenum glt::GLBufferStorage::wait(GLsync fence, uint64_t timeout){
+	return glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+}
+void glt::GLBufferStorage::delete_fence(GLsync fence){
+	glDeleteSync(fence);
+}
+void glt::GLBufferStorage::label(GLuint buffer, const std::string &label){
+	if (!ogl_IsVersionGEQ(4, 3)){
+		return;
+	}
+	GLint max_len = 0;
+	glGetIntegerv(GL_MAX_LABEL_LENGTH, &max_len);
+	size_t len = label.size();
+	if (max_len > 0 && len >= static_cast<size_t>(max_len)){
+		len = max_len - 1;
+	}
+	glObjectLabel(GL_BUFFER, buffer, static_cast<GLsizei>(len), label.c_str());
+}
+size_t glt::GLBufferStorage::offset_alignment(GLenum target){
+	GLenum query = GL_NONE;
+	switch (target){
+		case GL_UNIFORM_BUFFER:
+			query = GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT;
+			break;
+		case GL_SHADER_STORAGE_BUFFER:
+			query = GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT;
+			break;
+		case GL_TEXTURE_BUFFER:
+			query = GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT;
+			break;
+		default:
+			// Vertex, index and indirect command data only need to be aligned to their
+			// basic machine units, which are at most 4 bytes
+			return 4;
+	}
+	GLint align = 0;
+	glGetIntegerv(query, &align);
+	return align > 0 ? static_cast<size_t>(align) : 256;
+}
+
+glt::HostBufferStorage::HostBufferStorage() : next_name(1), bytes(0), peak(0){}
+GLuint glt::HostBufferStorage::create(size_t size, BufferUsage, bool &coherent, char *&mapping){
+	const GLuint name = next_name++;
+	// The memory is left uninitialized like a fresh GL buffer, so pages are only
+	// touched once they're written
+	stores[name] = std::unique_ptr<char[]>(new char[size]);
+	sizes[name] = size;
+	bytes += size;
+	peak = std::max(peak, bytes);
+	coherent = true;
+	mapping = stores[name].get();
+	return name;
+}
+void glt::HostBufferStorage::destroy(GLuint buffer){
+	assert(stores.count(buffer));
+	bytes -= sizes[buffer];
+	stores.erase(buffer);
+	sizes.erase(buffer);
+}
+void glt::HostBufferStorage::copy(GLuint src, size_t src_offset, GLuint dst, size_t dst_offset, size_t size){
+	std::memmove(stores[dst].get() + dst_offset, stores[src].get() + src_offset, size);
+}
+void glt::HostBufferStorage::read(GLuint buffer, size_t offset, size_t size, void *data){
+	std::memcpy(data, stores[buffer].get() + offset, size);
+}
+GLsync glt::HostBufferStorage::fence(){
+	// Copies are done immediately so there's never anything to wait on, any
+	// non-null value will do as the fence
+	return reinterpret_cast<GLsync>(this);
+}
+bool glt::HostBufferStorage::signaled(GLsync){
+	return true;
+}
+GLenum glt::HostBufferStorage::wait(GLsync, uint64_t){
+	return GL_ALREADY_SIGNALED;
+}
+void glt::HostBufferStorage::delete_fence(GLsync){}
+void glt::HostBufferStorage::label(GLuint, const std::string&){}
+size_t glt::HostBufferStorage::offset_alignment(GLenum target){
+	switch (target){
+		case GL_UNIFORM_BUFFER:
+		case GL_SHADER_STORAGE_BUFFER:
+		case GL_TEXTURE_BUFFER:
+			return 256;
+		default:
+			return 4;
+	}
+}
+size_t glt::HostBufferStorage::allocated_bytes() const {
+	return bytes;
+}
+size_t glt::HostBufferStorage::peak_bytes() const {
+	return peak;
+}
+
@@ -0,0 +1,363 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include "glt/util.h"
+#include "glt/bake_manifest.h"
+#include "glt/geometry_cache.h"
+
+using namespace glt;
+
+static const char CACHE_MAGIC[8] = { 'G', 'L', 'T', 'G', 'E', 'O', 'M', '\0' };
+// Bump whenever the layout of the cache or the data stored in it changes
+static const uint32_t CACHE_VERSION = 1;
+
+// A string in the cache's string table
+struct StringRef {
+	uint64_t offset, len;
+};
+// The cache starts with the header, offsets are from the start of the file
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	// The vertex format and optimization the data was made with, see format_key
+	uint32_t format;
+	FileKey source;
+	uint64_t file_size;
+	uint64_t shapes, shapes_offset;
+	uint64_t materials, materials_offset;
+	uint64_t textures, textures_offset;
+	uint64_t strings_size, strings_offset;
+	uint64_t verts_size, verts_offset;
+	uint64_t elems, elems_offset;
+};
+struct CachedShape {
+	StringRef name;
+	uint64_t index_offset, indices, vert_offset, verts, mat_id;
+	float pos_scale[3], pos_offset[3], uv_scale[2], uv_offset[2];
+};
+// The mat_id of shapes without a material, the parser's -1 material id as stored in ModelMatInfo
+static const uint64_t NO_MATERIAL = static_cast<size_t>(-1);
+struct CachedMaterial {
+	StringRef name;
+	float ka[4], kd[4], ks[4];
+	int32_t textures[MAT_TEX_COUNT];
+	int32_t pad;
+};
+
+static std::string cache_dir;
+static bool cache_enabled = true;
+
+static uint32_t format_key(const VertexFormat &format, bool optimize){
+	return static_cast<uint32_t>(format.position) | static_cast<uint32_t>(format.normal) << 8
+		| static_cast<uint32_t>(format.texcoord) << 16 | (optimize ? 1u : 0u) << 24;
+}
+static uint64_t align_to(uint64_t x, uint64_t align){
+	return (x + align - 1) / align * align;
+}
+// Check `count` elements of elem_size bytes starting at offset fit in the file
+static bool in_bounds(uint64_t offset, uint64_t count, uint64_t elem_size, uint64_t file_size){
+	return offset <= file_size && count <= (file_size - offset) / elem_size;
+}
+template<typename T>
+static T read_record(const char *data, uint64_t offset, size_t i){
+	T t;
+	std::memcpy(&t, data + offset + i * sizeof(T), sizeof(T));
+	return t;
+}
+static CacheHeader read_header(const char *data){
+	return read_record<CacheHeader>(data, 0, 0);
+}
+
+void glt::set_geometry_cache_dir(const std::string &dir){
+	cache_dir = dir;
+}
+void glt::set_geometry_cache_enabled(bool enabled){
+	cache_enabled = enabled;
+}
+bool glt::geometry_cache_enabled(){
+	return cache_enabled;
+}
+std::string glt::geometry_cache_path(const std::string &model_file, const VertexFormat &format, bool optimize){
+	std::ostringstream tag;
+	tag << ".p" << static_cast<int>(format.position) << "n" << static_cast<int>(format.normal)
+		<< "t" << static_cast<int>(format.texcoord) << (optimize ? "o" : "") << ".gltgeom";
+	if (cache_dir.empty()){
+		return model_file + tag.str();
+	}
+	// Models from different directories share the cache directory so the
+	// cache's name is prefixed with a hash of the model's path
+	const size_t sep = model_file.rfind(PATH_SEP);
+	const std::string name = sep == std::string::npos ? model_file : model_file.substr(sep + 1);
+	std::ostringstream path;
+	path << cache_dir;
+	if (cache_dir.back() != PATH_SEP){
+		path << PATH_SEP;
+	}
+	path << std::hex << std::setw(16) << std::setfill('0')
+		<< hash_bytes(model_file.data(), model_file.size()) << "_" << name << tag.str();
+	return path.str();
+}
+
+glt::MaterialDesc::MaterialDesc() : ka(0), kd(0), ks(0){
+	std::fill(textures, textures + MAT_TEX_COUNT, -1);
+}
+
+glt::GeometryCache::GeometryCache() : data(nullptr), size(0){}
+bool glt::GeometryCache::open(const std::string &model_file, const VertexFormat &format, bool optimize){
+	// Baked geometry registered by a manifest is used even if caching is disabled
+	const std::string baked = baked_file(model_file);
+	if (!baked.empty() && open_file(baked, model_file, format, optimize)){
+		return true;
+	}
+	return cache_enabled && open_file(geometry_cache_path(model_file, format, optimize), model_file,
+			format, optimize);
+}
+bool glt::GeometryCache::open_file(const std::string &path, const std::string &model_file,
+		const VertexFormat &format, bool optimize)
+{
+	bytes.clear();
+	data = nullptr;
+	size = 0;
+	FileStat st;
+	if (!stat_file(path, st) || !mapping.open(path)){
+		return false;
+	}
+	data = mapping.data();
+	size = mapping.size();
+	bool touched = false;
+	if (!validate(model_file, format, optimize, touched)){
+		std::cout << "Geometry cache " << path << " is out of date\n";
+		mapping.close();
+		data = nullptr;
+		size = 0;
+		return false;
+	}
+	// The model was touched but not changed, update the cache's modification time so we don't
+	// need to rehash it next time. The file can't be written while it's mapped so it's unmapped
+	// to update the key then mapped again
+	if (touched){
+		mapping.close();
+		update_file_key(path, offsetof(CacheHeader, source), model_file);
+		data = nullptr;
+		size = 0;
+		if (!mapping.open(path)){
+			return false;
+		}
+		data = mapping.data();
+		size = mapping.size();
+		if (!validate(model_file, format, optimize, touched)){
+			mapping.close();
+			data = nullptr;
+			size = 0;
+			return false;
+		}
+	}
+	return true;
+}
+bool glt::GeometryCache::validate(const std::string &model_file, const VertexFormat &format,
+		bool optimize, bool &touched)
+{
+	if (size < sizeof(CacheHeader)){
+		return false;
+	}
+	CacheHeader h = read_header(data);
+	if (std::memcmp(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || h.version != CACHE_VERSION
+			|| h.format != format_key(format, optimize) || h.file_size != size)
+	{
+		return false;
+	}
+	if (!in_bounds(h.shapes_offset, h.shapes, sizeof(CachedShape), size)
+			|| !in_bounds(h.materials_offset, h.materials, sizeof(CachedMaterial), size)
+			|| !in_bounds(h.textures_offset, h.textures, sizeof(StringRef), size)
+			|| !in_bounds(h.strings_offset, h.strings_size, 1, size)
+			|| !in_bounds(h.verts_offset, h.verts_size, 1, size)
+			|| !in_bounds(h.elems_offset, h.elems, sizeof(GLuint), size)
+			|| h.elems_offset % sizeof(GLuint) != 0)
+	{
+		return false;
+	}
+	// Check the records only reference data within the cache so the loaders can trust them
+	auto valid_string = [&](const StringRef &s){
+		return s.offset <= h.strings_size && s.len <= h.strings_size - s.offset;
+	};
+	const uint64_t stride = format.stride();
+	for (size_t i = 0; i < h.shapes; ++i){
+		const CachedShape s = read_record<CachedShape>(data, h.shapes_offset, i);
+		if (!valid_string(s.name) || s.index_offset > h.elems || s.indices > h.elems - s.index_offset
+				|| s.vert_offset > h.verts_size / stride || s.verts > h.verts_size / stride - s.vert_offset
+				|| (s.mat_id >= h.materials && s.mat_id != NO_MATERIAL))
+		{
+			return false;
+		}
+	}
+	for (size_t i = 0; i < h.materials; ++i){
+		const CachedMaterial m = read_record<CachedMaterial>(data, h.materials_offset, i);
+		if (!valid_string(m.name)){
+			return false;
+		}
+		for (const auto &t : m.textures){
+			if (t < -1 || t >= static_cast<int64_t>(h.textures)){
+				return false;
+			}
+		}
+	}
+	for (size_t i = 0; i < h.textures; ++i){
+		if (!valid_string(read_record<StringRef>(data, h.textures_offset, i))){
+			return false;
+		}
+	}
+	return file_key_matches(model_file, h.source, touched);
+}
+bool glt::GeometryCache::build(const std::string &model_file, const VertexFormat &format, bool optimize,
+		const GeometryData &geom, const std::string &out_file, std::ostream &log)
+{
+	mapping.close();
+	CacheHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	h.version = CACHE_VERSION;
+	h.format = format_key(format, optimize);
+	const bool have_source = make_file_key(model_file, h.source);
+
+	std::string strings;
+	auto add_string = [&](const std::string &s){
+		StringRef r{strings.size(), s.size()};
+		strings += s;
+		return r;
+	};
+	std::vector<CachedShape> shapes(geom.shapes.size());
+	for (size_t i = 0; i < shapes.size(); ++i){
+		const ModelMatInfo &info = geom.shapes[i].second;
+		CachedShape &s = shapes[i];
+		s.name = add_string(geom.shapes[i].first);
+		s.index_offset = info.index_offset;
+		s.indices = info.indices;
+		s.vert_offset = info.vert_offset;
+		s.verts = info.verts;
+		s.mat_id = info.mat_id;
+		for (int j = 0; j < 3; ++j){
+			s.pos_scale[j] = info.dequant.pos_scale[j];
+			s.pos_offset[j] = info.dequant.pos_offset[j];
+		}
+		for (int j = 0; j < 2; ++j){
+			s.uv_scale[j] = info.dequant.uv_scale[j];
+			s.uv_offset[j] = info.dequant.uv_offset[j];
+		}
+	}
+	std::vector<CachedMaterial> materials(geom.materials.size());
+	for (size_t i = 0; i < materials.size(); ++i){
+		const MaterialDesc &desc = geom.materials[i];
+		CachedMaterial &m = materials[i];
+		std::memset(&m, 0, sizeof(m));
+		m.name = add_string(desc.name);
+		for (int j = 0; j < 4; ++j){
+			m.ka[j] = desc.ka[j];
+			m.kd[j] = desc.kd[j];
+			m.ks[j] = desc.ks[j];
+		}
+		std::copy(desc.textures, desc.textures + MAT_TEX_COUNT, m.textures);
+	}
+	std::vector<StringRef> textures;
+	for (const auto &t : geom.textures){
+		textures.push_back(add_string(t));
+	}
+
+	h.shapes = shapes.size();
+	h.shapes_offset = align_to(sizeof(CacheHeader), 8);
+	h.materials = materials.size();
+	h.materials_offset = h.shapes_offset + shapes.size() * sizeof(CachedShape);
+	h.textures = textures.size();
+	h.textures_offset = h.materials_offset + materials.size() * sizeof(CachedMaterial);
+	h.strings_size = strings.size();
+	h.strings_offset = h.textures_offset + textures.size() * sizeof(StringRef);
+	// Align the vertex data for the benefit of anyone copying it with SIMD
+	h.verts_size = geom.verts.size();
+	h.verts_offset = align_to(h.strings_offset + h.strings_size, 16);
+	h.elems = geom.elems.size();
+	h.elems_offset = align_to(h.verts_offset + h.verts_size, sizeof(GLuint));
+	h.file_size = h.elems_offset + h.elems * sizeof(GLuint);
+
+	bytes.assign(h.file_size, 0);
+	auto write = [&](uint64_t offset, const void *src, size_t sz){
+		const char *c = static_cast<const char*>(src);
+		std::copy(c, c + sz, bytes.begin() + offset);
+	};
+	write(0, &h, sizeof(h));
+	write(h.shapes_offset, shapes.data(), shapes.size() * sizeof(CachedShape));
+	write(h.materials_offset, materials.data(), materials.size() * sizeof(CachedMaterial));
+	write(h.textures_offset, textures.data(), textures.size() * sizeof(StringRef));
+	write(h.strings_offset, strings.data(), strings.size());
+	write(h.verts_offset, geom.verts.data(), geom.verts.size());
+	write(h.elems_offset, geom.elems.data(), geom.elems.size() * sizeof(GLuint));
+	data = bytes.data();
+	size = bytes.size();
+	if (out_file.empty() && !cache_enabled){
+		return false;
+	}
+	if (!have_source){
+		log << "Failed to read " << model_file << " to key its geometry cache, not writing cache\n";
+		return false;
+	}
+	const std::string path = out_file.empty() ? geometry_cache_path(model_file, format, optimize) : out_file;
+	if (!replace_file(path, bytes.data(), bytes.size())){
+		return false;
+	}
+	log << "wrote geometry cache " << path << " (" << bytes.size() << " bytes)\n";
+	return true;
+}
+size_t glt::GeometryCache::shapes() const {
+	return data ? read_header(data).shapes : 0;
+}
+std::string glt::GeometryCache::shape_name(size_t i) const {
+	const CacheHeader h = read_header(data);
+	const StringRef name = read_record<CachedShape>(data, h.shapes_offset, i).name;
+	return std::string(data + h.strings_offset + name.offset, name.len);
+}
+ModelMatInfo glt::GeometryCache::shape(size_t i) const {
+	const CacheHeader h = read_header(data);
+	const CachedShape s = read_record<CachedShape>(data, h.shapes_offset, i);
+	ModelMatInfo info(s.index_offset, s.indices, s.vert_offset, s.mat_id, s.verts);
+	info.dequant.pos_scale = glm::vec3(s.pos_scale[0], s.pos_scale[1], s.pos_scale[2]);
+	info.dequant.pos_offset = glm::vec3(s.pos_offset[0], s.pos_offset[1], s.pos_offset[2]);
+	info.dequant.uv_scale = glm::vec2(s.uv_scale[0], s.uv_scale[1]);
+	info.dequant.uv_offset = glm::vec2(s.uv_offset[0], s.uv_offset[1]);
+	return info;
+}
+size_t glt::GeometryCache::materials() const {
+	return data ? read_header(data).materials : 0;
+}
+MaterialDesc glt::GeometryCache::material(size_t i) const {
+	const CacheHeader h = read_header(data);
+	const CachedMaterial m = read_record<CachedMaterial>(data, h.materials_offset, i);
+	MaterialDesc desc;
+	desc.name = std::string(data + h.strings_offset + m.name.offset, m.name.len);
+	desc.ka = glm::vec4(m.ka[0], m.ka[1], m.ka[2], m.ka[3]);
+	desc.kd = glm::vec4(m.kd[0], m.kd[1], m.kd[2], m.kd[3]);
+	desc.ks = glm::vec4(m.ks[0], m.ks[1], m.ks[2], m.ks[3]);
+	std::copy(m.textures, m.textures + MAT_TEX_COUNT, desc.textures);
+	return desc;
+}
+size_t glt::GeometryCache::textures() const {
+	return data ? read_header(data).textures : 0;
+}
+std::string glt::GeometryCache::texture(size_t i) const {
+	const CacheHeader h = read_header(data);
+	const StringRef t = read_record<StringRef>(data, h.textures_offset, i);
+	return std::string(data + h.strings_offset + t.offset, t.len);
+}
+const char* glt::GeometryCache::verts() const {
+	return data ? data + read_header(data).verts_offset : nullptr;
+}
+size_t glt::GeometryCache::verts_size() const {
+	return data ? read_header(data).verts_size : 0;
+}
+const GLuint* glt::GeometryCache::elems() const {
+	return data ? reinterpret_cast<const GLuint*>(data + read_header(data).elems_offset) : nullptr;
+}
+size_t glt::GeometryCache::elems_count() const {
+	return data ? read_header(data).elems : 0;
+}
+
@@ -1,17 +1,304 @@
 #include <iostream>
 #include <set>
 #include <algorithm>
-#include <numeric>
+#include <iterator>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <atomic>
 #include <glm/ext.hpp>
 #include "glt/util.h"
 #include "glt/load_models.h"
+#include "glt/vertex_layout.h"
+#include "glt/geometry_cache.h"
+#include "glt/obj_parser.h"
+#include "glt/bounded_queue.h"
 
-glt::ModelInfo::ModelInfo(size_t index_offset, size_t indices, size_t vert_offset)
-	: index_offset(index_offset), indices(indices), vert_offset(vert_offset)
+// A vertex in the FloatVertexLayout format welded in
+struct WeldVertex {
+	float attribs[glt::FLOAT_VERTEX_FLOATS];
+
+	bool operator==(const WeldVertex &b) const {
+		return std::memcmp(attribs, b.attribs, sizeof(attribs)) == 0;
+	}
+};
+struct WeldVertexHash {
+	size_t operator()(const WeldVertex &v) const {
+		// FNV-1a over the attribute bits, vertices are only welded if they match exactly
+		uint32_t bits[glt::FLOAT_VERTEX_FLOATS];
+		std::memcpy(bits, v.attribs, sizeof(bits));
+		uint64_t h = 14695981039346656037ull;
+		for (const auto &b : bits){
+			h = (h ^ b) * 1099511628211ull;
+		}
+		return static_cast<size_t>(h);
+	}
+};
+// Weld the shape's vertices, appending the unique ones to verts and the shape's indices
+// remapped to them to elems. The indices are relative to the first vertex appended.
+// Returns the number of unique vertices appended
+static size_t weld_shape(const tinyobj::mesh_t &mesh, std::vector<float> &verts, std::vector<GLuint> &elems){
+	using namespace glt;
+	// tinyobj stores each attribute in its own array with the same number of components as our float vertex
+	const size_t pos_n = Pos3f::components, normal_n = Normal3f::components, uv_n = UV2f::components;
+	const size_t n_verts = mesh.positions.size() / pos_n;
+	std::unordered_map<WeldVertex, GLuint, WeldVertexHash> unique;
+	unique.reserve(n_verts);
+	// Weld each of the loader's vertices once so indices referencing them don't need to be hashed
+	std::vector<GLuint> remap(n_verts);
+	for (size_t i = 0; i < n_verts; ++i){
+		WeldVertex v;
+		std::fill(std::begin(v.attribs), std::end(v.attribs), 0.f);
+		std::copy(mesh.positions.begin() + pos_n * i, mesh.positions.begin() + pos_n * (i + 1), v.attribs);
+		// Some models may not have/need normals or texcoords
+		if (mesh.normals.size() >= normal_n * (i + 1)){
+			std::copy(mesh.normals.begin() + normal_n * i, mesh.normals.begin() + normal_n * (i + 1),
+					v.attribs + FLOAT_VERTEX_NORMAL);
+		}
+		if (mesh.texcoords.size() >= uv_n * (i + 1)){
+			std::copy(mesh.texcoords.begin() + uv_n * i, mesh.texcoords.begin() + uv_n * (i + 1),
+					v.attribs + FLOAT_VERTEX_TEXCOORD);
+		}
+		const GLuint next = static_cast<GLuint>(unique.size());
+		auto fnd = unique.insert(std::make_pair(v, next));
+		if (fnd.second){
+			verts.insert(verts.end(), std::begin(v.attribs), std::end(v.attribs));
+		}
+		remap[i] = fnd.first->second;
+	}
+	elems.reserve(elems.size() + mesh.indices.size());
+	for (const auto &i : mesh.indices){
+		elems.push_back(remap[i]);
+	}
+	return unique.size();
+}
+// Totals over the shapes loaded for reporting
+struct LoadStats {
+	size_t loaded_verts, unique_verts;
+	glt::MeshOptStats opt;
+	glt::QuantizationError quant;
+
+	LoadStats() : loaded_verts(0), unique_verts(0){}
+};
+// Weld and optionally optimize the shape's vertices then pack them into the vertex format,
+// appending them to packed and the shape's indices to elems. verts is scratch space for
+// the welded float vertices. Fills out the offsets, counts and dequantization of the info
+template<typename Info>
+static void load_shape(const tinyobj::mesh_t &mesh, bool optimize, const glt::VertexFormat &format,
+		std::vector<float> &verts, std::vector<char> &packed, std::vector<GLuint> &elems, Info &info,
+		LoadStats &stats)
+{
+	const size_t stride = format.stride();
+	info.index_offset = elems.size();
+	info.indices = mesh.indices.size();
+	info.vert_offset = packed.size() / stride;
+	verts.clear();
+	info.verts = weld_shape(mesh, verts, elems);
+	if (optimize){
+		const glt::MeshOptStats opt = glt::optimize_mesh(verts.data(), glt::FLOAT_VERTEX_FLOATS, info.verts,
+				elems.data() + info.index_offset, info.indices);
+		stats.opt.before.triangles += opt.before.triangles;
+		stats.opt.before.vertices += opt.before.vertices;
+		stats.opt.before.transformed += opt.before.transformed;
+		stats.opt.after.triangles += opt.after.triangles;
+		stats.opt.after.vertices += opt.after.vertices;
+		stats.opt.after.transformed += opt.after.transformed;
+	}
+	packed.resize(packed.size() + info.verts * stride);
+	glt::pack_vertices(verts.data(), info.verts, format, packed.data() + info.vert_offset * stride,
+			info.dequant, stats.quant);
+	stats.loaded_verts += mesh.positions.size() / glt::Pos3f::components;
+	stats.unique_verts += info.verts;
+}
+static void print_load_stats(const LoadStats &stats, bool optimize, const glt::VertexFormat &format,
+		std::ostream &log)
+{
+	log << "welded " << stats.loaded_verts << " vertices to " << stats.unique_verts << " unique vertices\n";
+	if (optimize){
+		log << "optimized models, ACMR: " << stats.opt.before.acmr() << " -> " << stats.opt.after.acmr()
+			<< ", ATVR: " << stats.opt.before.atvr() << " -> " << stats.opt.after.atvr() << "\n";
+	}
+	if (!format.is_float()){
+		log << "packed vertices in " << format << ", " << stats.quant << "\n";
+	}
+}
+
+// Called with the texture files (relative to the model) used by a model's materials as soon
+// as they're known, so the textures can start loading while the rest of the model is processed
+typedef std::function<void(const std::vector<std::string>&)> TexturesCallback;
+
+// Parse the model file on `threads` threads (0 uses one per core) then weld, optimize and pack its
+// shapes into geom, printing out what was loaded to log. If `cancel` is passed the parse is
+// abandoned and fails once it's set, checked between shapes
+static bool parse_model(const std::string &file, bool optimize, const glt::VertexFormat &format,
+		glt::GeometryData &geom, const TexturesCallback &on_textures = TexturesCallback(),
+		const std::atomic<bool> *cancel = nullptr, size_t threads = 0, std::ostream &log = std::cout)
+{
+	using namespace glt;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string base_path;
+	const auto base_path_end = file.rfind(PATH_SEP);
+	if (base_path_end != std::string::npos){
+		base_path = file.substr(0, base_path_end + 1);
+	}
+	std::string err = load_obj(shapes, materials, file, base_path, threads);
+	if (!err.empty()){
+		log << "Failed to load model " << file << " error: " << err << std::endl;
+		return false;
+	}
+	if (cancel && *cancel){
+		return false;
+	}
+	log << "loaded " << shapes.size() << " model(s) from " << file << ", name(s):\n";
+	for (const auto &s : shapes){
+		log << "\t" << s.name;
+		if (!materials.empty()){
+			log << ", uses material: " << materials[s.mesh.material_ids[0]].name << "\n";
+		}
+		else {
+			log << "\n";
+		}
+	}
+	log << "loaded " << materials.size() << " material(s):\n";
+	for (const auto &m : materials){
+		log << "\t" << m.name << "\n";
+	}
+
+	// The materials are set up first so the textures can load while the shapes are processed
+	std::unordered_map<std::string, int32_t> texture_ids;
+	auto texture_id = [&](const std::string &name){
+		if (name.empty()){
+			return -1;
+		}
+		auto fnd = texture_ids.insert(std::make_pair(name, static_cast<int32_t>(geom.textures.size())));
+		if (fnd.second){
+			geom.textures.push_back(name);
+		}
+		return fnd.first->second;
+	};
+	for (const auto &m : materials){
+		MaterialDesc desc;
+		desc.name = m.name;
+		desc.ka = glm::vec4(m.ambient[0], m.ambient[1], m.ambient[2], 1);
+		desc.kd = glm::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], 1);
+		desc.ks = glm::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], m.shininess);
+		desc.textures[MAT_TEX_AMBIENT] = texture_id(m.ambient_texname);
+		desc.textures[MAT_TEX_DIFFUSE] = texture_id(m.diffuse_texname);
+		desc.textures[MAT_TEX_SPECULAR] = texture_id(m.specular_texname);
+		desc.textures[MAT_TEX_NORMAL] = texture_id(m.normal_texname);
+		// Find the map_d params for alpha cut out textures
+		for (auto it = m.unknown_parameter.begin(); it != m.unknown_parameter.end(); ++it){
+			if (it->first == "map_d"){
+				desc.textures[MAT_TEX_MASK] = texture_id(it->second);
+				break;
+			}
+		}
+		geom.materials.push_back(desc);
+	}
+	if (on_textures){
+		on_textures(geom.textures);
+	}
+
+	// Each shape is welded and packed as it's loaded so only the packed data is kept around
+	std::vector<float> verts;
+	LoadStats stats;
+	for (const auto &s : shapes){
+		if (cancel && *cancel){
+			return false;
+		}
+		ModelMatInfo info;
+		info.mat_id = s.mesh.material_ids[0];
+		load_shape(s.mesh, optimize, format, verts, geom.verts, geom.elems, info, stats);
+		geom.shapes.push_back(std::make_pair(s.name, info));
+	}
+	print_load_stats(stats, optimize, format, log);
+	return true;
+}
+// Get the model file's geometry from its cache if it's up to date, otherwise parse the
+// model and rebuild its cache. A cancelled parse fails without writing the cache
+static bool load_geometry(const std::string &file, bool optimize, const glt::VertexFormat &format,
+		glt::GeometryCache &cache, const TexturesCallback &on_textures = TexturesCallback(),
+		const std::atomic<bool> *cancel = nullptr)
+{
+	if (cache.open(file, format, optimize)){
+		std::cout << "loaded " << cache.shapes() << " model(s) and " << cache.materials()
+			<< " material(s) from the geometry cache for " << file << "\n";
+		if (on_textures){
+			std::vector<std::string> textures;
+			for (size_t i = 0; i < cache.textures(); ++i){
+				textures.push_back(cache.texture(i));
+			}
+			on_textures(textures);
+		}
+		return true;
+	}
+	glt::GeometryData geom;
+	if (!parse_model(file, optimize, format, geom, on_textures, cancel)){
+		return false;
+	}
+	cache.build(file, format, optimize, geom);
+	return true;
+}
+
+// Allocate the material buffer for the model's materials and write them out, looking up where
+// their textures ended up in obj_textures. Maps whose texture isn't in obj_textures are left as -1
+// so the materials can be written untextured while the textures are still loading
+static glt::SubBuffer write_materials(const glt::GeometryCache &cache, const std::string &base_path,
+		const glt::OBJTextures &obj_textures, glt::BufferAllocator &allocator, glt::SubBuffer mat_buf,
+		bool print)
+{
+	using namespace glt;
+	if (mat_buf.size == 0){
+		GLint ssbo_alignment = 0;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_alignment);
+		mat_buf = allocator.alloc(cache.materials() * sizeof(Material), ssbo_alignment);
+	}
+	Material *mats = static_cast<Material*>(mat_buf.map(GL_SHADER_STORAGE_BUFFER,
+				GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
+	for (size_t i = 0; i < cache.materials(); ++i){
+		const MaterialDesc m = cache.material(i);
+		// Find where the texture used for the map ended up, or -1 if it's not used
+		auto texture = [&](MaterialTexture t){
+			if (m.textures[t] < 0){
+				return glm::ivec2{-1};
+			}
+			auto tex = obj_textures.tex_map.find(base_path + cache.texture(m.textures[t]));
+			if (tex == obj_textures.tex_map.end()){
+				return glm::ivec2{-1};
+			}
+			return glm::ivec2(tex->second.first, tex->second.second);
+		};
+		mats[i].ka = m.ka;
+		mats[i].kd = m.kd;
+		mats[i].ks = m.ks;
+		const glm::ivec2 ambient = texture(MAT_TEX_AMBIENT);
+		const glm::ivec2 diffuse = texture(MAT_TEX_DIFFUSE);
+		const glm::ivec2 specular = texture(MAT_TEX_SPECULAR);
+		const glm::ivec2 normal = texture(MAT_TEX_NORMAL);
+		const glm::ivec2 mask = texture(MAT_TEX_MASK);
+		mats[i].map_ka_kd = glm::ivec4(ambient.x, ambient.y, diffuse.x, diffuse.y);
+		mats[i].map_ks_n = glm::ivec4(specular.x, specular.y, normal.x, normal.y);
+		mats[i].map_mask = glm::ivec4(mask.x, mask.y, -1, -1);
+		if (print){
+			std::cout << "Material " << m.name << " = \n" << mats[i] << "\n";
+		}
+	}
+	mat_buf.unmap(GL_SHADER_STORAGE_BUFFER);
+	return mat_buf;
+}
+
+glt::ModelInfo::ModelInfo(size_t index_offset, size_t indices, size_t vert_offset, size_t verts)
+	: index_offset(index_offset), indices(indices), vert_offset(vert_offset), verts(verts)
 {}
 
-glt::ModelMatInfo::ModelMatInfo(size_t index_offset, size_t indices, size_t vert_offset, size_t mat_id)
-	: index_offset(index_offset), indices(indices), vert_offset(vert_offset), mat_id(mat_id)
+glt::ModelMatInfo::ModelMatInfo(size_t index_offset, size_t indices, size_t vert_offset, size_t mat_id,
+		size_t verts)
+	: index_offset(index_offset), indices(indices), vert_offset(vert_offset), mat_id(mat_id), verts(verts)
 {}
 
 glt::Material::Material(glm::vec4 ka, glm::vec4 kd, glm::vec4 ks, glm::ivec4 map_ka_kd,
@@ -21,276 +308,411 @@ glt::Material::Material(glm::vec4 ka, glm::vec4 kd, glm::vec4 ks, glm::ivec4 map
 
 bool glt::load_models(const std::vector<std::string> &model_files, SubBuffer &vert_buf,
 		SubBuffer &elem_buf, BufferAllocator &allocator,
-		std::unordered_map<std::string, ModelInfo> &elem_offsets)
+		std::unordered_map<std::string, ModelInfo> &elem_offsets, bool optimize, const VertexFormat &format)
 {
 	using namespace glt;
-	std::vector<tinyobj::shape_t> loaded_models;
-	for (const auto &file : model_files){
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string base_path;
-		const auto base_path_end = file.rfind(PATH_SEP);
-		if (base_path_end != std::string::npos){
-			base_path = file.substr(0, base_path_end + 1);
-		}
-		std::string err = tinyobj::LoadObj(shapes, materials, file.c_str(), base_path.c_str());
-		if (!err.empty()){
-			std::cout << "Failed to load model " << file << " error: " << err << std::endl;
-			return false;
-		}
-		std::cout << "loaded " << shapes.size() << " model(s) from " << file << ", name(s):\n";
-		for (const auto &s : shapes){
-			std::cout << "\t" << s.name;
-			if (!materials.empty()){
-				std::cout << ", uses material: " << materials[s.mesh.material_ids[0]].name << "\n";
+	// The files are loaded in order on a worker thread (each one parsed in parallel by load_obj)
+	// while we upload the ones it's finished, the queue bounds how many loaded files are kept
+	// mapped waiting on us. A null cache means a file failed to load
+	BoundedQueue<std::unique_ptr<GeometryCache>> loaded(2);
+	std::thread loader([&](){
+		for (const auto &f : model_files){
+			std::unique_ptr<GeometryCache> cache(new GeometryCache);
+			if (!load_geometry(f, optimize, format, *cache)){
+				cache = nullptr;
 			}
-			else {
-				std::cout << "\n";
+			const bool ok = cache != nullptr;
+			if (!loaded.push(std::move(cache)) || !ok){
+				break;
 			}
 		}
-		std::cout << "loaded " << materials.size() << " material(s):\n";
-		for (const auto &m : materials){
-			std::cout << "\t" << m.name << "\n";
+		loaded.close();
+	});
+
+	// We don't know the total size until every file is loaded, so the buffers grow geometrically
+	// as files come in and are trimmed to fit at the end. A buffer isn't allocated until something
+	// needs to go in it, so an empty buffer is one we haven't allocated yet
+	auto reserve = [&](SubBuffer &buf, size_t align, size_t needed){
+		if (needed == 0){
+			return;
+		}
+		if (buf.size == 0){
+			buf = allocator.alloc(needed, align);
+		}
+		else if (buf.size < needed){
+			allocator.realloc(buf, std::max(needed, 2 * buf.size));
+		}
+	};
+	elem_buf = SubBuffer{};
+	vert_buf = SubBuffer{};
+	const size_t stride = format.stride();
+	size_t index_offset = 0, vert_offset = 0, files = 0;
+	std::unique_ptr<GeometryCache> c;
+	while (loaded.pop(c) && c){
+		reserve(elem_buf, sizeof(GLuint), (index_offset + c->elems_count()) * sizeof(GLuint));
+		reserve(vert_buf, 1, (vert_offset + c->verts_size() / stride) * stride);
+		if (c->elems_count() != 0){
+			allocator.upload(elem_buf, c->elems(), c->elems_count() * sizeof(GLuint), index_offset * sizeof(GLuint));
 		}
-		std::copy(shapes.begin(), shapes.end(), std::back_inserter(loaded_models));
+		if (c->verts_size() != 0){
+			allocator.upload(vert_buf, c->verts(), c->verts_size(), vert_offset * stride);
+		}
+		for (size_t i = 0; i < c->shapes(); ++i){
+			const ModelMatInfo s = c->shape(i);
+			ModelInfo info{s.index_offset + index_offset, s.indices, s.vert_offset + vert_offset, s.verts};
+			info.dequant = s.dequant;
+			elem_offsets[c->shape_name(i)] = info;
+		}
+		index_offset += c->elems_count();
+		vert_offset += c->verts_size() / stride;
+		++files;
 	}
-
-	size_t total_elems = std::accumulate(loaded_models.begin(), loaded_models.end(), 0,
-			[](const size_t &cur, const tinyobj::shape_t &s){
-				return cur + s.mesh.indices.size();
-			});
-	elem_buf = allocator.alloc(total_elems * sizeof(GLuint), sizeof(GLuint));
-	{
-		unsigned int *elems = static_cast<unsigned int*>(elem_buf.map(GL_ELEMENT_ARRAY_BUFFER,
-					GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
-		// Track our offset in the element count
-		size_t prev_offset = 0;
-		for (const auto &s : loaded_models){
-			elem_offsets[s.name] = ModelInfo{prev_offset, s.mesh.indices.size()};
-			std::copy(s.mesh.indices.begin(), s.mesh.indices.end(), elems + prev_offset);
-			prev_offset += s.mesh.indices.size();
+	loaded.close();
+	loader.join();
+	if (files != model_files.size()){
+		if (elem_buf.size != 0){
+			allocator.free(elem_buf);
+		}
+		if (vert_buf.size != 0){
+			allocator.free(vert_buf);
 		}
-		elem_buf.unmap(GL_ELEMENT_ARRAY_BUFFER);
+		return false;
 	}
-
-	// We store 6 floats per element at the moment
-	// Format is vec3 (pos), vec3 (normal), vec2 (texcoord)
-	vert_buf = allocator.alloc(total_elems * 8 * sizeof(float));
-	{
-		float *verts = static_cast<float*>(vert_buf.map(GL_ARRAY_BUFFER,
-					GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
-		// Track our offset in the vertex buffer
-		size_t i = 0;
-		for (const auto &s : loaded_models){
-			elem_offsets[s.name].vert_offset = i / 8;
-			for (auto p = s.mesh.positions.begin(), n = s.mesh.normals.begin(), t = s.mesh.texcoords.begin();
-					p != s.mesh.positions.end();
-					i += 8)
-			{
-				for (int k = 0; k < 3; ++k, ++p){
-					verts[i + k] = *p;
-				}
-				if (n != s.mesh.normals.end()){
-					for (int k = 3; k < 6; ++k, ++n){
-						verts[i + k] = *n;
-					}
-				}
-				// Some models may not have/need texcoords
-				if (t != s.mesh.texcoords.end()){
-					for (int k = 6; k < 8; ++k, ++t){
-						verts[i + k] = *t;
-					}
-				}
-			}
+	// Without any triangles there's nothing to draw, but vertices may still have been uploaded
+	if (index_offset == 0){
+		if (vert_buf.size != 0){
+			allocator.free(vert_buf);
 		}
-		vert_buf.unmap(GL_ARRAY_BUFFER);
+		elem_buf = allocator.alloc(0, sizeof(GLuint));
+		vert_buf = allocator.alloc(0);
+		return true;
 	}
+	allocator.trim(elem_buf, index_offset * sizeof(GLuint));
+	allocator.trim(vert_buf, vert_offset * stride);
 	return true;
 }
 bool glt::load_model_with_mats(const std::string &model_file, BufferAllocator &allocator,
 		SubBuffer &vert_buf, SubBuffer &elem_buf, SubBuffer &mat_buf,
-		OBJTextures &obj_textures, std::unordered_map<std::string, ModelMatInfo> &model_info)
+		OBJTextures &obj_textures, std::unordered_map<std::string, ModelMatInfo> &model_info,
+		bool optimize, const VertexFormat &format)
 {
 	using namespace glt;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
 	std::string base_path;
 	const auto base_path_end = model_file.rfind(PATH_SEP);
 	if (base_path_end != std::string::npos){
 		base_path = model_file.substr(0, base_path_end + 1);
 	}
-	std::string err = tinyobj::LoadObj(shapes, materials, model_file.c_str(), base_path.c_str());
-	if (!err.empty()){
-		std::cout << "Failed to load model " << model_file << " error: " << err << std::endl;
-		return false;
-	}
-	std::cout << "loaded " << shapes.size() << " model(s) from " << model_file << ", name(s):\n";
-	for (const auto &s : shapes){
-		std::cout << "\t" << s.name;
-		if (!materials.empty()){
-			std::cout << ", uses material: " << materials[s.mesh.material_ids[0]].name << "\n";
+	// The geometry is loaded on another thread which starts decoding the textures as soon as
+	// the materials are parsed, while we upload the textures as they're decoded
+	GeometryCache cache;
+	std::mutex textures_lock;
+	std::shared_ptr<TextureSetLoader> textures;
+	auto geometry = std::async(std::launch::async, [&](){
+		return load_geometry(model_file, optimize, format, cache, [&](const std::vector<std::string> &names){
+			std::set<std::string> texture_files;
+			for (const auto &n : names){
+				texture_files.insert(base_path + n);
+			}
+			std::lock_guard<std::mutex> lock(textures_lock);
+			textures = std::make_shared<TextureSetLoader>(texture_files);
+		});
+	});
+	bool textures_uploaded = false;
+	while (geometry.wait_for(std::chrono::seconds(0)) != std::future_status::ready){
+		std::shared_ptr<TextureSetLoader> t;
+		{
+			std::lock_guard<std::mutex> lock(textures_lock);
+			t = textures;
+		}
+		if (t && !textures_uploaded){
+			textures_uploaded = t->upload(1);
 		}
 		else {
-			std::cout << "\n";
+			geometry.wait_for(std::chrono::milliseconds(1));
 		}
 	}
+	// The textures are only requested once the model has been parsed, so if it failed there are none
+	if (!geometry.get()){
+		return false;
+	}
 
-	size_t total_elems = std::accumulate(shapes.begin(), shapes.end(), 0,
-			[](const size_t &cur, const tinyobj::shape_t &s){
-				return cur + s.mesh.indices.size();
-			});
-	elem_buf = allocator.alloc(total_elems * sizeof(GLuint), sizeof(GLuint));
-	{
-		unsigned int *elems = static_cast<unsigned int*>(elem_buf.map(GL_ELEMENT_ARRAY_BUFFER,
-					GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
-		// Track our offset in the element count
-		size_t prev_offset = 0;
-		for (const auto &s : shapes){
-			model_info[s.name] = ModelMatInfo{prev_offset, s.mesh.indices.size()};
-			std::copy(s.mesh.indices.begin(), s.mesh.indices.end(), elems + prev_offset);
-			prev_offset += s.mesh.indices.size();
-		}
-		elem_buf.unmap(GL_ELEMENT_ARRAY_BUFFER);
+	elem_buf = allocator.alloc(cache.elems_count() * sizeof(GLuint), sizeof(GLuint));
+	allocator.upload(elem_buf, cache.elems(), cache.elems_count() * sizeof(GLuint));
+	vert_buf = allocator.alloc(cache.verts_size());
+	allocator.upload(vert_buf, cache.verts(), cache.verts_size());
+	for (size_t i = 0; i < cache.shapes(); ++i){
+		model_info[cache.shape_name(i)] = cache.shape(i);
 	}
 
-	// We store 6 floats per element at the moment
-	// Format is vec3 (pos), vec3 (normal), vec2 (texcoord)
-	vert_buf = allocator.alloc(total_elems * 8 * sizeof(float));
-	{
-		float *verts = static_cast<float*>(vert_buf.map(GL_ARRAY_BUFFER,
-					GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
-		// Track our offset in the vertex buffer
-		size_t i = 0;
-		for (const auto &s : shapes){
-			model_info[s.name].vert_offset = i / 8;
-			model_info[s.name].mat_id = s.mesh.material_ids[0];
-			for (auto p = s.mesh.positions.begin(), n = s.mesh.normals.begin(), t = s.mesh.texcoords.begin();
-					p != s.mesh.positions.end();
-					i += 8)
-			{
-				for (int k = 0; k < 3; ++k, ++p){
-					verts[i + k] = *p;
-				}
-				if (n != s.mesh.normals.end()){
-					for (int k = 3; k < 6; ++k, ++n){
-						verts[i + k] = *n;
-					}
-				}
-				// Some models may not have/need texcoords
-				if (t != s.mesh.texcoords.end()){
-					for (int k = 6; k < 8; ++k, ++t){
-						verts[i + k] = *t;
-					}
-				}
+	if (cache.materials() != 0){
+		obj_textures = textures->finish();
+		if (obj_textures.textures.empty() && cache.textures() != 0){
+			allocator.free(elem_buf);
+			allocator.free(vert_buf);
+			elem_buf = SubBuffer{};
+			vert_buf = SubBuffer{};
+			return false;
+		}
+
+		mat_buf = write_materials(cache, base_path, obj_textures, allocator, SubBuffer{}, true);
+	}
+	return true;
+}
+bool glt::stream_model(const std::string &model_file, SubBuffer &vert_buf, SubBuffer &elem_buf,
+		BufferAllocator &allocator, std::unordered_map<std::string, ModelInfo> &elem_offsets, size_t window)
+{
+	using namespace glt;
+	OBJCounts counts;
+	std::string err = count_obj(model_file, counts, window);
+	if (!err.empty()){
+		std::cout << "Failed to load model " << model_file << " error: " << err << std::endl;
+		return false;
+	}
+	if (counts.triangles == 0){
+		std::cout << "Failed to load model " << model_file << " error: it has no faces\n";
+		return false;
+	}
+	const size_t vert_size = counts.positions * FLOAT_VERTEX_FLOATS * sizeof(float);
+	const size_t elem_size = counts.triangles * 3 * sizeof(GLuint);
+	vert_buf = allocator.alloc(vert_size);
+	elem_buf = allocator.alloc(elem_size, sizeof(GLuint));
+	if (vert_buf.size < vert_size || elem_buf.size < elem_size){
+		std::cout << "Failed to allocate buffers to stream model " << model_file << " into\n";
+		for (SubBuffer *b : { &vert_buf, &elem_buf }){
+			if (b->size != 0){
+				allocator.free(*b);
 			}
 		}
-		vert_buf.unmap(GL_ARRAY_BUFFER);
+		return false;
+	}
+	// The buffers are written through their persistent mapping if they have one, so the data
+	// goes straight from the file to the buffers without any copies in host memory
+	float *verts = static_cast<float*>(vert_buf.map(GL_ARRAY_BUFFER, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+	GLuint *elems = static_cast<GLuint*>(elem_buf.map(GL_ELEMENT_ARRAY_BUFFER,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+	std::vector<OBJGroup> groups;
+	err = stream_obj(model_file, counts, verts, elems, groups, window);
+	vert_buf.unmap(GL_ARRAY_BUFFER);
+	elem_buf.unmap(GL_ELEMENT_ARRAY_BUFFER);
+	if (!err.empty()){
+		std::cout << "Failed to load model " << model_file << " error: " << err << std::endl;
+		allocator.free(vert_buf);
+		allocator.free(elem_buf);
+		return false;
+	}
+	for (const auto &g : groups){
+		elem_offsets[g.name] = ModelInfo{g.first_triangle * 3, g.triangles * 3, 0, counts.positions};
 	}
+	std::cout << "streamed " << groups.size() << " model(s) with " << counts.positions << " vertices and "
+		<< counts.triangles << " triangles from " << model_file << ", peak RSS "
+		<< peak_rss() / (1024 * 1024) << "MB\n";
+	return true;
+}
+bool glt::bake_model(const std::string &model_file, bool optimize, const VertexFormat &format,
+		const std::string &out_file, size_t threads, std::ostream &log)
+{
+	GeometryData geom;
+	if (!parse_model(model_file, optimize, format, geom, TexturesCallback(), nullptr, threads, log)){
+		return false;
+	}
+	GeometryCache cache;
+	return cache.build(model_file, format, optimize, geom, out_file, log);
+}
+glt::ModelLoadProgress::ModelLoadProgress()
+	: shapes_ready(0), shapes(0), bytes_uploaded(0), bytes(0), textures_ready(0), textures(0)
+{}
 
-	if (!materials.empty()){
-		std::cout << "loaded " << materials.size() << " material(s):\n";
-		std::set<std::string> texture_files;
-		for (const auto &m : materials){
-			if (!m.ambient_texname.empty()){
-				texture_files.insert(base_path + m.ambient_texname);
-			}
-			if (!m.diffuse_texname.empty()){
-				texture_files.insert(base_path + m.diffuse_texname);
-			}
-			if (!m.specular_texname.empty()){
-				texture_files.insert(base_path + m.specular_texname);
-			}
-			if (!m.normal_texname.empty()){
-				texture_files.insert(base_path + m.normal_texname);
+// Largest single upload made by AsyncModelLoad::update, so the time budget is checked regularly
+static const size_t UPLOAD_SLICE = 1 << 20;
+
+glt::AsyncModelLoad::Shared::Shared() : cancelled(false), cache(new GeometryCache){}
+
+glt::AsyncModelLoad::AsyncModelLoad(const std::string &model_file, BufferAllocator &allocator, bool optimize,
+		const VertexFormat &format)
+	: allocator(allocator), shared(std::make_shared<Shared>()), stride(format.stride()), next_shape(0),
+	verts_uploaded(0), elems_uploaded(0), geometry_loaded(false), is_done(false), is_failed(false)
+{
+	const auto base_path_end = model_file.rfind(PATH_SEP);
+	if (base_path_end != std::string::npos){
+		base_path = model_file.substr(0, base_path_end + 1);
+	}
+	// The worker only holds on to the shared state, so it's detached rather than run with
+	// std::async whose future would block in our destructor until the model was loaded
+	std::shared_ptr<Shared> state = shared;
+	const std::string path = base_path;
+	std::packaged_task<bool()> task([state, path, model_file, optimize, format](){
+		return load_geometry(model_file, optimize, format, *state->cache, [&](const std::vector<std::string> &names){
+			std::set<std::string> texture_files;
+			for (const auto &n : names){
+				texture_files.insert(path + n);
 			}
-			for (auto it = m.unknown_parameter.begin(); it != m.unknown_parameter.end(); ++it){
-				if (it->first == "map_d"){
-					texture_files.insert(base_path + it->second);
-					break;
-				}
+			std::lock_guard<std::mutex> lock(state->texture_lock);
+			if (!state->cancelled){
+				state->texture_loader = std::make_shared<TextureSetLoader>(texture_files);
 			}
+		}, &state->cancelled);
+	});
+	geometry = task.get_future();
+	std::thread(std::move(task)).detach();
+}
+glt::AsyncModelLoad::~AsyncModelLoad(){
+	// Tell the worker to stop, it'll finish up and free the shared state on its own. The flag
+	// is set under the texture lock so the worker can't start loading textures after fail
+	// has cancelled the ones it's started
+	{
+		std::lock_guard<std::mutex> lock(shared->texture_lock);
+		shared->cancelled = true;
+	}
+	if (!is_done && !is_failed){
+		fail();
+	}
+}
+bool glt::AsyncModelLoad::update(size_t byte_budget, double time_budget_ms){
+	using namespace std::chrono;
+	if (is_done || is_failed){
+		return true;
+	}
+	const auto start = high_resolution_clock::now();
+	auto out_of_time = [&](){
+		return time_budget_ms > 0
+			&& duration_cast<duration<double, std::milli>>(high_resolution_clock::now() - start).count() >= time_budget_ms;
+	};
+	if (!geometry_loaded && geometry.wait_for(seconds(0)) == std::future_status::ready){
+		if (!geometry.get()){
+			fail();
+			return true;
 		}
-		obj_textures = load_texture_set(texture_files);
-		if (obj_textures.textures.empty() && !texture_files.empty()){
-			return false;
+		geometry_loaded = true;
+		elem_buf = allocator.alloc(shared->cache->elems_count() * sizeof(GLuint), sizeof(GLuint));
+		vert_buf = allocator.alloc(shared->cache->verts_size());
+		if (shared->cache->materials() != 0){
+			mat_buf = write_materials(*shared->cache, base_path, obj_textures, allocator, mat_buf, false);
 		}
+	}
 
-		GLint ssbo_alignment = 0;
-		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_alignment);
-		mat_buf = allocator.alloc(materials.size() * sizeof(Material), ssbo_alignment);
-		{
-			Material *mats = static_cast<Material*>(mat_buf.map(GL_SHADER_STORAGE_BUFFER,
-						GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_WRITE_BIT));
-			for (size_t i = 0; i < materials.size(); ++i){
-				const auto &m = materials[i];
-				mats[i].ka = glm::vec4(m.ambient[0], m.ambient[1], m.ambient[2], 1);
-				mats[i].kd = glm::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], 1);
-				mats[i].ks = glm::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], m.shininess);
-				// Find all the texture information used by this material
-				if (!m.ambient_texname.empty()){
-					const auto &tex = obj_textures.tex_map[base_path + m.ambient_texname];
-					mats[i].map_ka_kd.x = tex.first;
-					mats[i].map_ka_kd.y = tex.second;
-				}
-				else {
-					mats[i].map_ka_kd.x = -1;
-					mats[i].map_ka_kd.y = -1;
-				}
-
-				if (!m.diffuse_texname.empty()){
-					const auto &tex = obj_textures.tex_map[base_path + m.diffuse_texname];
-					mats[i].map_ka_kd.z = tex.first;
-					mats[i].map_ka_kd.w = tex.second;
-				}
-				else {
-					mats[i].map_ka_kd.z = -1;
-					mats[i].map_ka_kd.w = -1;
-				}
-
-				if (!m.specular_texname.empty()){
-					const auto &tex = obj_textures.tex_map[base_path + m.specular_texname];
-					mats[i].map_ks_n.x = tex.first;
-					mats[i].map_ks_n.y = tex.second;
-				}
-				else {
-					mats[i].map_ks_n.x = -1;
-					mats[i].map_ks_n.y = -1;
-				}
-
-				if (!m.normal_texname.empty()){
-					const auto &tex = obj_textures.tex_map[base_path + m.normal_texname];
-					mats[i].map_ks_n.z = tex.first;
-					mats[i].map_ks_n.w = tex.second;
-				}
-				else {
-					mats[i].map_ks_n.z = -1;
-					mats[i].map_ks_n.w = -1;
-				}
+	// Upload the geometry shape by shape so each can be drawn as soon as its data is in
+	size_t uploaded = 0;
+	while (geometry_loaded && next_shape < shared->cache->shapes()){
+		const ModelMatInfo s = shared->cache->shape(next_shape);
+		const size_t vert_end = (s.vert_offset + s.verts) * stride;
+		const size_t elem_end = (s.index_offset + s.indices) * sizeof(GLuint);
+		if (verts_uploaded >= vert_end && elems_uploaded >= elem_end){
+			model_info[shared->cache->shape_name(next_shape)] = s;
+			++next_shape;
+			continue;
+		}
+		if (uploaded >= byte_budget || out_of_time()){
+			break;
+		}
+		if (verts_uploaded < vert_end){
+			const size_t sz = std::min(std::min(vert_end - verts_uploaded, byte_budget - uploaded), UPLOAD_SLICE);
+			allocator.upload(vert_buf, shared->cache->verts() + verts_uploaded, sz, verts_uploaded);
+			verts_uploaded += sz;
+			uploaded += sz;
+		}
+		else {
+			const size_t sz = std::min(std::min(elem_end - elems_uploaded, byte_budget - uploaded), UPLOAD_SLICE);
+			allocator.upload(elem_buf, reinterpret_cast<const char*>(shared->cache->elems()) + elems_uploaded, sz,
+					elems_uploaded);
+			elems_uploaded += sz;
+			uploaded += sz;
+		}
+	}
 
-				// Find the map_d params for alpha cut out textures
-				mats[i].map_mask = glm::ivec4{-1};
-				for (auto it = m.unknown_parameter.begin(); it != m.unknown_parameter.end(); ++it){
-					if (it->first == "map_d"){
-						const auto &tex = obj_textures.tex_map[base_path + it->second];
-						mats[i].map_mask.x = tex.first;
-						mats[i].map_mask.y = tex.second;
-						mats[i].map_mask.z = -1;
-						mats[i].map_mask.w = -1;
-						break;
-					}
-				}
-				std::cout << "Material " << m.name << " = \n" << mats[i] << "\n";
+	// Spend what's left of the budget on the textures decoded so far, one at a time so we
+	// can stop when out of time
+	std::shared_ptr<TextureSetLoader> textures = get_texture_loader();
+	bool textures_done = false;
+	if (textures){
+		textures_done = textures->upload(0, 0);
+		while (!textures_done && uploaded < byte_budget && !out_of_time()){
+			const size_t before = textures->textures_uploaded();
+			const size_t before_bytes = textures->bytes_uploaded();
+			textures_done = textures->upload(0, 1);
+			if (textures->textures_uploaded() == before){
+				break;
 			}
-			mat_buf.unmap(GL_SHADER_STORAGE_BUFFER);
+			uploaded += textures->bytes_uploaded() - before_bytes;
+		}
+		if (textures->failed()){
+			fail();
+			return true;
 		}
 	}
-	return true;
+	if (geometry_loaded && next_shape == shared->cache->shapes() && textures_done){
+		obj_textures = textures->finish();
+		if (shared->cache->materials() != 0){
+			mat_buf = write_materials(*shared->cache, base_path, obj_textures, allocator, mat_buf, true);
+		}
+		is_done = true;
+	}
+	return is_done;
+}
+bool glt::AsyncModelLoad::done() const {
+	return is_done;
+}
+bool glt::AsyncModelLoad::failed() const {
+	return is_failed;
+}
+glt::ModelLoadProgress glt::AsyncModelLoad::progress(){
+	ModelLoadProgress p;
+	p.shapes_ready = model_info.size();
+	if (geometry_loaded){
+		p.shapes = shared->cache->shapes();
+		p.bytes_uploaded = verts_uploaded + elems_uploaded;
+		p.bytes = shared->cache->verts_size() + shared->cache->elems_count() * sizeof(GLuint);
+	}
+	std::shared_ptr<TextureSetLoader> textures = get_texture_loader();
+	if (textures){
+		p.textures_ready = textures->textures_uploaded();
+		p.textures = textures->texture_count();
+	}
+	return p;
+}
+const std::unordered_map<std::string, glt::ModelMatInfo>& glt::AsyncModelLoad::ready_shapes() const {
+	return model_info;
+}
+const glt::SubBuffer& glt::AsyncModelLoad::vertex_buffer() const {
+	return vert_buf;
+}
+const glt::SubBuffer& glt::AsyncModelLoad::element_buffer() const {
+	return elem_buf;
+}
+const glt::SubBuffer& glt::AsyncModelLoad::material_buffer() const {
+	return mat_buf;
+}
+const glt::OBJTextures& glt::AsyncModelLoad::textures() const {
+	return obj_textures;
+}
+std::shared_ptr<glt::TextureSetLoader> glt::AsyncModelLoad::get_texture_loader(){
+	std::lock_guard<std::mutex> lock(shared->texture_lock);
+	return shared->texture_loader;
+}
+void glt::AsyncModelLoad::fail(){
+	is_failed = true;
+	std::shared_ptr<TextureSetLoader> textures = get_texture_loader();
+	if (textures){
+		textures->cancel();
+	}
+	for (SubBuffer *b : { &vert_buf, &elem_buf, &mat_buf }){
+		if (b->size != 0){
+			allocator.free(*b);
+		}
+		*b = SubBuffer{};
+	}
+	model_info.clear();
+	obj_textures = OBJTextures{};
 }
 std::ostream& operator<<(std::ostream &os, const glt::ModelInfo &m){
 	os << "glt::ModelInfo:"
 		<< "\n\tindex_offset: " << m.index_offset
 		<< "\n\tindices: " << m.indices
 		<< "\n\tvert_offset: " << m.vert_offset
+		<< "\n\tverts: " << m.verts
+		<< "\n\tpos_scale: " << glm::to_string(m.dequant.pos_scale)
+		<< "\n\tpos_offset: " << glm::to_string(m.dequant.pos_offset)
+		<< "\n\tuv_scale: " << glm::to_string(m.dequant.uv_scale)
+		<< "\n\tuv_offset: " << glm::to_string(m.dequant.uv_offset)
 		<< "\n--------\n";
 	return os;
 }
@@ -300,6 +722,11 @@ std::ostream& operator<<(std::ostream &os, const glt::ModelMatInfo &m){
 		<< "\n\tindices: " << m.indices
 		<< "\n\tvert_offset: " << m.vert_offset
 		<< "\n\tmat_id: " << m.mat_id
+		<< "\n\tverts: " << m.verts
+		<< "\n\tpos_scale: " << glm::to_string(m.dequant.pos_scale)
+		<< "\n\tpos_offset: " << glm::to_string(m.dequant.pos_offset)
+		<< "\n\tuv_scale: " << glm::to_string(m.dequant.uv_scale)
+		<< "\n\tuv_offset: " << glm::to_string(m.dequant.uv_offset)
 		<< "\n--------\n";
 	return os;
 }
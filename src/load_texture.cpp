@@ -3,8 +3,12 @@
 #include <utility>
 #include <map>
 #include <cassert>
+#include <memory>
+#include <algorithm>
+#include <chrono>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include "glt/baked_texture.h"
 #include "glt/load_texture.h"
 
 //Swap rows of n bytes pointed to by a with those pointed to by b
@@ -202,17 +206,18 @@ GLint glt::load_cubemap(const std::vector<std::string> &files, int *width, int *
 }
 
 /* 
- * Information about the image dimensions and channels of a texture so we
+ * Information about the image dimensions, channels and storage format of a texture so we
  * can group matching textures into arrays
  */
 struct TextureInfo {
 	int width, height, channels;
+	GLenum internal_format;
 };
 bool operator<(const TextureInfo &a, const TextureInfo &b){
 	if (a.width == b.width){
 		if (a.height == b.height){
 			if (a.channels == b.channels){
-				return false;
+				return a.internal_format < b.internal_format;
 			}
 			return a.channels < b.channels;
 		}
@@ -224,81 +229,257 @@ std::ostream& operator<<(std::ostream &os, const TextureInfo &t){
 	os << "TextureInfo {\n\twidth = " << t.width
 		<< "\n\theight = " << t.height
 		<< "\n\tchannels = " << t.channels
+		<< "\n\tinternal_format = " << t.internal_format
 		<< "\n}";
 	return os;
 }
 
-struct Texture {
-	TextureInfo info;
-	std::string name;
-	unsigned char *tex;
-};
+static GLenum sized_format(int channels){
+	switch (channels){
+		case 1: return GL_R8;
+		case 2: return GL_RG8;
+		case 3: return GL_RGB8;
+		default: return GL_RGBA8;
+	}
+}
+static GLenum pixel_format(int channels){
+	switch (channels){
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+		default: return GL_RGBA;
+	}
+}
+
+static size_t worker_count(size_t threads){
+	return threads == 0 ? std::max<size_t>(std::thread::hardware_concurrency(), 1) : threads;
+}
 
 glt::OBJTextures glt::load_texture_set(const std::set<std::string> &files){
-	OBJTextures obj_textures;
-	std::map<TextureInfo, std::vector<Texture>> unique_textures;
-	for (auto f = files.begin(); f != files.end(); ++f){
-		Texture tex;
-		tex.name = *f;
-		tex.tex = stbi_load(f->c_str(), &tex.info.width, &tex.info.height, &tex.info.channels, 0);
-		if (!tex.tex){
-			std::cout << "load_texture_set error loading " << *f
-				<< " - " << stbi_failure_reason() << std::endl;
-			for (auto &u : unique_textures){
-				for (auto &t : u.second){
-					stbi_image_free(t.tex);
-				}
+	return TextureSetLoader(files).finish();
+}
+
+glt::TextureSetLoader::TextureSetLoader(const std::set<std::string> &files, size_t threads)
+	: next_task(0), error(false), stop(false), headers_read(0),
+	decoded(2 * worker_count(threads)), uploaded(0), uploaded_bytes(0), arrays_made(false)
+{
+	for (const auto &f : files){
+		textures.push_back(Texture{f, 0, 0, 0, 0, nullptr});
+	}
+	threads = std::min(worker_count(threads), textures.size());
+	for (size_t i = 0; i < threads; ++i){
+		workers.push_back(std::thread([this](){ work(); }));
+	}
+}
+glt::TextureSetLoader::~TextureSetLoader(){
+	join_workers();
+}
+bool glt::TextureSetLoader::upload(double timeout_ms, size_t byte_budget){
+	using namespace std::chrono;
+	const auto timeout = duration_cast<nanoseconds>(duration<double, std::milli>(timeout_ms));
+	if (!arrays_made){
+		std::unique_lock<std::mutex> lock(header_lock);
+		header_read.wait_for(lock, timeout, [&](){ return error || headers_read == textures.size(); });
+		if (error){
+			return true;
+		}
+		if (headers_read != textures.size()){
+			return false;
+		}
+		lock.unlock();
+		make_arrays();
+	}
+	// Upload everything that's been decoded, only waiting if nothing is ready yet
+	Decoded d;
+	const size_t start_bytes = uploaded_bytes;
+	for (bool wait = true; uploaded < textures.size() && !error && uploaded_bytes - start_bytes < byte_budget;
+			wait = false)
+	{
+		if (!decoded.pop_for(d, wait ? timeout : nanoseconds(0))){
+			break;
+		}
+		upload_texture(d);
+	}
+	return error || uploaded == textures.size();
+}
+glt::OBJTextures glt::TextureSetLoader::finish(){
+	while (!upload(10)){
+	}
+	join_workers();
+	if (error){
+		cancel();
+		return OBJTextures{};
+	}
+	size_t num_baked = 0;
+	for (const auto &t : textures){
+		if (t.baked){
+			++num_baked;
+		}
+	}
+	if (num_baked > 0){
+		std::cout << "loaded " << num_baked << " of " << textures.size() << " texture(s) from baked textures\n";
+	}
+	return result;
+}
+void glt::TextureSetLoader::cancel(){
+	join_workers();
+	error = true;
+	if (!result.textures.empty()){
+		glDeleteTextures(result.textures.size(), result.textures.data());
+	}
+	result = OBJTextures{};
+}
+bool glt::TextureSetLoader::failed() const {
+	return error;
+}
+size_t glt::TextureSetLoader::texture_count() const {
+	return textures.size();
+}
+size_t glt::TextureSetLoader::textures_uploaded() const {
+	return uploaded;
+}
+size_t glt::TextureSetLoader::bytes_uploaded() const {
+	return uploaded_bytes;
+}
+void glt::TextureSetLoader::join_workers(){
+	stop = true;
+	decoded.close();
+	for (auto &w : workers){
+		w.join();
+	}
+	workers.clear();
+}
+void glt::TextureSetLoader::work(){
+	// Header reads are all claimed before any decode so the GL thread can create the arrays
+	// and start consuming decoded images while the rest are still decoding
+	const size_t n = textures.size();
+	for (size_t t = next_task++; t < 2 * n && !stop && !error; t = next_task++){
+		if (t < n){
+			const bool ok = read_header(textures[t]);
+			std::lock_guard<std::mutex> lock(header_lock);
+			if (!ok){
+				error = true;
 			}
-			return obj_textures;
+			++headers_read;
+			header_read.notify_all();
+			continue;
+		}
+		// Claimed isn't read, another worker may still be reading the header we're about to decode
+		{
+			std::unique_lock<std::mutex> lock(header_lock);
+			header_read.wait(lock, [&](){ return error || headers_read == n; });
 		}
-		// Perform y-swap on loaded images
-		for (int i = 0; i < tex.info.height / 2; ++i){
-			swap_row(&tex.tex[i * tex.info.width * tex.info.channels],
-					&tex.tex[(tex.info.height - i - 1) * tex.info.width * tex.info.channels],
-					tex.info.width * tex.info.channels);
+		if (!error && !decode(t - n)){
+			error = true;
 		}
-		unique_textures[tex.info].push_back(tex);
 	}
-	// Upload each texture array and track where the textures ended up in obj_textures
+	if (error){
+		decoded.close();
+		std::lock_guard<std::mutex> lock(header_lock);
+		header_read.notify_all();
+	}
+}
+bool glt::TextureSetLoader::read_header(Texture &tex){
+	// Prefer the baked texture so we can skip decoding and generating mips
+	std::shared_ptr<BakedTexture> baked = std::make_shared<BakedTexture>();
+	if (baked->open(tex.name)){
+		tex.width = baked->width();
+		tex.height = baked->height();
+		tex.channels = baked->channels();
+		tex.internal_format = baked->internal_format();
+		tex.baked = baked;
+		return true;
+	}
+	if (!stbi_info(tex.name.c_str(), &tex.width, &tex.height, &tex.channels)){
+		std::cout << "load_texture_set error loading " << tex.name
+			<< " - " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	tex.internal_format = sized_format(tex.channels);
+	return true;
+}
+bool glt::TextureSetLoader::decode(size_t i){
+	const Texture &tex = textures[i];
+	if (tex.baked){
+		return decoded.push(Decoded{i, nullptr}) || stop;
+	}
+	int x, y, n;
+	std::shared_ptr<unsigned char> img(stbi_load(tex.name.c_str(), &x, &y, &n, 0), stbi_image_free);
+	if (!img){
+		std::cout << "load_texture_set error loading " << tex.name
+			<< " - " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	if (x != tex.width || y != tex.height || n != tex.channels){
+		std::cout << "load_texture_set error: " << tex.name << " changed while loading\n";
+		return false;
+	}
+	// Perform y-swap on loaded images
+	unsigned char *p = img.get();
+	for (int r = 0; r < y / 2; ++r){
+		swap_row(&p[r * x * n], &p[(y - r - 1) * x * n], x * n);
+	}
+	return decoded.push(Decoded{i, img}) || stop;
+}
+void glt::TextureSetLoader::make_arrays(){
+	// Group the textures by their dimensions and format, the layers follow the order of the set
+	std::map<TextureInfo, std::vector<size_t>> unique_textures;
+	for (size_t i = 0; i < textures.size(); ++i){
+		const Texture &t = textures[i];
+		unique_textures[TextureInfo{t.width, t.height, t.channels, t.internal_format}].push_back(i);
+	}
+	placement.resize(textures.size());
 	for (const auto &u : unique_textures){
 		const TextureInfo &info = u.first;
-		GLenum format, sized_format;
-		switch (info.channels){
-			case 1:
-				format = GL_RED;
-				sized_format = GL_R8;
-				break;
-			case 2:
-				format = GL_RG;
-				sized_format = GL_RG8;
-				break;
-			case 3:
-				format = GL_RGB;
-				sized_format = GL_RGB8;
-				break;
-			default:
-				format = GL_RGBA;
-				sized_format = GL_RGBA8;
-				break;
-		}
+		const GLuint array = result.textures.size();
 		GLuint tex;
 		glGenTextures(1, &tex);
 		glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
-		const GLsizei levels = std::log2(std::max(info.width, info.height));
-		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, sized_format, info.width, info.height, u.second.size());
-		for (size_t i = 0; i < u.second.size(); ++i){
-			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, info.width, info.height,
-					1, format, GL_UNSIGNED_BYTE, u.second[i].tex);
-			obj_textures.tex_map[u.second[i].name] = std::make_pair(obj_textures.textures.size(), i);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, mip_levels(info.width, info.height), info.internal_format,
+				info.width, info.height, u.second.size());
+		for (size_t l = 0; l < u.second.size(); ++l){
+			placement[u.second[l]] = std::make_pair(array, l);
+			result.tex_map[textures[u.second[l]].name] = placement[u.second[l]];
 		}
-		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
-		obj_textures.textures.push_back(tex);
+		result.textures.push_back(tex);
+		remaining.push_back(u.second.size());
+		gen_mips.push_back(false);
 	}
-	for (auto &u : unique_textures){
-		for (auto &t : u.second){
-			stbi_image_free(t.tex);
+	arrays_made = true;
+}
+void glt::TextureSetLoader::upload_texture(const Decoded &d){
+	const Texture &t = textures[d.index];
+	const GLuint array = placement[d.index].first;
+	const GLint layer = placement[d.index].second;
+	const GLenum format = pixel_format(t.channels);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, result.textures[array]);
+	// Rows of 1 and 3 channel images aren't 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (t.baked){
+		for (int l = 0; l < t.baked->levels(); ++l){
+			const TextureLevel lvl = t.baked->level(l);
+			if (t.baked->compressed()){
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, lvl.width, lvl.height, 1,
+						t.internal_format, lvl.size, lvl.data);
+			}
+			else {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, lvl.width, lvl.height, 1,
+						format, GL_UNSIGNED_BYTE, lvl.data);
+			}
+			uploaded_bytes += lvl.size;
 		}
 	}
-	return obj_textures;
+	else {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, t.width, t.height, 1,
+				format, GL_UNSIGNED_BYTE, d.pixels.get());
+		uploaded_bytes += static_cast<size_t>(t.width) * t.height * t.channels;
+		gen_mips[array] = true;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	++uploaded;
+	// Baked textures come with their mips, only generate them if we decoded an image
+	if (--remaining[array] == 0 && gen_mips[array]){
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
 }
 
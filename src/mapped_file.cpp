@@ -0,0 +1,284 @@
+#include <iostream>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "glt/mapped_file.h"
+
+#ifdef _WIN32
+glt::MappedFile::MappedFile() : ptr(nullptr), len(0), file(INVALID_HANDLE_VALUE), mapping(nullptr){}
+glt::MappedFile::MappedFile(MappedFile &&m) : ptr(m.ptr), len(m.len), file(m.file), mapping(m.mapping){
+	m.ptr = nullptr;
+	m.len = 0;
+	m.file = INVALID_HANDLE_VALUE;
+	m.mapping = nullptr;
+}
+glt::MappedFile& glt::MappedFile::operator=(MappedFile &&m){
+	if (this != &m){
+		close();
+		std::swap(ptr, m.ptr);
+		std::swap(len, m.len);
+		std::swap(file, m.file);
+		std::swap(mapping, m.mapping);
+	}
+	return *this;
+}
+bool glt::MappedFile::open(const std::string &path){
+	close();
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE){
+		std::cout << "Failed to open " << path << " for mapping, error " << GetLastError() << "\n";
+		return false;
+	}
+	LARGE_INTEGER sz;
+	GetFileSizeEx(file, &sz);
+	len = static_cast<size_t>(sz.QuadPart);
+	if (len == 0){
+		return true;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping){
+		ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (!ptr){
+		std::cout << "Failed to map " << path << ", error " << GetLastError() << "\n";
+		close();
+		return false;
+	}
+	return true;
+}
+void glt::MappedFile::close(){
+	if (ptr){
+		UnmapViewOfFile(ptr);
+	}
+	if (mapping){
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE){
+		CloseHandle(file);
+	}
+	ptr = nullptr;
+	len = 0;
+	file = INVALID_HANDLE_VALUE;
+	mapping = nullptr;
+}
+bool glt::MappedFile::is_open() const {
+	return file != INVALID_HANDLE_VALUE;
+}
+#else
+glt::MappedFile::MappedFile() : ptr(nullptr), len(0), fd(-1){}
+glt::MappedFile::MappedFile(MappedFile &&m) : ptr(m.ptr), len(m.len), fd(m.fd){
+	m.ptr = nullptr;
+	m.len = 0;
+	m.fd = -1;
+}
+glt::MappedFile& glt::MappedFile::operator=(MappedFile &&m){
+	if (this != &m){
+		close();
+		std::swap(ptr, m.ptr);
+		std::swap(len, m.len);
+		std::swap(fd, m.fd);
+	}
+	return *this;
+}
+bool glt::MappedFile::open(const std::string &path){
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1){
+		std::cout << "Failed to open " << path << " for mapping\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		std::cout << "Failed to stat " << path << "\n";
+		close();
+		return false;
+	}
+	len = static_cast<size_t>(st.st_size);
+	if (len == 0){
+		return true;
+	}
+	void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED){
+		std::cout << "Failed to map " << path << "\n";
+		close();
+		return false;
+	}
+	ptr = static_cast<const char*>(m);
+	return true;
+}
+void glt::MappedFile::close(){
+	if (ptr){
+		munmap(const_cast<char*>(ptr), len);
+	}
+	if (fd != -1){
+		::close(fd);
+	}
+	ptr = nullptr;
+	len = 0;
+	fd = -1;
+}
+bool glt::MappedFile::is_open() const {
+	return fd != -1;
+}
+#endif
+glt::MappedFile::~MappedFile(){
+	close();
+}
+const char* glt::MappedFile::data() const {
+	return ptr;
+}
+size_t glt::MappedFile::size() const {
+	return len;
+}
+void glt::MappedFile::release(size_t offset, size_t size) const {
+	if (!ptr || offset >= len){
+		return;
+	}
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const size_t page = info.dwPageSize;
+#else
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	const size_t begin = offset / page * page;
+	const size_t end = std::min(offset + size, len) / page * page;
+	if (end <= begin){
+		return;
+	}
+#ifdef _WIN32
+	// Unlocking pages which aren't locked removes them from the working set
+	VirtualUnlock(const_cast<char*>(ptr) + begin, end - begin);
+#else
+	// The mapping is read only so dropping the pages just means they're read back from the file
+	madvise(const_cast<char*>(ptr) + begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+bool glt::stat_file(const std::string &path, FileStat &stat){
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path.c_str(), &st) != 0){
+		return false;
+	}
+#else
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0){
+		return false;
+	}
+#endif
+	stat.size = static_cast<uint64_t>(st.st_size);
+	stat.mtime = static_cast<int64_t>(st.st_mtime);
+	return true;
+}
+static uint64_t mix(uint64_t h){
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+uint64_t glt::hash_bytes(const char *data, size_t size){
+	const uint64_t k = 0x9e3779b97f4a7c15ull;
+	uint64_t lanes[4] = { k, k << 1, k << 2, k << 3 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32){
+		uint64_t w[4];
+		std::memcpy(w, data + i, sizeof(w));
+		for (int j = 0; j < 4; ++j){
+			lanes[j] = (lanes[j] ^ w[j]) * k;
+			lanes[j] ^= lanes[j] >> 31;
+		}
+	}
+	uint64_t h = size;
+	for (int j = 0; j < 4; ++j){
+		h = mix(h ^ lanes[j]);
+	}
+	for (; i < size; ++i){
+		h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+	}
+	return mix(h);
+}
+bool glt::hash_file(const std::string &path, uint64_t &hash){
+	MappedFile file;
+	if (!file.open(path)){
+		return false;
+	}
+	hash = hash_bytes(file.data(), file.size());
+	return true;
+}
+bool glt::make_file_key(const std::string &path, FileKey &key){
+	FileStat st;
+	if (!stat_file(path, st) || !hash_file(path, key.hash)){
+		return false;
+	}
+	key.size = st.size;
+	key.mtime = st.mtime;
+	return true;
+}
+bool glt::file_key_matches(const std::string &path, const FileKey &key, bool &touched){
+	touched = false;
+	FileStat st;
+	if (!stat_file(path, st) || st.size != key.size){
+		return false;
+	}
+	if (st.mtime == key.mtime){
+		return true;
+	}
+	uint64_t hash = 0;
+	if (!hash_file(path, hash) || hash != key.hash){
+		return false;
+	}
+	touched = true;
+	return true;
+}
+bool glt::update_file_key(const std::string &path, size_t key_offset, const std::string &source){
+	FileStat st;
+	if (!stat_file(source, st)){
+		return false;
+	}
+	std::fstream fout(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	if (!fout){
+		return false;
+	}
+	fout.seekp(key_offset + offsetof(FileKey, mtime));
+	return static_cast<bool>(fout.write(reinterpret_cast<const char*>(&st.mtime), sizeof(st.mtime)));
+}
+bool glt::replace_file(const std::string &path, const char *data, size_t size){
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream fout(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!fout.write(data, size)){
+			std::cout << "Failed to write " << tmp << "\n";
+			fout.close();
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+	// rename won't replace an existing file on Windows
+	if (std::rename(tmp.c_str(), path.c_str()) != 0){
+		std::remove(path.c_str());
+		if (std::rename(tmp.c_str(), path.c_str()) != 0){
+			std::cout << "Failed to move " << tmp << " into place at " << path << "\n";
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
@@ -0,0 +1,278 @@
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cassert>
+#include <glm/glm.hpp>
+#include "glt/mesh_optimizer.h"
+
+using namespace glt;
+
+static const size_t NO_VERTEX = ~size_t{0};
+
+// The triangles using each vertex, stored contiguously per vertex
+struct TriangleAdjacency {
+	std::vector<size_t> counts, offsets, tris;
+};
+static void build_adjacency(const GLuint *indices, size_t n_indices, size_t n_verts, TriangleAdjacency &adj){
+	adj.counts.assign(n_verts, 0);
+	adj.offsets.assign(n_verts, 0);
+	adj.tris.resize(n_indices);
+	for (size_t i = 0; i < n_indices; ++i){
+		assert(indices[i] < n_verts);
+		++adj.counts[indices[i]];
+	}
+	for (size_t v = 1; v < n_verts; ++v){
+		adj.offsets[v] = adj.offsets[v - 1] + adj.counts[v - 1];
+	}
+	std::vector<size_t> fill = adj.offsets;
+	for (size_t i = 0; i < n_indices; ++i){
+		adj.tris[fill[indices[i]]++] = i / 3;
+	}
+}
+// Simulated FIFO cache, a vertex is in the cache if it was one of the last `size` misses.
+// Returns true if the vertex missed and had to be transformed
+static bool cache_access(std::vector<size_t> &stamps, size_t &time, size_t size, GLuint v){
+	if (time - stamps[v] > size){
+		stamps[v] = time++;
+		return true;
+	}
+	return false;
+}
+
+glt::VertexCacheStats::VertexCacheStats() : triangles(0), vertices(0), transformed(0){}
+double glt::VertexCacheStats::acmr() const {
+	return triangles == 0 ? 0 : static_cast<double>(transformed) / triangles;
+}
+double glt::VertexCacheStats::atvr() const {
+	return vertices == 0 ? 0 : static_cast<double>(transformed) / vertices;
+}
+
+VertexCacheStats glt::analyze_vertex_cache(const GLuint *indices, size_t n_indices, size_t n_verts,
+		size_t cache_size)
+{
+	VertexCacheStats stats;
+	stats.triangles = n_indices / 3;
+	std::vector<size_t> stamps(n_verts, 0);
+	std::vector<bool> used(n_verts, false);
+	size_t time = cache_size + 1;
+	for (size_t i = 0; i < n_indices; ++i){
+		if (cache_access(stamps, time, cache_size, indices[i])){
+			++stats.transformed;
+		}
+		if (!used[indices[i]]){
+			used[indices[i]] = true;
+			++stats.vertices;
+		}
+	}
+	return stats;
+}
+void glt::optimize_vertex_cache(GLuint *dst, const GLuint *indices, size_t n_indices, size_t n_verts,
+		size_t cache_size, std::vector<size_t> *clusters)
+{
+	assert(dst != indices);
+	const size_t n_tris = n_indices / 3;
+	TriangleAdjacency adj;
+	build_adjacency(indices, n_indices, n_verts, adj);
+	// Number of triangles still to be emitted using each vertex
+	std::vector<size_t> live = adj.counts;
+	std::vector<size_t> stamps(n_verts, 0);
+	std::vector<bool> emitted(n_tris, false);
+	// Vertices of recently emitted triangles, to pick up from when we hit a dead end
+	std::vector<GLuint> dead_end;
+	dead_end.reserve(n_indices);
+	std::vector<GLuint> candidates;
+	size_t time = cache_size + 1;
+	size_t cursor = 0, out = 0;
+	if (clusters){
+		clusters->clear();
+	}
+	for (; cursor < n_verts && live[cursor] == 0; ++cursor);
+	size_t fan = cursor < n_verts ? cursor : NO_VERTEX;
+	if (clusters && fan != NO_VERTEX){
+		clusters->push_back(0);
+	}
+	while (fan != NO_VERTEX){
+		// Emit all the remaining triangles around the fanning vertex
+		candidates.clear();
+		for (size_t i = adj.offsets[fan]; i < adj.offsets[fan] + adj.counts[fan]; ++i){
+			const size_t t = adj.tris[i];
+			if (emitted[t]){
+				continue;
+			}
+			emitted[t] = true;
+			for (size_t k = 0; k < 3; ++k){
+				const GLuint v = indices[3 * t + k];
+				dst[out++] = v;
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				cache_access(stamps, time, cache_size, v);
+			}
+		}
+		// Fan around the candidate that will still be in the cache after emitting its
+		// remaining triangles and has been there longest, otherwise any with triangles left
+		fan = NO_VERTEX;
+		long long best = -1;
+		for (const auto &v : candidates){
+			if (live[v] == 0){
+				continue;
+			}
+			const size_t age = time - stamps[v];
+			const long long priority = age + 2 * live[v] <= cache_size ? static_cast<long long>(age) : 0;
+			if (priority > best){
+				best = priority;
+				fan = v;
+			}
+		}
+		if (fan != NO_VERTEX){
+			continue;
+		}
+		// We've hit a dead end, try to continue from something emitted recently and
+		// otherwise from the next vertex with triangles left
+		while (!dead_end.empty() && fan == NO_VERTEX){
+			const GLuint v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] != 0){
+				fan = v;
+			}
+		}
+		if (fan == NO_VERTEX){
+			for (; cursor < n_verts && live[cursor] == 0; ++cursor);
+			fan = cursor < n_verts ? cursor : NO_VERTEX;
+		}
+		if (clusters && fan != NO_VERTEX){
+			clusters->push_back(out / 3);
+		}
+	}
+	assert(out == n_tris * 3);
+}
+void glt::optimize_overdraw(GLuint *indices, size_t n_indices, const float *verts, size_t vertex_floats,
+		size_t n_verts, const std::vector<size_t> &clusters, size_t cache_size, float threshold)
+{
+	const size_t n_tris = n_indices / 3;
+	if (n_tris == 0 || clusters.empty()){
+		return;
+	}
+	// Split the clusters further at points where the triangles so far have an ACMR
+	// close enough to the whole cluster's that starting over costs little
+	std::vector<size_t> bounds;
+	std::vector<size_t> stamps(n_verts, 0);
+	size_t time = cache_size + 1;
+	for (size_t c = 0; c < clusters.size(); ++c){
+		const size_t begin = clusters[c];
+		const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : n_tris;
+		// Flush the cache between clusters like the hard boundary would
+		time += cache_size + 1;
+		size_t misses = 0;
+		for (size_t i = begin * 3; i < end * 3; ++i){
+			misses += cache_access(stamps, time, cache_size, indices[i]);
+		}
+		const double cluster_acmr = static_cast<double>(misses) / (end - begin);
+		time += cache_size + 1;
+		bounds.push_back(begin);
+		misses = 0;
+		size_t tris = 0;
+		for (size_t t = begin; t < end; ++t){
+			for (size_t k = 0; k < 3; ++k){
+				misses += cache_access(stamps, time, cache_size, indices[3 * t + k]);
+			}
+			++tris;
+			if (t + 1 < end && static_cast<double>(misses) / tris <= threshold * cluster_acmr){
+				bounds.push_back(t + 1);
+				time += cache_size + 1;
+				misses = 0;
+				tris = 0;
+			}
+		}
+	}
+	// Find the centroid of the mesh and the area weighted centroid and normal of each
+	// cluster. Clusters facing away from the middle of the mesh are likely to occlude
+	// others from any view so they should be drawn first
+	std::vector<float> sort_key(bounds.size());
+	glm::vec3 mesh_center{0};
+	float mesh_area = 0;
+	std::vector<glm::vec3> centers(bounds.size(), glm::vec3{0}), normals(bounds.size(), glm::vec3{0});
+	std::vector<float> areas(bounds.size(), 0);
+	for (size_t c = 0; c < bounds.size(); ++c){
+		const size_t end = c + 1 < bounds.size() ? bounds[c + 1] : n_tris;
+		for (size_t t = bounds[c]; t < end; ++t){
+			glm::vec3 p[3];
+			for (size_t k = 0; k < 3; ++k){
+				const float *v = verts + indices[3 * t + k] * vertex_floats;
+				p[k] = glm::vec3{v[0], v[1], v[2]};
+			}
+			const glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+			const float area = glm::length(n);
+			centers[c] += (p[0] + p[1] + p[2]) / 3.f * area;
+			normals[c] += n;
+			areas[c] += area;
+		}
+		mesh_center += centers[c];
+		mesh_area += areas[c];
+	}
+	mesh_center = mesh_area > 0 ? mesh_center / mesh_area : mesh_center;
+	for (size_t c = 0; c < bounds.size(); ++c){
+		const glm::vec3 center = areas[c] > 0 ? centers[c] / areas[c] : centers[c];
+		const float len = glm::length(normals[c]);
+		sort_key[c] = len > 0 ? glm::dot(center - mesh_center, normals[c] / len) : 0;
+	}
+	std::vector<size_t> order(bounds.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](const size_t &a, const size_t &b){
+		return sort_key[a] > sort_key[b];
+	});
+	std::vector<GLuint> sorted;
+	sorted.reserve(n_tris * 3);
+	for (const auto &c : order){
+		const size_t end = c + 1 < bounds.size() ? bounds[c + 1] : n_tris;
+		sorted.insert(sorted.end(), indices + bounds[c] * 3, indices + end * 3);
+	}
+	std::copy(sorted.begin(), sorted.end(), indices);
+}
+size_t glt::optimize_vertex_fetch(float *verts, size_t vertex_floats, size_t n_verts, GLuint *indices,
+		size_t n_indices)
+{
+	std::vector<size_t> remap(n_verts, NO_VERTEX);
+	size_t next = 0;
+	for (size_t i = 0; i < n_indices; ++i){
+		if (remap[indices[i]] == NO_VERTEX){
+			remap[indices[i]] = next++;
+		}
+		indices[i] = static_cast<GLuint>(remap[indices[i]]);
+	}
+	const size_t referenced = next;
+	for (auto &r : remap){
+		if (r == NO_VERTEX){
+			r = next++;
+		}
+	}
+	std::vector<float> reordered(n_verts * vertex_floats);
+	for (size_t v = 0; v < n_verts; ++v){
+		std::copy(verts + v * vertex_floats, verts + (v + 1) * vertex_floats,
+				reordered.begin() + remap[v] * vertex_floats);
+	}
+	std::copy(reordered.begin(), reordered.end(), verts);
+	return referenced;
+}
+MeshOptStats glt::optimize_mesh(float *verts, size_t vertex_floats, size_t n_verts, GLuint *indices,
+		size_t n_indices, size_t cache_size)
+{
+	MeshOptStats stats;
+	stats.before = analyze_vertex_cache(indices, n_indices, n_verts, cache_size);
+	std::vector<GLuint> reordered(n_indices);
+	std::vector<size_t> clusters;
+	optimize_vertex_cache(reordered.data(), indices, n_indices, n_verts, cache_size, &clusters);
+	optimize_overdraw(reordered.data(), n_indices, verts, vertex_floats, n_verts, clusters, cache_size);
+	std::copy(reordered.begin(), reordered.end(), indices);
+	optimize_vertex_fetch(verts, vertex_floats, n_verts, indices, n_indices);
+	stats.after = analyze_vertex_cache(indices, n_indices, n_verts, cache_size);
+	return stats;
+}
+
+std::ostream& operator<<(std::ostream &os, const VertexCacheStats &s){
+	os << "VertexCacheStats { triangles: " << s.triangles << ", vertices: " << s.vertices
+		<< ", transformed: " << s.transformed << ", acmr: " << s.acmr()
+		<< ", atvr: " << s.atvr() << " }";
+	return os;
+}
+
@@ -0,0 +1,792 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include "glt/mapped_file.h"
+#include "glt/obj_parser.h"
+#include "glt/vertex_layout.h"
+
+using namespace glt;
+
+// Files smaller than this are parsed in one chunk, it's not worth starting threads
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+// Face vertex attribute indices are stored 0 based if they're absolute. Indices relative to
+// the end of the attribute list are stored as their index within the chunk minus RELATIVE_BIAS
+// and resolved once the number of attributes in the earlier chunks is known
+static const int64_t NO_INDEX = -1;
+static const int64_t RELATIVE_BIAS = int64_t(1) << 48;
+
+enum class ObjEventType { GROUP, OBJECT, USEMTL, MTLLIB };
+// A statement in the file which changes the shape the following faces go into
+struct ObjEvent {
+	ObjEventType type;
+	// The chunk's face the event comes before
+	size_t face;
+	std::string name;
+};
+// The attributes, faces and events parsed from a chunk of the file
+struct ObjChunk {
+	std::vector<float> v, vn, vt;
+	// v, vt, vn indices of each face vertex
+	std::vector<int64_t> indices;
+	// Start of each face in indices (in face vertices), with the end of the last face at the back
+	std::vector<size_t> faces;
+	std::vector<ObjEvent> events;
+	// Offsets of the chunk's attributes in the merged attribute arrays, in attributes
+	size_t v_base, vn_base, vt_base;
+	std::string err;
+
+	size_t face_count() const {
+		return faces.empty() ? 0 : faces.size() - 1;
+	}
+};
+// A run of faces in a chunk
+struct FaceRange {
+	size_t chunk, begin, end;
+};
+// The faces making up a shape, as it'll be exported
+struct ShapeSpan {
+	std::string name;
+	int material;
+	std::vector<FaceRange> ranges;
+};
+struct VertexKey {
+	int64_t v, vt, vn;
+
+	bool operator==(const VertexKey &b) const {
+		return v == b.v && vt == b.vt && vn == b.vn;
+	}
+};
+struct VertexKeyHash {
+	size_t operator()(const VertexKey &k) const {
+		uint64_t h = 14695981039346656037ull;
+		h = (h ^ static_cast<uint64_t>(k.v)) * 1099511628211ull;
+		h = (h ^ static_cast<uint64_t>(k.vt)) * 1099511628211ull;
+		h = (h ^ static_cast<uint64_t>(k.vn)) * 1099511628211ull;
+		return static_cast<size_t>(h ^ (h >> 29));
+	}
+};
+
+// Run f(i) for i in [0, n) on up to `threads` threads
+template<typename F>
+static void parallel_for(size_t n, size_t threads, const F &f){
+	threads = std::min(threads, n);
+	if (threads <= 1){
+		for (size_t i = 0; i < n; ++i){
+			f(i);
+		}
+		return;
+	}
+	std::atomic<size_t> next(0);
+	auto worker = [&](){
+		for (size_t i = next++; i < n; i = next++){
+			f(i);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (size_t i = 0; i < threads - 1; ++i){
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto &t : pool){
+		t.join();
+	}
+}
+
+static bool is_space(char c){
+	return c == ' ' || c == '\t';
+}
+static bool is_digit(char c){
+	return c >= '0' && c <= '9';
+}
+static const char* skip_space(const char *p, const char *end){
+	while (p != end && is_space(*p)){
+		++p;
+	}
+	return p;
+}
+static const char* skip_token(const char *p, const char *end){
+	while (p != end && !is_space(*p)){
+		++p;
+	}
+	return p;
+}
+// Read the whitespace delimited token at p
+static std::string read_token(const char *p, const char *end){
+	p = skip_space(p, end);
+	return std::string(p, skip_token(p, end));
+}
+// Check if the line starts with the keyword followed by whitespace
+static bool is_keyword(const char *p, const char *end, const char *keyword, size_t len){
+	return static_cast<size_t>(end - p) > len && std::memcmp(p, keyword, len) == 0 && is_space(p[len]);
+}
+/*
+ * Parse a decimal float without going through the locale. Up to 19 significant digits are
+ * accumulated in an integer and scaled by the power of ten once, which is exact for the
+ * short decimals exporters write out. Anything that isn't a number reads as 0
+ */
+static const char* parse_float(const char *p, const char *end, float &out){
+	static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	p = skip_space(p, end);
+	bool neg = false;
+	if (p != end && (*p == '-' || *p == '+')){
+		neg = *p == '-';
+		++p;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	for (; p != end && is_digit(*p); ++p){
+		if (digits < 19){
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0 ? 1 : 0;
+		}
+		else {
+			++exponent;
+		}
+	}
+	if (p != end && *p == '.'){
+		for (++p; p != end && is_digit(*p); ++p){
+			if (digits < 19){
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0 ? 1 : 0;
+				--exponent;
+			}
+		}
+	}
+	if (p != end && (*p == 'e' || *p == 'E')){
+		++p;
+		bool exp_neg = false;
+		if (p != end && (*p == '-' || *p == '+')){
+			exp_neg = *p == '-';
+			++p;
+		}
+		int e = 0;
+		for (; p != end && is_digit(*p); ++p){
+			e = std::min(e * 10 + (*p - '0'), 1000);
+		}
+		exponent += exp_neg ? -e : e;
+	}
+	double val = static_cast<double>(mantissa);
+	if (mantissa != 0 && exponent != 0){
+		if (exponent > 0){
+			val *= exponent <= 22 ? POW10[exponent] : std::pow(10.0, exponent);
+		}
+		else {
+			val /= exponent >= -22 ? POW10[-exponent] : std::pow(10.0, -exponent);
+		}
+	}
+	out = static_cast<float>(neg ? -val : val);
+	// Skip past anything unparseable like nan so we don't get stuck
+	return skip_token(p, end);
+}
+static const char* parse_int(const char *p, const char *end, int64_t &out){
+	bool neg = false;
+	if (p != end && (*p == '-' || *p == '+')){
+		neg = *p == '-';
+		++p;
+	}
+	int64_t val = 0;
+	for (; p != end && is_digit(*p); ++p){
+		val = val * 10 + (*p - '0');
+	}
+	out = neg ? -val : val;
+	return p;
+}
+// Convert the 1 based or negative relative OBJ index into how we store it in the chunk
+static int64_t chunk_index(int64_t idx, size_t count){
+	if (idx > 0){
+		return idx - 1;
+	}
+	if (idx < 0){
+		return static_cast<int64_t>(count) + idx - RELATIVE_BIAS;
+	}
+	return NO_INDEX;
+}
+static void parse_face(const char *p, const char *end, ObjChunk &chunk){
+	const size_t n_v = chunk.v.size() / 3, n_vn = chunk.vn.size() / 3, n_vt = chunk.vt.size() / 2;
+	for (p = skip_space(p, end); p != end; p = skip_space(p, end)){
+		int64_t v = 0, vt = 0, vn = 0;
+		p = parse_int(p, end, v);
+		if (p != end && *p == '/'){
+			++p;
+			if (p != end && *p != '/'){
+				p = parse_int(p, end, vt);
+			}
+			if (p != end && *p == '/'){
+				p = parse_int(p + 1, end, vn);
+			}
+		}
+		p = skip_token(p, end);
+		if (v == 0){
+			chunk.err = "Invalid face vertex";
+			continue;
+		}
+		chunk.indices.push_back(chunk_index(v, n_v));
+		chunk.indices.push_back(chunk_index(vt, n_vt));
+		chunk.indices.push_back(chunk_index(vn, n_vn));
+	}
+	chunk.faces.push_back(chunk.indices.size() / 3);
+}
+static void parse_line(const char *p, const char *end, ObjChunk &chunk){
+	p = skip_space(p, end);
+	if (p == end || *p == '#'){
+		return;
+	}
+	float f[3];
+	if (is_keyword(p, end, "v", 1)){
+		p = parse_float(p + 1, end, f[0]);
+		p = parse_float(p, end, f[1]);
+		parse_float(p, end, f[2]);
+		chunk.v.insert(chunk.v.end(), f, f + 3);
+	}
+	else if (is_keyword(p, end, "vn", 2)){
+		p = parse_float(p + 2, end, f[0]);
+		p = parse_float(p, end, f[1]);
+		parse_float(p, end, f[2]);
+		chunk.vn.insert(chunk.vn.end(), f, f + 3);
+	}
+	else if (is_keyword(p, end, "vt", 2)){
+		p = parse_float(p + 2, end, f[0]);
+		parse_float(p, end, f[1]);
+		chunk.vt.insert(chunk.vt.end(), f, f + 2);
+	}
+	else if (is_keyword(p, end, "f", 1)){
+		// The face we're starting was already pushed as the end of the previous one
+		if (chunk.faces.empty()){
+			chunk.faces.push_back(0);
+		}
+		parse_face(p + 1, end, chunk);
+	}
+	else if (is_keyword(p, end, "g", 1)){
+		chunk.events.push_back(ObjEvent{ObjEventType::GROUP, chunk.face_count(), read_token(p + 1, end)});
+	}
+	else if (is_keyword(p, end, "o", 1)){
+		chunk.events.push_back(ObjEvent{ObjEventType::OBJECT, chunk.face_count(), read_token(p + 1, end)});
+	}
+	else if (is_keyword(p, end, "usemtl", 6)){
+		chunk.events.push_back(ObjEvent{ObjEventType::USEMTL, chunk.face_count(), read_token(p + 6, end)});
+	}
+	else if (is_keyword(p, end, "mtllib", 6)){
+		chunk.events.push_back(ObjEvent{ObjEventType::MTLLIB, chunk.face_count(), read_token(p + 6, end)});
+	}
+}
+static void parse_chunk(const char *p, const char *end, ObjChunk &chunk){
+	while (p < end){
+		const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!eol){
+			eol = end;
+		}
+		const char *line_end = eol != p && eol[-1] == '\r' ? eol - 1 : eol;
+		parse_line(p, line_end, chunk);
+		p = eol + 1;
+	}
+}
+// Resolve the chunk's stored index to an absolute one, returns false if it's out of range
+static bool resolve_index(int64_t &idx, size_t base, size_t count){
+	if (idx == NO_INDEX){
+		return true;
+	}
+	if (idx < NO_INDEX){
+		idx += RELATIVE_BIAS + static_cast<int64_t>(base);
+	}
+	return idx >= 0 && idx < static_cast<int64_t>(count);
+}
+
+static std::string trim(const std::string &s){
+	const size_t begin = s.find_first_not_of(" \t\r");
+	if (begin == std::string::npos){
+		return "";
+	}
+	return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+static void parse_mtl_floats(const char *p, const char *end, float *out, int n){
+	for (int i = 0; i < n; ++i){
+		p = parse_float(p, end, out[i]);
+	}
+}
+static void init_material(tinyobj::material_t &m){
+	m.name = "";
+	m.ambient_texname = "";
+	m.diffuse_texname = "";
+	m.specular_texname = "";
+	m.normal_texname = "";
+	for (int i = 0; i < 3; ++i){
+		m.ambient[i] = 0;
+		m.diffuse[i] = 0;
+		m.specular[i] = 0;
+		m.transmittance[i] = 0;
+		m.emission[i] = 0;
+	}
+	m.illum = 0;
+	m.dissolve = 1;
+	m.shininess = 1;
+	m.ior = 1;
+	m.unknown_parameter.clear();
+}
+// Parse the MTL file into materials as tinyobj does, unknown parameters are stored by name
+static bool parse_mtl(const std::string &file, std::vector<tinyobj::material_t> &materials,
+		std::map<std::string, int> &material_map)
+{
+	std::ifstream fin(file.c_str());
+	if (!fin){
+		return false;
+	}
+	tinyobj::material_t material;
+	init_material(material);
+	bool have_material = false;
+	auto flush = [&](){
+		if (have_material){
+			material_map[material.name] = static_cast<int>(materials.size());
+			materials.push_back(material);
+		}
+	};
+	std::string line;
+	while (std::getline(fin, line)){
+		line = trim(line);
+		if (line.empty() || line[0] == '#'){
+			continue;
+		}
+		const char *p = line.c_str(), *end = p + line.size();
+		auto rest = [&](size_t n){
+			return trim(line.substr(n));
+		};
+		if (is_keyword(p, end, "newmtl", 6)){
+			flush();
+			init_material(material);
+			material.name = read_token(p + 6, end);
+			have_material = true;
+		}
+		else if (is_keyword(p, end, "Ka", 2)){
+			parse_mtl_floats(p + 2, end, material.ambient, 3);
+		}
+		else if (is_keyword(p, end, "Kd", 2)){
+			parse_mtl_floats(p + 2, end, material.diffuse, 3);
+		}
+		else if (is_keyword(p, end, "Ks", 2)){
+			parse_mtl_floats(p + 2, end, material.specular, 3);
+		}
+		else if (is_keyword(p, end, "Kt", 2)){
+			parse_mtl_floats(p + 2, end, material.transmittance, 3);
+		}
+		else if (is_keyword(p, end, "Ke", 2)){
+			parse_mtl_floats(p + 2, end, material.emission, 3);
+		}
+		else if (is_keyword(p, end, "Ni", 2)){
+			parse_mtl_floats(p + 2, end, &material.ior, 1);
+		}
+		else if (is_keyword(p, end, "Ns", 2)){
+			parse_mtl_floats(p + 2, end, &material.shininess, 1);
+		}
+		else if (is_keyword(p, end, "d", 1)){
+			parse_mtl_floats(p + 1, end, &material.dissolve, 1);
+		}
+		else if (is_keyword(p, end, "illum", 5)){
+			int64_t illum = 0;
+			parse_int(skip_space(p + 5, end), end, illum);
+			material.illum = static_cast<int>(illum);
+		}
+		else if (is_keyword(p, end, "map_Ka", 6)){
+			material.ambient_texname = rest(6);
+		}
+		else if (is_keyword(p, end, "map_Kd", 6)){
+			material.diffuse_texname = rest(6);
+		}
+		else if (is_keyword(p, end, "map_Ks", 6)){
+			material.specular_texname = rest(6);
+		}
+		else if (is_keyword(p, end, "map_Ns", 6)){
+			material.normal_texname = rest(6);
+		}
+		else {
+			const size_t space = line.find_first_of(" \t");
+			if (space != std::string::npos){
+				material.unknown_parameter.insert(std::make_pair(line.substr(0, space), rest(space)));
+			}
+		}
+	}
+	flush();
+	return true;
+}
+
+// Triangulate the span's faces into the shape, de-indexing each v/vt/vn combination once
+static void build_shape(const ShapeSpan &span, const std::vector<ObjChunk> &chunks, const std::vector<float> &v,
+		const std::vector<float> &vn, const std::vector<float> &vt, tinyobj::shape_t &shape)
+{
+	shape.name = span.name;
+	tinyobj::mesh_t &mesh = shape.mesh;
+	std::unordered_map<VertexKey, unsigned int, VertexKeyHash> cache;
+	auto vertex = [&](const int64_t *idx){
+		const VertexKey key{idx[0], idx[1], idx[2]};
+		auto fnd = cache.insert(std::make_pair(key, static_cast<unsigned int>(cache.size())));
+		if (fnd.second){
+			mesh.positions.insert(mesh.positions.end(), v.begin() + 3 * key.v, v.begin() + 3 * key.v + 3);
+			if (key.vn != NO_INDEX){
+				mesh.normals.insert(mesh.normals.end(), vn.begin() + 3 * key.vn, vn.begin() + 3 * key.vn + 3);
+			}
+			if (key.vt != NO_INDEX){
+				mesh.texcoords.insert(mesh.texcoords.end(), vt.begin() + 2 * key.vt, vt.begin() + 2 * key.vt + 2);
+			}
+		}
+		return fnd.first->second;
+	};
+	for (const auto &r : span.ranges){
+		const ObjChunk &c = chunks[r.chunk];
+		for (size_t f = r.begin; f < r.end; ++f){
+			const int64_t *face = c.indices.data() + 3 * c.faces[f];
+			const size_t n = c.faces[f + 1] - c.faces[f];
+			for (size_t k = 2; k < n; ++k){
+				mesh.indices.push_back(vertex(face));
+				mesh.indices.push_back(vertex(face + 3 * (k - 1)));
+				mesh.indices.push_back(vertex(face + 3 * k));
+				mesh.material_ids.push_back(span.material);
+			}
+		}
+	}
+}
+
+std::string glt::load_obj(std::vector<tinyobj::shape_t> &shapes, std::vector<tinyobj::material_t> &materials,
+		const std::string &file, const std::string &mtl_base_path, size_t threads)
+{
+	shapes.clear();
+	materials.clear();
+	if (threads == 0){
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	MappedFile mapping;
+	if (!mapping.open(file)){
+		return "Cannot open " + file;
+	}
+	const char *data = mapping.data();
+	const size_t size = mapping.size();
+
+	// Split the file into chunks ending on a newline, a few per thread to balance the load
+	std::vector<std::pair<size_t, size_t>> ranges;
+	const size_t target = std::max(MIN_CHUNK_SIZE, size / (threads * 4) + 1);
+	for (size_t begin = 0; begin < size;){
+		size_t end = std::min(begin + target, size);
+		if (end < size){
+			const char *nl = static_cast<const char*>(std::memchr(data + end, '\n', size - end));
+			end = nl ? nl - data + 1 : size;
+		}
+		ranges.push_back(std::make_pair(begin, end));
+		begin = end;
+	}
+	std::vector<ObjChunk> chunks(ranges.size());
+	parallel_for(chunks.size(), threads, [&](size_t i){
+		parse_chunk(data + ranges[i].first, data + ranges[i].second, chunks[i]);
+	});
+
+	// Prefix sum the attribute counts to place each chunk's attributes in the merged arrays
+	size_t n_v = 0, n_vn = 0, n_vt = 0;
+	for (auto &c : chunks){
+		if (!c.err.empty()){
+			return c.err + " in " + file;
+		}
+		c.v_base = n_v;
+		c.vn_base = n_vn;
+		c.vt_base = n_vt;
+		n_v += c.v.size() / 3;
+		n_vn += c.vn.size() / 3;
+		n_vt += c.vt.size() / 2;
+	}
+	std::vector<float> v(3 * n_v), vn(3 * n_vn), vt(2 * n_vt);
+	std::vector<char> index_ok(chunks.size(), 1);
+	parallel_for(chunks.size(), threads, [&](size_t i){
+		ObjChunk &c = chunks[i];
+		std::copy(c.v.begin(), c.v.end(), v.begin() + 3 * c.v_base);
+		std::copy(c.vn.begin(), c.vn.end(), vn.begin() + 3 * c.vn_base);
+		std::copy(c.vt.begin(), c.vt.end(), vt.begin() + 2 * c.vt_base);
+		std::vector<float>().swap(c.v);
+		std::vector<float>().swap(c.vn);
+		std::vector<float>().swap(c.vt);
+		for (size_t j = 0; j < c.indices.size(); j += 3){
+			if (!resolve_index(c.indices[j], c.v_base, n_v) || !resolve_index(c.indices[j + 1], c.vt_base, n_vt)
+					|| !resolve_index(c.indices[j + 2], c.vn_base, n_vn))
+			{
+				index_ok[i] = 0;
+				return;
+			}
+		}
+	});
+	if (std::find(index_ok.begin(), index_ok.end(), 0) != index_ok.end()){
+		return "Face index out of range in " + file;
+	}
+
+	// Load the materials, the MTL files are small so this isn't worth splitting up
+	std::map<std::string, int> material_map;
+	std::string err;
+	for (const auto &c : chunks){
+		for (const auto &e : c.events){
+			if (e.type == ObjEventType::MTLLIB && !parse_mtl(mtl_base_path + e.name, materials, material_map)){
+				err += "Cannot open material file " + mtl_base_path + e.name + "\n";
+			}
+		}
+	}
+
+	// Walk the groups, objects and material changes in order to find the faces of each shape
+	std::vector<ShapeSpan> spans;
+	ShapeSpan span;
+	span.material = -1;
+	size_t span_faces = 0;
+	auto flush = [&](){
+		if (span_faces > 0){
+			spans.push_back(span);
+		}
+		span.ranges.clear();
+		span_faces = 0;
+	};
+	for (size_t i = 0; i < chunks.size(); ++i){
+		size_t face = 0;
+		auto add_faces = [&](size_t end){
+			if (end > face){
+				span.ranges.push_back(FaceRange{i, face, end});
+				span_faces += end - face;
+			}
+			face = end;
+		};
+		for (const auto &e : chunks[i].events){
+			add_faces(e.face);
+			switch (e.type){
+				case ObjEventType::GROUP:
+				case ObjEventType::OBJECT:
+					flush();
+					span.name = e.name;
+					break;
+				case ObjEventType::USEMTL: {
+					flush();
+					auto fnd = material_map.find(e.name);
+					span.material = fnd != material_map.end() ? fnd->second : -1;
+					break;
+				}
+				default:
+					break;
+			}
+		}
+		add_faces(chunks[i].face_count());
+	}
+	flush();
+
+	shapes.resize(spans.size());
+	parallel_for(spans.size(), threads, [&](size_t i){
+		build_shape(spans[i], chunks, v, vn, vt, shapes[i]);
+	});
+	return err;
+}
+
+// Run f(begin, end) over the mapped file in windows of about `window` bytes moved forward to the
+// next newline so lines aren't split, releasing each window once it's been processed. Stops
+// early if f returns false
+template<typename F>
+static void for_each_window(const MappedFile &mapping, size_t window, const F &f){
+	const char *data = mapping.data();
+	const size_t size = mapping.size();
+	window = std::max<size_t>(window, 1);
+	for (size_t begin = 0; begin < size;){
+		size_t end = std::min(begin + window, size);
+		if (end < size){
+			const char *nl = static_cast<const char*>(std::memchr(data + end, '\n', size - end));
+			end = nl ? nl - data + 1 : size;
+		}
+		const bool more = f(data + begin, data + end);
+		mapping.release(begin, end - begin);
+		if (!more){
+			return;
+		}
+		begin = end;
+	}
+}
+// Run f(line, line_end) on each line in [p, end), returns false if f does
+template<typename F>
+static bool for_each_line(const char *p, const char *end, const F &f){
+	while (p < end){
+		const char *eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!eol){
+			eol = end;
+		}
+		const char *line_end = eol != p && eol[-1] == '\r' ? eol - 1 : eol;
+		if (!f(skip_space(p, line_end), line_end)){
+			return false;
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+std::string glt::count_obj(const std::string &file, OBJCounts &counts, size_t window){
+	counts = OBJCounts{0, 0, 0, 0};
+	MappedFile mapping;
+	if (!mapping.open(file)){
+		return "Cannot open " + file;
+	}
+	for_each_window(mapping, window, [&](const char *begin, const char *end){
+		return for_each_line(begin, end, [&](const char *p, const char *line_end){
+			if (is_keyword(p, line_end, "v", 1)){
+				++counts.positions;
+			}
+			else if (is_keyword(p, line_end, "vn", 2)){
+				++counts.normals;
+			}
+			else if (is_keyword(p, line_end, "vt", 2)){
+				++counts.texcoords;
+			}
+			else if (is_keyword(p, line_end, "f", 1)){
+				uint64_t n = 0;
+				for (p = skip_space(p + 1, line_end); p != line_end; p = skip_space(skip_token(p, line_end), line_end)){
+					++n;
+				}
+				counts.triangles += n > 2 ? n - 2 : 0;
+			}
+			return true;
+		});
+	});
+	return "";
+}
+std::string glt::stream_obj(const std::string &file, const OBJCounts &counts, float *verts, uint32_t *elems,
+		std::vector<OBJGroup> &groups, size_t window)
+{
+	groups.clear();
+	if (counts.positions > UINT32_MAX){
+		return "Too many vertices in " + file + " for 32 bit indices";
+	}
+	MappedFile mapping;
+	if (!mapping.open(file)){
+		return "Cannot open " + file;
+	}
+	// Normals and texcoords can only be written straight into the vertices if there's one per position
+	const bool use_normals = counts.normals == counts.positions;
+	const bool use_texcoords = counts.texcoords == counts.positions;
+	const int64_t n_pos = static_cast<int64_t>(counts.positions);
+	uint64_t n_v = 0, n_vn = 0, n_vt = 0, tris = 0;
+	// Set if a face uses a normal or texcoord other than its position's, which we can't represent
+	bool unmatched = false;
+	std::string err;
+	groups.push_back(OBJGroup{"", 0, 0});
+	auto start_group = [&](const std::string &name){
+		if (name.empty()){
+			return;
+		}
+		if (groups.back().triangles == 0){
+			groups.back().name = name;
+		}
+		else {
+			groups.push_back(OBJGroup{name, tris, 0});
+		}
+	};
+	auto parse_face_line = [&](const char *p, const char *end){
+		int64_t first = 0, prev = 0;
+		size_t n = 0;
+		for (p = skip_space(p, end); p != end; p = skip_space(p, end), ++n){
+			int64_t v = 0, vt = 0, vn = 0;
+			p = parse_int(p, end, v);
+			if (p != end && *p == '/'){
+				++p;
+				if (p != end && *p != '/'){
+					p = parse_int(p, end, vt);
+				}
+				if (p != end && *p == '/'){
+					p = parse_int(p + 1, end, vn);
+				}
+			}
+			p = skip_token(p, end);
+			const int64_t idx = v > 0 ? v - 1 : static_cast<int64_t>(n_v) + v;
+			if (v == 0){
+				err = "Invalid face vertex in " + file;
+				return false;
+			}
+			if (idx < 0 || idx >= n_pos){
+				err = "Face index out of range in " + file;
+				return false;
+			}
+			if (use_texcoords && vt != 0 && (vt > 0 ? vt - 1 : static_cast<int64_t>(n_vt) + vt) != idx){
+				unmatched = true;
+			}
+			if (use_normals && vn != 0 && (vn > 0 ? vn - 1 : static_cast<int64_t>(n_vn) + vn) != idx){
+				unmatched = true;
+			}
+			if (n == 0){
+				first = idx;
+			}
+			else if (n >= 2){
+				if (tris == counts.triangles){
+					err = file + " changed while streaming it";
+					return false;
+				}
+				uint32_t *tri = elems + 3 * tris;
+				tri[0] = static_cast<uint32_t>(first);
+				tri[1] = static_cast<uint32_t>(prev);
+				tri[2] = static_cast<uint32_t>(idx);
+				++tris;
+				++groups.back().triangles;
+			}
+			prev = idx;
+		}
+		return true;
+	};
+	for_each_window(mapping, window, [&](const char *begin, const char *end){
+		return for_each_line(begin, end, [&](const char *p, const char *line_end){
+			if (is_keyword(p, line_end, "v", 1)){
+				if (n_v == counts.positions){
+					err = file + " changed while streaming it";
+					return false;
+				}
+				float *vert = verts + n_v * FLOAT_VERTEX_FLOATS;
+				p = parse_float(p + 1, line_end, vert[0]);
+				p = parse_float(p, line_end, vert[1]);
+				parse_float(p, line_end, vert[2]);
+				// The destination may be uninitialized mapped memory so unused attributes are zeroed
+				if (!use_normals){
+					std::fill(vert + FLOAT_VERTEX_NORMAL, vert + FLOAT_VERTEX_TEXCOORD, 0.f);
+				}
+				if (!use_texcoords){
+					std::fill(vert + FLOAT_VERTEX_TEXCOORD, vert + FLOAT_VERTEX_FLOATS, 0.f);
+				}
+				++n_v;
+			}
+			else if (is_keyword(p, line_end, "vn", 2)){
+				if (use_normals && n_vn < counts.normals){
+					float *normal = verts + n_vn * FLOAT_VERTEX_FLOATS + FLOAT_VERTEX_NORMAL;
+					p = parse_float(p + 2, line_end, normal[0]);
+					p = parse_float(p, line_end, normal[1]);
+					parse_float(p, line_end, normal[2]);
+				}
+				++n_vn;
+			}
+			else if (is_keyword(p, line_end, "vt", 2)){
+				if (use_texcoords && n_vt < counts.texcoords){
+					float *uv = verts + n_vt * FLOAT_VERTEX_FLOATS + FLOAT_VERTEX_TEXCOORD;
+					p = parse_float(p + 2, line_end, uv[0]);
+					parse_float(p, line_end, uv[1]);
+				}
+				++n_vt;
+			}
+			else if (is_keyword(p, line_end, "f", 1)){
+				return parse_face_line(p + 1, line_end);
+			}
+			else if (is_keyword(p, line_end, "g", 1) || is_keyword(p, line_end, "o", 1)){
+				start_group(read_token(p + 1, line_end));
+			}
+			return true;
+		});
+	});
+	if (err.empty() && (n_v != counts.positions || tris != counts.triangles)){
+		err = file + " changed while streaming it";
+	}
+	if (!err.empty()){
+		groups.clear();
+		return err;
+	}
+	if (groups.back().triangles == 0){
+		groups.pop_back();
+	}
+	if (unmatched){
+		std::cout << "Warning: " << file << " has faces using normals or texcoords of other positions,"
+			<< " streaming uses each position's own\n";
+	}
+	return "";
+}
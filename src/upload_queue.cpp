@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include "glt/upload_queue.h"
+
+using namespace glt;
+
+glt::UploadStats::UploadStats() : writes(0), bytes(0), copies(0){}
+
+glt::UploadQueue::UploadQueue(size_t staging_size, BufferStorage *storage)
+	: storage(storage ? storage : gl_buffer_storage()), staging(staging_size, true, this->storage),
+	staging_size(staging_size), staged(0), staging_buffer(0)
+{}
+void glt::UploadQueue::write(const SubBuffer &dst, const void *data, size_t size, size_t dst_offset){
+	assert(dst_offset + size <= dst.size);
+	const char *src = static_cast<const char*>(data);
+	// Writes larger than the ring are staged in pieces, flushing the queue
+	// to let the ring wrap around when it fills up
+	while (size != 0){
+		const size_t chunk = std::min(size, staging_size);
+		if (staged + chunk > staging_size){
+			flush();
+		}
+		SubBuffer stage = staging.alloc(chunk);
+		// Wasted space at the end of the ring can still leave the frame without room
+		if (stage.size == 0){
+			flush();
+			stage = staging.alloc(chunk);
+		}
+		void *ptr = stage.map(GL_COPY_READ_BUFFER, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		std::memcpy(ptr, src, stage.size);
+		stage.unmap(GL_COPY_READ_BUFFER);
+		staging_buffer = stage.buffer;
+		staged += stage.size;
+		writes.push_back(Write { dst.buffer, dst.offset + dst_offset, stage.offset, stage.size });
+		src += stage.size;
+		dst_offset += stage.size;
+		size -= stage.size;
+	}
+}
+const UploadStats& glt::UploadQueue::flush(){
+	last = UploadStats{};
+	staged = 0;
+	if (writes.empty()){
+		staging.end_frame();
+		return last;
+	}
+	// Sort by destination so adjacent ranges end up next to each other. If any writes
+	// overlap the order they were queued in matters, so keep that order instead
+	std::vector<Write> sorted = writes;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Write &a, const Write &b){
+		return a.buffer < b.buffer || (a.buffer == b.buffer && a.dst_offset < b.dst_offset);
+	});
+	bool overlap = false;
+	for (size_t i = 1; i < sorted.size() && !overlap; ++i){
+		overlap = sorted[i].buffer == sorted[i - 1].buffer
+			&& sorted[i].dst_offset < sorted[i - 1].dst_offset + sorted[i - 1].size;
+	}
+	submit(overlap ? writes : sorted);
+	writes.clear();
+	staging.end_frame();
+	return last;
+}
+const UploadStats& glt::UploadQueue::last_flush() const {
+	return last;
+}
+void glt::UploadQueue::submit(const std::vector<Write> &sorted){
+	last.writes = sorted.size();
+	for (size_t i = 0; i < sorted.size();){
+		Write run = sorted[i];
+		// Extend the run while both the destination and staged source are contiguous
+		size_t j = i + 1;
+		for (; j < sorted.size(); ++j){
+			const Write &w = sorted[j];
+			if (w.buffer != run.buffer || w.dst_offset != run.dst_offset + run.size
+					|| w.src_offset != run.src_offset + run.size)
+			{
+				break;
+			}
+			run.size += w.size;
+		}
+		storage->copy(staging_buffer, run.src_offset, run.buffer, run.dst_offset, run.size);
+		++last.copies;
+		last.bytes += run.size;
+		i = j;
+	}
+}
+
+std::ostream& operator<<(std::ostream &os, const UploadStats &s){
+	os << "UploadStats { writes: " << s.writes << ", bytes: " << s.bytes
+		<< ", copies: " << s.copies << " }";
+	return os;
+}
+
@@ -5,9 +5,36 @@
 #include <string>
 #include <fstream>
 #include <SDL.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #include "glt/gl_core_4_5.h"
 #include "glt/util.h"
 
+size_t glt::peak_rss(){
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))){
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0){
+		return 0;
+	}
+#ifdef __APPLE__
+	// macOS reports bytes, Linux kilobytes
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
 std::string glt::get_resource_path(const std::string &sub_dir){
 	using namespace glt;
 	static std::string base_res;
@@ -0,0 +1,147 @@
+#include <cmath>
+#include "glt/vertex_format.h"
+#include "glt/vertex_layout.h"
+
+using namespace glt;
+
+static_assert(VertexLayout<Pos16, NormalOct8, UVHalf>::stride() == 12, "Smallest layout should be 12 bytes");
+static_assert(VertexLayout<Pos16, Normal1010102, UV16>::stride() == 16, "Layout should be 16 bytes");
+
+// Call f.apply<Layout>() with the VertexLayout matching the format, so the work done for
+// the format is specialised for its attributes instead of branching on them per vertex
+template<typename Pos, typename Normal, typename F>
+static void dispatch_texcoord(const VertexFormat &format, F &f){
+	switch (format.texcoord){
+		case TexcoordFormat::FLOAT: f.template apply<VertexLayout<Pos, Normal, UV2f>>(); break;
+		case TexcoordFormat::HALF: f.template apply<VertexLayout<Pos, Normal, UVHalf>>(); break;
+		case TexcoordFormat::UNORM16: f.template apply<VertexLayout<Pos, Normal, UV16>>(); break;
+	}
+}
+template<typename Pos, typename F>
+static void dispatch_normal(const VertexFormat &format, F &f){
+	switch (format.normal){
+		case NormalFormat::FLOAT: dispatch_texcoord<Pos, Normal3f>(format, f); break;
+		case NormalFormat::INT_2_10_10_10_REV: dispatch_texcoord<Pos, Normal1010102>(format, f); break;
+		case NormalFormat::OCT16: dispatch_texcoord<Pos, NormalOct>(format, f); break;
+		case NormalFormat::OCT8: dispatch_texcoord<Pos, NormalOct8>(format, f); break;
+	}
+}
+template<typename F>
+static void dispatch(const VertexFormat &format, F &f){
+	switch (format.position){
+		case PositionFormat::FLOAT: dispatch_normal<Pos3f>(format, f); break;
+		case PositionFormat::UNORM16: dispatch_normal<Pos16>(format, f); break;
+	}
+}
+
+struct LayoutOffsets {
+	size_t normal, texcoord, stride;
+
+	template<typename Layout>
+	void apply(){
+		normal = Layout::normal_offset();
+		texcoord = Layout::texcoord_offset();
+		stride = Layout::stride();
+	}
+};
+struct SetAttribFormats {
+	GLuint binding;
+
+	template<typename Layout>
+	void apply(){
+		Layout::set_attrib_formats(binding);
+	}
+};
+struct PackVertices {
+	const float *verts;
+	size_t n;
+	char *out;
+	Dequantization &dequant;
+	QuantizationError &err;
+
+	template<typename Layout>
+	void apply(){
+		Layout::pack(verts, n, out, dequant);
+		Layout::measure_error(verts, n, out, dequant, err);
+	}
+};
+struct UnpackVertices {
+	const char *packed;
+	size_t n;
+	const Dequantization &dequant;
+	float *verts;
+
+	template<typename Layout>
+	void apply(){
+		Layout::unpack(packed, n, dequant, verts);
+	}
+};
+
+static LayoutOffsets layout_offsets(const VertexFormat &format){
+	LayoutOffsets offsets;
+	dispatch(format, offsets);
+	return offsets;
+}
+
+glt::VertexFormat::VertexFormat(PositionFormat position, NormalFormat normal, TexcoordFormat texcoord)
+	: position(position), normal(normal), texcoord(texcoord)
+{}
+bool glt::VertexFormat::is_float() const {
+	return position == PositionFormat::FLOAT && normal == NormalFormat::FLOAT
+		&& texcoord == TexcoordFormat::FLOAT;
+}
+size_t glt::VertexFormat::normal_offset() const {
+	return layout_offsets(*this).normal;
+}
+size_t glt::VertexFormat::texcoord_offset() const {
+	return layout_offsets(*this).texcoord;
+}
+size_t glt::VertexFormat::stride() const {
+	return layout_offsets(*this).stride;
+}
+void glt::VertexFormat::set_attrib_formats(GLuint binding) const {
+	SetAttribFormats set{binding};
+	dispatch(*this, set);
+}
+
+glt::Dequantization::Dequantization() : pos_scale(1), pos_offset(0), uv_scale(1), uv_offset(0){}
+
+glt::QuantizationError::QuantizationError()
+	: position(0), position_rel(0), position_sq(0), normal(0), texcoord(0), vertices(0)
+{}
+float glt::QuantizationError::position_rms() const {
+	return vertices == 0 ? 0 : static_cast<float>(std::sqrt(position_sq / vertices));
+}
+
+void glt::pack_vertices(const float *verts, size_t n, const VertexFormat &format, char *out,
+		Dequantization &dequant, QuantizationError &err)
+{
+	PackVertices pack{verts, n, out, dequant, err};
+	dispatch(format, pack);
+}
+void glt::unpack_vertices(const char *packed, size_t n, const VertexFormat &format,
+		const Dequantization &dequant, float *verts)
+{
+	UnpackVertices unpack{packed, n, dequant, verts};
+	dispatch(format, unpack);
+}
+
+std::ostream& operator<<(std::ostream &os, const glt::VertexFormat &f){
+	static const char *position_names[] = { "float", "unorm16" };
+	static const char *normal_names[] = { "float", "int_2_10_10_10_rev", "oct16", "oct8" };
+	static const char *texcoord_names[] = { "float", "half", "unorm16" };
+	os << "VertexFormat { position: " << position_names[static_cast<int>(f.position)]
+		<< ", normal: " << normal_names[static_cast<int>(f.normal)]
+		<< ", texcoord: " << texcoord_names[static_cast<int>(f.texcoord)]
+		<< ", stride: " << f.stride() << " }";
+	return os;
+}
+std::ostream& operator<<(std::ostream &os, const glt::QuantizationError &e){
+	os << "QuantizationError { vertices: " << e.vertices
+		<< ", position max: " << e.position << " (" << e.position_rel * 100.f << "% of bounds)"
+		<< ", position rms: " << e.position_rms()
+		<< ", normal max: " << e.normal << " deg"
+		<< ", texcoord max: " << e.texcoord << " }";
+	return os;
+}
+
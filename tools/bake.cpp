@@ -0,0 +1,251 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#endif
+#include "glt/util.h"
+#include "glt/load_models.h"
+#include "glt/geometry_cache.h"
+#include "glt/baked_texture.h"
+#include "glt/bake_manifest.h"
+
+/*
+ * Bakes the models and images under a resource directory into the formats the loaders can map
+ * and upload without parsing or decoding: models are welded, optimized and packed into geometry
+ * caches and images are flipped and stored with their full mip chain. A manifest listing the
+ * baked files is written so they can be registered with load_bake_manifest at startup.
+ * Files are baked in parallel on a pool of worker threads
+ */
+
+using namespace glt;
+
+enum class AssetType { MODEL, IMAGE };
+struct Asset {
+	AssetType type;
+	// Path relative to the resource directory
+	std::string rel;
+	std::string baked;
+	bool ok;
+};
+
+static std::string lower_ext(const std::string &file){
+	const size_t dot = file.rfind('.');
+	if (dot == std::string::npos){
+		return "";
+	}
+	std::string ext = file.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](char c){ return std::tolower(c); });
+	return ext;
+}
+static bool is_image(const std::string &ext){
+	static const char *exts[] = { "png", "jpg", "jpeg", "tga", "bmp", "psd", "gif", "pgm", "ppm" };
+	return std::find_if(std::begin(exts), std::end(exts), [&](const char *e){ return ext == e; })
+		!= std::end(exts);
+}
+// Recursively list the files under dir/rel, appending their paths relative to dir
+static void list_files(const std::string &dir, const std::string &rel, std::vector<std::string> &files){
+	const std::string path = rel.empty() ? dir : dir + PATH_SEP + rel;
+	auto visit = [&](const std::string &name, bool is_dir){
+		if (name == "." || name == ".."){
+			return;
+		}
+		const std::string child = rel.empty() ? name : rel + PATH_SEP + name;
+		if (is_dir){
+			list_files(dir, child, files);
+		}
+		else {
+			files.push_back(child);
+		}
+	};
+#ifdef _WIN32
+	WIN32_FIND_DATAA fd;
+	HANDLE find = FindFirstFileA((path + "\\*").c_str(), &fd);
+	if (find == INVALID_HANDLE_VALUE){
+		return;
+	}
+	do {
+		visit(fd.cFileName, (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+	} while (FindNextFileA(find, &fd));
+	FindClose(find);
+#else
+	DIR *d = opendir(path.c_str());
+	if (!d){
+		return;
+	}
+	while (dirent *e = readdir(d)){
+		struct stat st;
+		const std::string child = path + PATH_SEP + e->d_name;
+		if (stat(child.c_str(), &st) == 0){
+			visit(e->d_name, S_ISDIR(st.st_mode));
+		}
+	}
+	closedir(d);
+#endif
+}
+// Create the directories leading up to the file
+static void make_parent_dirs(const std::string &file){
+	for (size_t sep = file.find_first_of("/\\", 1); sep != std::string::npos;
+			sep = file.find_first_of("/\\", sep + 1))
+	{
+		const std::string dir = file.substr(0, sep);
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0755);
+#endif
+	}
+}
+
+// Get the absolute path of the existing file or directory so the manifest can find it from anywhere
+static std::string absolute_path(const std::string &path){
+#ifdef _WIN32
+	char *abs = _fullpath(nullptr, path.c_str(), 0);
+#else
+	char *abs = realpath(path.c_str(), nullptr);
+#endif
+	if (!abs){
+		return path;
+	}
+	const std::string s = abs;
+	std::free(abs);
+	return s;
+}
+
+int main(int argc, char **argv){
+	std::string res_dir = "res";
+	std::string out_dir, manifest;
+	size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+	bool optimize = true, compress = false;
+	VertexFormat format;
+	for (int i = 1; i < argc; ++i){
+		if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			out_dir = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc){
+			manifest = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+			threads = std::max(std::strtoul(argv[++i], nullptr, 10), 1ul);
+		}
+		else if (std::strcmp(argv[i], "-c") == 0){
+			compress = true;
+		}
+		else if (std::strcmp(argv[i], "-q") == 0){
+			format = VertexFormat(PositionFormat::UNORM16, NormalFormat::OCT8, TexcoordFormat::HALF);
+		}
+		else if (std::strcmp(argv[i], "--no-optimize") == 0){
+			optimize = false;
+		}
+		else if (argv[i][0] != '-'){
+			res_dir = argv[i];
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [-o out dir] [-m manifest] [-j threads] [-c] [-q]"
+				<< " [--no-optimize] [res dir]\n"
+				<< "\t-o: write baked files under this directory instead of next to their sources\n"
+				<< "\t-m: manifest to write, defaults to <res dir>/bake_manifest.txt\n"
+				<< "\t-c: compress 1 and 2 channel images to RGTC\n"
+				<< "\t-q: pack models in the 12 byte quantized vertex format instead of floats\n";
+			return argv[i] == std::string("-h") ? 0 : 1;
+		}
+	}
+	res_dir = absolute_path(res_dir);
+	if (!out_dir.empty()){
+		make_parent_dirs(out_dir + PATH_SEP);
+		out_dir = absolute_path(out_dir);
+	}
+	if (manifest.empty()){
+		manifest = res_dir + PATH_SEP + "bake_manifest.txt";
+	}
+
+	std::vector<std::string> files;
+	list_files(res_dir, "", files);
+	std::sort(files.begin(), files.end());
+	std::vector<Asset> assets;
+	for (const auto &f : files){
+		const std::string ext = lower_ext(f);
+		if (ext == "obj"){
+			assets.push_back(Asset{AssetType::MODEL, f, "", false});
+		}
+		else if (is_image(ext)){
+			assets.push_back(Asset{AssetType::IMAGE, f, "", false});
+		}
+	}
+	if (assets.empty()){
+		std::cout << "No models or images found under " << res_dir << "\n";
+		return 1;
+	}
+	std::cout << "Baking " << assets.size() << " file(s) under " << res_dir << " on "
+		<< threads << " thread(s), models packed as " << format << "\n";
+
+	// Workers pull the next asset off the list until it's empty
+	std::atomic<size_t> next(0);
+	std::mutex print_mutex;
+	auto worker = [&](){
+		for (size_t i = next++; i < assets.size(); i = next++){
+			Asset &a = assets[i];
+			const std::string source = res_dir + PATH_SEP + a.rel;
+			const std::string dst = out_dir.empty() ? source : out_dir + PATH_SEP + a.rel;
+			if (!out_dir.empty()){
+				make_parent_dirs(dst);
+			}
+			// Each file is baked on one thread as the pool already keeps every core busy, and
+			// its output is collected so it's printed in one piece
+			std::ostringstream log;
+			if (a.type == AssetType::MODEL){
+				a.baked = geometry_cache_path(dst, format, optimize);
+				a.ok = bake_model(source, optimize, format, a.baked, 1, log);
+			}
+			else {
+				a.baked = baked_texture_path(dst);
+				a.ok = bake_texture(source, compress, a.baked);
+			}
+			std::lock_guard<std::mutex> lock(print_mutex);
+			std::cout << log.str() << (a.ok ? "baked " : "FAILED to bake ") << a.rel << "\n";
+		}
+	};
+	using namespace std::chrono;
+	const auto start = high_resolution_clock::now();
+	std::vector<std::thread> pool;
+	for (size_t i = 0; i < std::min(threads, assets.size()); ++i){
+		pool.push_back(std::thread(worker));
+	}
+	for (auto &t : pool){
+		t.join();
+	}
+	const double secs = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+
+	std::vector<BakeEntry> entries;
+	size_t failed = 0;
+	for (const auto &a : assets){
+		if (a.ok){
+			entries.push_back(BakeEntry{res_dir + PATH_SEP + a.rel, a.baked});
+		}
+		else {
+			++failed;
+		}
+	}
+	if (!write_bake_manifest(manifest, entries)){
+		return 1;
+	}
+	std::cout << "Baked " << entries.size() << " file(s) in " << secs << "s, " << failed
+		<< " failed, wrote manifest " << manifest << "\n";
+	return failed == 0 ? 0 : 1;
+}
+